@@ -20,9 +20,25 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <ImfCompression.h>
 
 NORI_NAMESPACE_BEGIN
 
+struct BitmapLayer;
+
+/// Pixel type and compression of an OpenEXR file
+struct EXRSettings {
+    /// Store 16-bit half floats instead of 32-bit floats
+    bool half = false;
+    Imf::Compression compression = Imf::NO_COMPRESSION;
+
+    /**
+     * \brief Return the compression method with the given name: "none",
+     * "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa" or "dwab"
+     */
+    static Imf::Compression parseCompression(const std::string &name);
+};
+
 /**
  * \brief Stores a RGB high dynamic-range bitmap
  *
@@ -44,8 +60,16 @@ public:
     /// Load an OpenEXR file with the specified filename
     Bitmap(const std::string &filename);
 
-    /// Save the bitmap as an EXR file with the specified filename
-    void saveEXR(const std::string &filename);
+    /**
+     * \brief Save the bitmap as an EXR file with the specified filename
+     *
+     * The bitmap is stored in the R, G and B channels. Any \c layers
+     * (e.g. AOVs of the same render) are added to the same file. The
+     * time it took and the size of the file are reported on the console.
+     */
+    void saveEXR(const std::string &filename,
+        const std::vector<BitmapLayer> &layers = std::vector<BitmapLayer>(),
+        const EXRSettings &settings = EXRSettings());
 
     /// Save the bitmap as a PNG file (with sRGB tonemapping) with the specified filename
     void savePNG(const std::string &filename);
@@ -53,6 +77,20 @@ public:
     Color3f eval(const Point2f& uv) const;
 };
 
+/**
+ * \brief Named layer of a multi-layer OpenEXR file (see \ref Bitmap::saveEXR())
+ *
+ * Every character of \c channels names one channel of the layer, which
+ * takes the next component of the bitmap: "RGB" writes the channels
+ * "<name>.R", "<name>.G" and "<name>.B", while e.g. "Z" only writes the
+ * first component of a depth buffer to "<name>.Z".
+ */
+struct BitmapLayer {
+    std::string name;
+    const Bitmap *bitmap;
+    std::string channels;
+};
+
 /**
  * \brief Stores a RGB low dynamic-range bitmap
  *
@@ -24,7 +24,13 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
+#include <nori/bitmap.h>
 #include <tbb/mutex.h>
+#include <ImfForward.h>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <deque>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
 
@@ -43,6 +49,10 @@ NORI_NAMESPACE_BEGIN
  * this region. For that reason, this class also stores information about
  * a small border region around the rectangle, whose size depends on the
  * properties of the reconstruction filter.
+ *
+ * Optionally, a block also stores named layers of additional per-sample
+ * values (e.g. the AOVs of an integrator), which are filtered like the
+ * radiance and normalized with the same weights.
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> {
 public:
@@ -85,17 +95,58 @@ public:
     /// Convert a bitmap into an image block
     void fromBitmap(const Bitmap &bitmap);
 
+    /// Replace the additional layers by cleared ones with the given names
+    void setLayers(const std::vector<std::string> &names);
+
+    /// Return the names of the additional layers
+    const std::vector<std::string> &getLayerNames() const { return m_layerNames; }
+
+    /// Turn an additional layer into a bitmap (see \ref toBitmap())
+    Bitmap *layerToBitmap(size_t index) const;
+
+    /**
+     * \brief Save the unnormalized contents to an OpenEXR file
+     *
+     * Writes the accumulated colors along with the filter weights (R, G, B
+     * and W channels) including the border region. Additional layers are
+     * not stored. Partial renders of
+     * disjoint sets of blocks written this way can be summed and normalized
+     * afterwards, which gives the same image as rendering all blocks at once.
+     *
+     * \param outputSize
+     *     Size of the full image (stored as the display window)
+     * \param shardIndex, shardCount
+     *     Which part of the image this file contains (stored as metadata)
+     */
+    void savePartialEXR(const std::string &filename, const Vector2i &outputSize,
+        int shardIndex = 0, int shardCount = 1) const;
+
+    /**
+     * \brief Load a partial image written by \ref savePartialEXR()
+     *
+     * The offset, size and border of the returned block match the file.
+     */
+    static ImageBlock *loadPartialEXR(const std::string &filename,
+        Vector2i *outputSize = nullptr, int *shardIndex = nullptr, int *shardCount = nullptr);
+
     /// Clear all contents
-    void clear() { setConstant(Color4f()); }
+    void clear();
 
     /// Record a sample with the given position and radiance value
-    void put(const Point2f &pos, const Color3f &value);
+    void put(const Point2f &pos, const Color3f &value) { put(pos, value, nullptr); }
+
+    /**
+     * \brief Record a sample along with its values for the additional
+     * layers (one per layer, or \c nullptr to only record the radiance)
+     */
+    void put(const Point2f &pos, const Color3f &value, const Color3f *layers);
 
     /**
      * \brief Merge another image block into this one
      *
      * During the merge operation, this function locks 
-     * the destination block using a mutex.
+     * the destination block using a mutex. Both blocks
+     * must have the same additional layers.
      */
     void put(ImageBlock &b);
 
@@ -116,16 +167,67 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
+    std::vector<std::string> m_layerNames;
+    std::vector<Bitmap> m_layers;
     mutable tbb::mutex m_mutex;
 };
 
+/**
+ * \brief Unfiltered image for contributions that are splatted at arbitrary
+ * pixels, e.g. by light tracing
+ *
+ * Unlike \ref ImageBlock, all render threads can write to it at the same
+ * time: the pixels are accumulated with atomic operations, so no tile needs
+ * to be locked.
+ */
+class SplatBlock {
+public:
+    /// Create an empty image covering the given region (e.g. the crop window)
+    SplatBlock(const Point2i &offset, const Vector2i &size);
+
+    /// Clear all contents
+    void clear();
+
+    /// Add \c value to the pixel containing \c pos (thread-safe)
+    void splat(const Point2f &pos, const Color3f &value);
+
+    /// Return the accumulated value of a pixel (relative to the offset)
+    Color3f get(int x, int y) const;
+
+    /**
+     * \brief Add the splats, multiplied by \c scale, to an image block
+     *
+     * The pixels are added with the filter weight already accumulated in
+     * \c block, so that they are not affected by its normalization. Pixels
+     * without samples (weight zero) don't receive any splats.
+     */
+    void addTo(ImageBlock &block, float scale) const;
+
+    /**
+     * \brief Add the splats, multiplied by \c scale, to an image block
+     * with a filter weight of one, for images that only consist of splats
+     */
+    void putInto(ImageBlock &block, float scale) const;
+
+    /// Return the offset of the image
+    const Point2i &getOffset() const { return m_offset; }
+
+    /// Return the size of the image
+    const Vector2i &getSize() const { return m_size; }
+
+protected:
+    Point2i m_offset;
+    Vector2i m_size;
+    std::unique_ptr<std::atomic<float>[]> m_data;
+};
+
 /**
  * \brief Spiraling block generator
  *
  * This class can be used to chop up an image into many small
  * rectangular blocks suitable for parallel rendering. The blocks
  * are ordered in spiraling pattern so that the center is
- * rendered first.
+ * rendered first, or optionally in scanline order.
  */
 class BlockGenerator {
 public:
@@ -137,6 +239,33 @@ public:
      *      Maximum size of the individual blocks
      */
     BlockGenerator(const Vector2i &size, int blockSize);
+
+    /**
+     * \brief Create a block generator that only covers a region of the image
+     * \param offset
+     *      Offset of the region (e.g. a crop window) in pixels
+     * \param size
+     *      Size of the region that should be split into blocks
+     * \param blockSize
+     *      Maximum size of the individual blocks
+     */
+    BlockGenerator(const Point2i &offset, const Vector2i &size, int blockSize);
+
+    /**
+     * \brief Create a block generator that only emits a deterministic subset
+     * of the blocks, so that several processes can share the work
+     *
+     * The blocks of the region are numbered in scanline order, and block
+     * \c i is part of shard <tt>i % shardCount</tt>.
+     */
+    BlockGenerator(const Point2i &offset, const Vector2i &size, int blockSize,
+        int shardIndex, int shardCount);
+
+    /**
+     * \brief Emit the blocks row by row from the top instead of in a spiral
+     * (e.g. for an \ref ImageStream). Must be called before \ref next()
+     */
+    void setScanlineOrder();
     
     /**
      * \brief Return the next block to be rendered
@@ -152,15 +281,110 @@ public:
 protected:
     enum EDirection { ERight = 0, EDown, ELeft, EUp };
 
+    /// Move on to the next block of the spiral (or row) that lies within the image
+    void advance();
+
+    /// Check if the current block belongs to the shard
+    bool inShard() const {
+        return (m_block.x() + m_block.y() * m_numBlocks.x()) % m_shardCount == m_shardIndex;
+    }
+
     Point2i m_block;
     Vector2i m_numBlocks;
+    Point2i m_offset;
     Vector2i m_size;
     int m_blockSize;
     int m_numSteps;
     int m_blocksLeft;
     int m_stepsLeft;
     int m_direction;
+    int m_shardIndex;
+    int m_shardCount;
+    bool m_scanline = false;
+    tbb::mutex m_mutex;
+};
+
+/**
+ * \brief Writes an image to a scanline OpenEXR file while it is rendered
+ *
+ * Instead of accumulating the whole image, the rendered blocks are merged
+ * into strips of pixel rows as high as a block. Once all blocks that
+ * overlap a strip (including their filter border) are done, the strip is
+ * normalized, written and released. The file is written outside of the
+ * lock that merges the blocks, so that the other threads don't wait for
+ * the compression and the I/O. The blocks should therefore be rendered from top
+ * to bottom (see \ref BlockGenerator::setScanlineOrder()), so that only
+ * the few strips that are being rendered are kept in memory.
+ */
+class ImageStream {
+public:
+    /**
+     * \brief Create the file "<filename>.exr" for a region of the image
+     * (e.g. the crop window)
+     * \param blockOffset, blockRegion
+     *     Region that is split into blocks, which may extend beyond the
+     *     written one (e.g. to sample around a crop window)
+     * \param blockSize, borderSize
+     *     Size and border of the blocks that will be rendered
+     */
+    ImageStream(const std::string &filename, const Point2i &offset, const Vector2i &size,
+        const Point2i &blockOffset, const Vector2i &blockRegion, int blockSize, int borderSize,
+        const EXRSettings &settings = EXRSettings());
+
+    /// Release all memory
+    ~ImageStream();
+
+    /**
+     * \brief Merge a rendered block and write all strips that are complete
+     *
+     * This function is thread-safe
+     */
+    void put(const ImageBlock &block);
+
+    /// Return true when the whole image has been written
+    bool isComplete() const { return m_writtenStrips == m_stripCount; }
+
+    /// Return the maximum number of strips that were in memory at the same time
+    int getPeakStripCount() const { return m_peakStripCount; }
+
+    /// Return the size of a strip in bytes
+    size_t getStripMemory() const;
+
+protected:
+    typedef Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Strip;
+
+    /// Return true if no more blocks will be merged into a strip
+    bool isDone(int strip) const;
+
+    /// Write the finished strips in order (called without holding m_mutex)
+    void write();
+
+    /// Normalize a strip and write it to the file
+    void writeStrip(int index, const Strip &strip);
+
+    Point2i m_offset;
+    Vector2i m_size;
+    /// Offset of the first block relative to the written region
+    Point2i m_blockOffset;
+    int m_blockSize;
+    int m_borderSize;
+    int m_blocksPerRow;
+    int m_blockRowCount;
+    int m_stripCount;
+    /// Index of the next strip that will be finished
+    int m_nextStrip = 0;
+    int m_writtenStrips = 0;
+    int m_peakStripCount = 0;
+    bool m_half;
+    /// Number of merged blocks of each row of blocks
+    std::vector<int> m_blocksDone;
+    std::map<int, std::unique_ptr<Strip>> m_strips;
+    /// Strips that are finished but not written yet, in order
+    std::deque<std::pair<int, std::unique_ptr<Strip>>> m_finished;
+    std::unique_ptr<Imf::OutputFile> m_file;
     tbb::mutex m_mutex;
+    /// Serializes the writes, since scanline files must be written in order
+    tbb::mutex m_writeMutex;
 };
 
 NORI_NAMESPACE_END
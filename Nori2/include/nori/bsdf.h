@@ -23,6 +23,7 @@
 #pragma once
 
 #include <nori/object.h>
+#include <nori/texture.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -46,14 +47,29 @@ struct BSDFQueryRecord {
     /// Measure associated with the sample
     EMeasure measure;
 
+    /// Maximum number of texture values that a BSDF can cache in the record
+    static const int MaxTextures = 2;
+
+    /**
+     * Values of the BSDF textures at \c uv. They are evaluated by the first
+     * query and reused by the following ones of the same shading event
+     */
+    mutable Color3f texValues[MaxTextures];
+
+    /// BSDF that filled in \c texValues (or \c nullptr if not yet filled in)
+    mutable const BSDF *texOwner;
+
+    /// UV coordinates at which \c texValues were evaluated
+    mutable Vector2f texUV;
+
     /// Create a new record for sampling the BSDF
     BSDFQueryRecord(const Vector3f &wi, const Vector2f &uv = Vector2f() )
-        : wi(wi), eta(1.f), uv(uv), measure(EUnknownMeasure) { }
+        : wi(wi), eta(1.f), uv(uv), measure(EUnknownMeasure), texOwner(nullptr) { }
 
     /// Create a new record for querying the BSDF
     BSDFQueryRecord(const Vector3f &wi,
             const Vector3f &wo, const Vector2f& uv, EMeasure measure)
-        : wi(wi), wo(wo), uv(uv), eta(1.f), measure(measure) { }
+        : wi(wi), wo(wo), eta(1.f), uv(uv), measure(measure), texOwner(nullptr) { }
 };
 
 /**
@@ -117,6 +133,34 @@ public:
      * or not to store photons on a surface
      */
     virtual bool isDiffuse() const { return false; }
+
+    /**
+     * \brief Return whether or not this BSDF is an ideal diffuse
+     * (Lambertian) reflector, i.e. its value does not depend on the
+     * directions. Irradiance caching relies on this to reuse the
+     * irradiance of nearby points
+     */
+    virtual bool isLambertian() const { return false; }
+
+protected:
+    /**
+     * \brief Return the values of the given textures at \c bRec.uv.
+     * They are cached in the record, and evaluated again when it is
+     * queried with another BSDF or its \c uv has changed
+     */
+    template <int N>
+    const Color3f *fetchTextures(const BSDFQueryRecord &bRec,
+            const TextureBinding (&textures)[N]) const {
+        static_assert(N <= BSDFQueryRecord::MaxTextures,
+            "Too many textures to cache in a BSDFQueryRecord");
+        if (bRec.texOwner != this || bRec.texUV != bRec.uv) {
+            for (int i = 0; i < N; ++i)
+                bRec.texValues[i] = textures[i].eval(bRec.uv);
+            bRec.texOwner = this;
+            bRec.texUV = bRec.uv;
+        }
+        return bRec.texValues;
+    }
 };
 
 NORI_NAMESPACE_END
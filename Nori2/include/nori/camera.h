@@ -57,9 +57,49 @@ public:
         const Point2f &samplePosition,
         const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Sample a camera position that sees the point \c ref (used to
+     * connect light paths to the camera)
+     *
+     * \param samplePosition
+     *    Returns the position on the film in fractional pixel coordinates
+     *
+     * \param origin
+     *    Returns the sampled position on the camera
+     *
+     * \param pdf
+     *    Returns the density of \c origin with respect to solid angles at \c ref
+     *
+     * \return
+     *    The importance of the ray from \c origin towards \c ref, or zero
+     *    if the point is not visible on the film. The importance is
+     *    normalized over the whole film, i.e. a pixel receives the
+     *    contributions splatted to it divided by the number of light paths
+     *    per pixel.
+     */
+    virtual Color3f sampleImportance(const Point3f &ref, Point2f &samplePosition,
+        Point3f &origin, float &pdf) const {
+        throw NoriException("Camera::sampleImportance(): not supported by this camera!");
+    }
+
+    /**
+     * \brief Return the densities with which \ref sampleRay() generates
+     * \c ray: the density of the origin (one for pinhole cameras) and
+     * of the direction with respect to solid angles
+     */
+    virtual void pdfRay(const Ray3f &ray, float &pdfPos, float &pdfDir) const {
+        throw NoriException("Camera::pdfRay(): not supported by this camera!");
+    }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
+    /// Return the offset of the crop window (the region that is rendered) in pixels
+    const Point2i &getCropOffset() const { return m_cropOffset; }
+
+    /// Return the size of the crop window in pixels (by default the output size)
+    const Vector2i &getCropSize() const { return m_cropSize; }
+
     /// Return the camera's reconstruction filter in image space
     const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
 
@@ -70,6 +110,8 @@ public:
     EClassType getClassType() const { return ECamera; }
 protected:
     Vector2i m_outputSize;
+    Point2i m_cropOffset;
+    Vector2i m_cropSize;
     ReconstructionFilter *m_rfilter;
 };
 
@@ -121,11 +121,14 @@ class BSDF;
 class Bitmap;
 class BlockGenerator;
 class Camera;
+class Denoiser;
+struct FeatureBuffers;
 class ImageBlock;
 class Integrator;
 class KDTree;
 class Emitter;
 struct EmitterQueryRecord;
+struct LightBounds;
 class Mesh;
 class NoriObject;
 class NoriObjectFactory;
@@ -0,0 +1,82 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/object.h>
+#include <nori/bitmap.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Auxiliary per-pixel buffers ("AOVs") rendered along with the radiance
+ *
+ * The features describe the first surface seen through each pixel: the
+ * albedo of its BSDF, its shading normal and its distance to the camera.
+ * They are averaged over the camera samples of the pixel, and pixels that
+ * don't see any surface are zero. \c meshId is the index of the mesh seen
+ * by the first sample plus one (zero for none), which isn't averaged.
+ *
+ * \c variance holds the variance of the pixel estimate for each color
+ * channel, and \c sampleCount the number of samples with a valid radiance
+ * value. They can only be computed for integrators that render image
+ * blocks (and the variance with at least two samples per pixel), which is
+ * indicated by \c hasVariance and \c hasSampleCount.
+ *
+ * The buffers cover the camera's crop window.
+ */
+struct FeatureBuffers {
+    Bitmap albedo;
+    Bitmap normal;
+    /// Distance to the camera (in all three channels)
+    Bitmap depth;
+    /// Mesh index plus one (in all three channels)
+    Bitmap meshId;
+    Bitmap variance;
+    /// Number of valid samples (in all three channels)
+    Bitmap sampleCount;
+    bool hasVariance = false;
+    bool hasSampleCount = false;
+
+    /// Allocate cleared buffers of the given size
+    FeatureBuffers(const Vector2i &size);
+
+    /// Return the available buffers as layers of an OpenEXR file
+    std::vector<BitmapLayer> getLayers() const;
+};
+
+/**
+ * \brief Image-space denoising stage applied after rendering
+ *
+ * A denoiser filters the normalized radiance image with the help of the
+ * \ref FeatureBuffers, which the renderer computes whenever the scene
+ * contains a denoiser.
+ */
+class Denoiser : public NoriObject {
+public:
+    /// Return a denoised copy of \c image (both of the size of the features)
+    virtual Bitmap *denoise(const Bitmap &image, const FeatureBuffers &features) const = 0;
+
+    /**
+     * \brief Return the type of object (i.e. Mesh/Camera/etc.)
+     * provided by this instance
+     * */
+    EClassType getClassType() const { return EDenoiser; }
+};
+
+NORI_NAMESPACE_END
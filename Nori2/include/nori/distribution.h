@@ -4,10 +4,17 @@
 
 #include <nori/common.h>
 #include <nori/object.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
 
+/**
+ * \brief Piecewise-constant 1D distribution on [0, 1]
+ *
+ * Samples are drawn proportionally to the n function values \c f, which
+ * cover equally sized intervals (see PBRT, Sec. 13.3.1).
+ */
 struct Distribution1D{
 public:
 
@@ -21,6 +28,14 @@ public:
 
 };
 
+/**
+ * \brief Piecewise-constant 2D distribution on [0, 1]^2
+ *
+ * \c func holds nu x nv values in row-major order (v is the row). A sample
+ * first selects v from the marginal distribution and then u from the
+ * conditional distribution of that row. Both \ref SampleContinuous2()
+ * and \ref DiscretePdf2() return densities with respect to area on [0, 1]^2.
+ */
 struct Distribution2D{
 public:
     Distribution2D(const float* func, int nu, int nv);
@@ -195,4 +195,238 @@ private:
     bool m_normalized;
 };
 
+/**
+ * \brief Discrete probability distribution based on the alias method
+ *
+ * Provides the same interface as \ref DiscretePDF, but \ref normalize()
+ * builds an alias table (Walker, Vose) so that sampling takes constant time
+ * and touches a single table entry instead of performing a binary search
+ * over the CDF. This is preferable for large distributions, e.g. over the
+ * triangles of an emissive mesh. Note that the mapping from samples to
+ * entries is different from the one of \ref DiscretePDF (it is not
+ * monotonic).
+ *
+ * \ingroup libcore
+ */
+struct DiscreteAliasPDF {
+public:
+    /// Allocate memory for a distribution with the given number of entries
+    explicit DiscreteAliasPDF(size_t nEntries = 0) {
+        reserve(nEntries);
+        clear();
+    }
+
+    /// Clear all entries
+    void clear() {
+        m_table.clear();
+        m_sum = 0.0f;
+        m_normalized = false;
+    }
+
+    /// Reserve memory for a certain number of entries
+    void reserve(size_t nEntries) {
+        m_table.reserve(nEntries);
+    }
+
+    /// Append an entry with the specified discrete probability
+    void append(float pdfValue) {
+        m_table.push_back(Entry { 0.0f, pdfValue, (uint32_t) m_table.size() });
+        m_normalized = false;
+    }
+
+    /// Return the number of entries so far
+    size_t size() const {
+        return m_table.size();
+    }
+
+    /// Access an entry by its index
+    float operator[](size_t entry) const {
+        return m_table[entry].pdf;
+    }
+
+    /// Have the probability densities been normalized?
+    bool isNormalized() const {
+        return m_normalized;
+    }
+
+    /**
+     * \brief Return the original (unnormalized) sum of all PDF entries
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    float getSum() const {
+        return m_sum;
+    }
+
+    /**
+     * \brief Return the normalization factor (i.e. the inverse of \ref getSum())
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    float getNormalization() const {
+        return m_normalization;
+    }
+
+    /**
+     * \brief Normalize the distribution and build the alias table
+     *
+     * \return Sum of the (previously unnormalized) entries
+     */
+    float normalize() {
+        double sum = 0.0;
+        for (const Entry &entry : m_table)
+            sum += entry.pdf;
+        m_sum = (float) sum;
+        if (!(m_sum > 0)) {
+            m_normalization = 0.0f;
+            return m_sum;
+        }
+        m_normalization = 1.0f / m_sum;
+
+        /* Vose's method: scale the probabilities so that the average is
+           one, and pair every "small" entry with a "large" one that
+           donates the remainder of its bucket */
+        size_t n = m_table.size();
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        uint32_t largest = 0;
+        for (size_t i = 0; i < n; ++i) {
+            m_table[i].pdf = (float) (m_table[i].pdf / sum);
+            scaled[i] = m_table[i].pdf * (double) n;
+            m_table[i].alias = (uint32_t) i;
+            (scaled[i] < 1.0 ? small : large).push_back((uint32_t) i);
+            if (m_table[i].pdf > m_table[largest].pdf)
+                largest = (uint32_t) i;
+        }
+
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            m_table[s].threshold = (float) scaled[s];
+            m_table[s].alias = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        /* The remaining entries fill their bucket (up to roundoff), except
+           those with zero probability, which must never be chosen */
+        for (uint32_t i : large)
+            m_table[i].threshold = 1.0f;
+        for (uint32_t i : small) {
+            if (m_table[i].pdf > 0) {
+                m_table[i].threshold = 1.0f;
+            } else {
+                m_table[i].threshold = 0.0f;
+                m_table[i].alias = largest;
+            }
+        }
+
+        m_normalized = true;
+        return m_sum;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sample(float sampleValue) const {
+        return sampleReuse(sampleValue);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sample(float sampleValue, float &pdf) const {
+        return sampleReuse(sampleValue, pdf);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in, out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleReuse(float &sampleValue) const {
+        /* Select a bucket, and use the remaining precision of the sample
+           to choose between the bucket's entry and its alias */
+        float scaled = sampleValue * m_table.size();
+        size_t bucket = std::min((size_t) scaled, m_table.size() - 1);
+        float u = std::min(scaled - bucket, 1.0f);
+
+        /* A full bucket is also chosen for u = 1, which has no remainder
+           left for its alias (of zero probability) */
+        const Entry &entry = m_table[bucket];
+        if (u < entry.threshold || entry.threshold >= 1.0f) {
+            sampleValue = std::min(u / entry.threshold, 1.0f);
+            return bucket;
+        } else {
+            sampleValue = std::min((u - entry.threshold) / (1.0f - entry.threshold), 1.0f);
+            return entry.alias;
+        }
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample.
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in,out]
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    size_t sampleReuse(float &sampleValue, float &pdf) const {
+        size_t index = sampleReuse(sampleValue);
+        pdf = m_table[index].pdf;
+        return index;
+    }
+
+    /**
+     * \brief Turn the underlying distribution into a
+     * human-readable string format
+     */
+    std::string toString() const {
+        std::string result = tfm::format("DiscreteAliasPDF[sum=%f, "
+            "normalized=%f, pdf = {", m_sum, m_normalized);
+
+        for (size_t i=0; i<m_table.size(); ++i) {
+            result += std::to_string(operator[](i));
+            if (i != m_table.size()-1)
+                result += ", ";
+        }
+        return result + "}]";
+    }
+private:
+    /// A bucket of the alias table (kept together for cache locality)
+    struct Entry {
+        float threshold; ///< Probability of choosing the entry itself within its bucket
+        float pdf;       ///< Probability of the entry
+        uint32_t alias;  ///< Entry chosen otherwise
+    };
+
+    std::vector<Entry> m_table;
+    float m_sum, m_normalization = 0.0f;
+    bool m_normalized;
+};
+
 NORI_NAMESPACE_END
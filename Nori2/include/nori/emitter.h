@@ -58,6 +58,10 @@ struct EmitterQueryRecord {
     Vector3f wi;
     /// Distance between 'ref' and 'p'
     float dist;
+    /// Shading normal at 'ref' (zero if unknown), used for cosine-weighted sampling
+    Normal3f refNormal = Normal3f::Zero();
+    /// Triangle containing 'p', for emitters attached to a mesh
+    uint32_t triIndex = 0;
 
     /// Create an unitialized query record
     EmitterQueryRecord() : emitter(nullptr) { }
@@ -65,6 +69,9 @@ struct EmitterQueryRecord {
     /// Create a new query record that can be used to sample a emitter
     EmitterQueryRecord(const Point3f& ref) : ref(ref) { }
 
+    /// Create a new query record for sampling an emitter from a surface point with normal 'refNormal'
+    EmitterQueryRecord(const Point3f& ref, const Normal3f& refNormal) : ref(ref), refNormal(refNormal) { }
+
     /**
      * \brief Create a query record that can be used to query the
      * sampling density after having intersected an area emitter
@@ -127,6 +134,30 @@ public:
      */
     virtual Color3f eval(const EmitterQueryRecord &lRec) const = 0;
 
+    /**
+     * \brief Sample a photon leaving the emitter
+     *
+     * \param ray      Returns the origin and direction of the photon
+     * \param n        Returns the normal at the origin (zero for point lights)
+     * \param sample1  A uniformly distributed sample on \f$[0,1]^2\f$ (position)
+     * \param sample2  A uniformly distributed sample on \f$[0,1]^2\f$ (direction)
+     *
+     * \return The power of the photon, i.e. the emitted radiance times the
+     *         cosine divided by the density of the position and direction.
+     *         Emitters that can't emit photons (e.g. environment maps)
+     *         return zero.
+     */
+    virtual Color3f samplePhoton(Ray3f &ray, Normal3f &n, const Point2f &sample1, const Point2f &sample2) const { return Color3f(0.f); }
+
+    /**
+     * \brief Return the densities with which \ref samplePhoton() generates
+     * a photon leaving \c p (with normal \c n) in direction \c d: the
+     * density of the position wrt. area (one for point lights) and of the
+     * direction wrt. solid angles
+     */
+    virtual void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+        float &pdfPos, float &pdfDir) const { pdfPos = pdfDir = 0.f; }
+
     /**
      * \brief Virtual destructor
      * */
@@ -147,6 +178,26 @@ public:
 
 	bool isDelta() const { return m_type == EmitterType::EMITTER_POINT; }
 
+    /**
+     * \brief Bound the positions, emission directions and power of the
+     * emitter, used to build the light hierarchy of the scene
+     *
+     * \return \c false for emitters without finite bounds (e.g. environment maps)
+     * */
+    virtual bool getLightBounds(LightBounds &bounds) const { return false; }
+
+    /**
+     * \brief Append the light primitives that the scene samples in place
+     * of this emitter (by default, the emitter itself)
+     * */
+    virtual void getLightPrimitives(std::vector<const Emitter *> &primitives) const { primitives.push_back(this); }
+
+    /**
+     * \brief Return the light primitive responsible for the given triangle
+     * of the attached mesh
+     * */
+    virtual const Emitter *getPrimitive(uint32_t index) const { return this; }
+
 protected:
     /// Pointer to the mesh if the emitter is attached to a mesh
     Mesh * m_mesh = nullptr;
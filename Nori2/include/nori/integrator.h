@@ -22,6 +22,36 @@
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Outputs of a camera sample besides its radiance
+ *
+ * Integrators fill these in while they trace the path of the sample, e.g.
+ * the features of the first surface hit for a denoiser, which then don't
+ * need a ray of their own.
+ */
+struct SampleRecord {
+    /// One value for each name of \ref Integrator::getAOVNames() (or \c nullptr), zero on entry
+    Color3f *aovs = nullptr;
+
+    /// Whether the features of the first surface hit are needed
+    bool needsFeatures = false;
+
+    /// Set by an integrator that recorded the features
+    bool hasFeatures = false;
+
+    /// Mesh of the first surface hit (\c nullptr if the ray escaped)
+    const Mesh *mesh = nullptr;
+
+    /// Sampling weight of the BSDF at the first hit (zero for emitters)
+    Color3f albedo = Color3f(0.f);
+
+    /// Shading normal at the first hit
+    Normal3f normal = Normal3f(0.f);
+
+    /// Distance to the first hit
+    float depth = 0.f;
+};
+
 /**
  * \brief Abstract integrator (i.e. a rendering technique)
  *
@@ -39,6 +69,33 @@ public:
     /// Perform an (optional) preprocess step
     virtual void preprocess(const Scene *scene) { }
 
+    /**
+     * \brief Perform an (optional) postprocess step once all blocks are
+     * rendered, e.g. to add contributions that were splatted to other
+     * pixels than the one passed to \ref Li()
+     */
+    virtual void postprocess(const Scene *scene, ImageBlock &result) { }
+
+    /**
+     * \brief Render the whole image at once (optional)
+     *
+     * Techniques whose samples are not tied to a pixel (e.g. Metropolis
+     * light transport) override this to replace the block-wise rendering
+     * that calls \ref Li() for every pixel sample. The arguments are those
+     * of \ref renderScene(); \c result is already cleared.
+     *
+     * \return \c false to render the image block by block
+     */
+    virtual bool render(const Scene *scene, const Sampler *sampler, ImageBlock &result,
+        int shardIndex, int shardCount) const { return false; }
+
+    /**
+     * \brief Return true if the integrator needs the whole image at once,
+     * i.e. it overrides \ref render() or adds to other pixels than those
+     * of the current block. Such images can't be streamed to a file
+     */
+    virtual bool needsWholeImage() const { return false; }
+
     /**
      * \brief Sample the incident radiance along a ray
      *
@@ -53,6 +110,26 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Return the names of the additional outputs ("AOVs", e.g. the
+     * direct and indirect part of the radiance) that the integrator can
+     * compute along with the radiance
+     */
+    virtual std::vector<std::string> getAOVNames() const { return std::vector<std::string>(); }
+
+    /**
+     * \brief Sample the incident radiance along a ray, along with the
+     * additional outputs of the same sample
+     *
+     * \param sRec
+     *    The outputs that are needed. Integrators that don't record the
+     *    features of the first hit leave \c sRec.hasFeatures unset, and
+     *    the caller computes them separately
+     */
+    virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray, SampleRecord &sRec) const {
+        return Li(scene, sampler, ray);
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
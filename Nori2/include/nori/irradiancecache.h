@@ -0,0 +1,101 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <nori/color.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Sparse world-space cache of irradiance samples (Ward et al. 1988)
+ *
+ * Every record stores the irradiance at a point together with its
+ * translational and rotational gradients (Ward and Heckbert 1992), which
+ * are used to extrapolate the record to nearby points. Records are kept
+ * in an octree; both insertion and lookup are lock-free, so the render
+ * threads can populate the cache while they are reading from it.
+ */
+class IrradianceCache {
+public:
+    struct Record {
+        Point3f p;
+        Normal3f n;
+        Color3f E;
+        /// Harmonic mean distance to the surrounding geometry
+        float R;
+        /// Translational gradient per color channel (world space)
+        Vector3f gradT[3];
+        /// Rotational gradient per color channel (world space)
+        Vector3f gradR[3];
+    };
+
+    /**
+     * \brief Create an empty cache for a scene with the given bounds
+     *
+     * \param error
+     *    Maximum allowed error (Ward's 'a'). A record is used up to a
+     *    distance of error * R and a normal deviation of about
+     *    acos(1 - error^2)
+     */
+    IrradianceCache(const BoundingBox3f &bounds, float error);
+
+    /// Release all memory
+    ~IrradianceCache();
+
+    /**
+     * \brief Interpolate the irradiance at \c p with normal \c n from the
+     * nearby records. Returns \c false if none of them is valid there
+     */
+    bool lookup(const Point3f &p, const Normal3f &n, Color3f &E) const;
+
+    /// Add a record (can be called concurrently with itself and \ref lookup())
+    void insert(const Record &record);
+
+    /// Return the number of records
+    size_t getRecordCount() const { return m_recordCount; }
+
+private:
+    struct Entry {
+        Record record;
+        Entry *next;
+    };
+
+    struct Node {
+        std::atomic<Node *> children[8];
+        std::atomic<Entry *> entries;
+
+        Node();
+        ~Node();
+    };
+
+    void insert(Node *node, const BoundingBox3f &nodeBounds, const Record &record,
+        const BoundingBox3f &dataBounds, int depth);
+
+    static BoundingBox3f childBounds(const BoundingBox3f &bounds, int child);
+
+    BoundingBox3f m_bounds;
+    float m_error;
+    Node m_root;
+    std::atomic<size_t> m_recordCount;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,111 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounds on the position, emission directions and power of one or
+ * more emitters (see PBRT v4, Sec. 12.6.3)
+ *
+ * Light is emitted from points inside \c bounds, into directions that are
+ * within \c cosTheta_e of some direction inside the cone
+ * (\c w, \c cosTheta_o), with a total power proportional to \c phi.
+ */
+struct LightBounds {
+    BoundingBox3f bounds;
+    Vector3f w = Vector3f(0, 0, 1);
+    float phi = 0;
+    float cosTheta_o = 1;
+    float cosTheta_e = 1;
+    bool twoSided = false;
+
+    /**
+     * \brief Conservative estimate of the contribution of the emitters to
+     * a shading point \c p with normal \c n (which can be zero, e.g. for
+     * participating media)
+     */
+    float importance(const Point3f &p, const Normal3f &n) const;
+
+    /// Merge two bounds
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+};
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene
+ *
+ * Each node stores the \ref LightBounds of its subtree. An emitter is
+ * chosen for a shading point by walking down the tree and choosing each
+ * child proportionally to its importance, which takes the distance,
+ * orientation and power of the emitters into account. This makes the
+ * probability of sampling an emitter roughly proportional to its
+ * contribution, which matters a lot in scenes with many emitters.
+ *
+ * Emitters without finite bounds (environment maps) are not part of the
+ * hierarchy; they are chosen with a fixed probability instead.
+ */
+class LightBVH {
+public:
+    /// Build the hierarchy over the given emitters
+    LightBVH(const std::vector<const Emitter *> &emitters);
+
+    /**
+     * \brief Choose an emitter for the shading point \c p with normal \c n
+     *
+     * \param pmf
+     *     Probability of choosing the returned emitter
+     * \return
+     *     The chosen emitter, or \c nullptr if no emitter can contribute
+     */
+    const Emitter *sample(const Point3f &p, const Normal3f &n, float rnd, float &pmf) const;
+
+    /// Return the probability of choosing \c emitter in \ref sample()
+    float pmf(const Point3f &p, const Normal3f &n, const Emitter *emitter) const;
+
+    /// Return the number of nodes of the hierarchy
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+private:
+    struct Node {
+        LightBounds bounds;
+        uint32_t index;    ///< Second child (interior nodes) or emitter (leaves)
+        bool leaf;
+    };
+
+    /// Recursively build the subtree over emitters [start, end), returns the node index
+    uint32_t build(std::vector<std::pair<uint32_t, LightBounds>> &lights,
+        size_t start, size_t end, uint64_t bitTrail, int depth);
+
+    /// Probability of choosing an emitter from the hierarchy (rather than an infinite one)
+    float hierarchyProbability() const {
+        return m_nodes.empty() ? 0.f : 1.f / (1 + m_infinite.size());
+    }
+
+    std::vector<const Emitter *> m_emitters;
+    std::vector<const Emitter *> m_infinite;
+    std::vector<Node> m_nodes;
+    /// Path from the root to every emitter (one bit per level, 1 = second child)
+    std::unordered_map<const Emitter *, uint64_t> m_bitTrails;
+};
+
+NORI_NAMESPACE_END
@@ -50,9 +50,11 @@ struct Intersection {
     Frame geoFrame;
     /// Pointer to the associated mesh
     const Mesh *mesh;
+    /// Index of the intersected triangle within the mesh
+    n_UINT triIndex;
 
     /// Create an uninitialized intersection record
-    Intersection() : mesh(nullptr) { }
+    Intersection() : mesh(nullptr), triIndex(0) { }
 
     /// Transform a direction vector into the local shading frame
     Vector3f toLocal(const Vector3f &d) const {
@@ -96,6 +98,28 @@ public:
      */
     void samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2f &uv) const;
 
+    /**
+     * \brief Return the position, normal and uv coordinates of the point
+     * with barycentric coordinates \c bary on the given triangle
+     *
+     * The normal is interpolated from the vertex normals when available,
+     * and so are the uv coordinates (otherwise the barycentric coordinates
+     * are returned, as done for ray intersections).
+     */
+    void getSurfacePoint(n_UINT index, const Vector3f &bary, Point3f &p, Normal3f &n, Point2f &uv) const;
+
+    /**
+     * \brief Choose a triangle proportionally to its surface area
+     *
+     * \param sample
+     *     A uniformly distributed sample on [0,1], rescaled so that it can
+     *     be reused afterwards
+     */
+    n_UINT sampleTriangle(float &sample) const { return (n_UINT) m_pdf.sampleReuse(sample); }
+
+    /// Return the probability of choosing the given triangle in \ref sampleTriangle()
+    float getTriangleProbability(n_UINT index) const { return m_pdf[index]; }
+
 	/// Return the surface area of the given triangle
 	float pdf(const Point3f &p) const;
 
@@ -159,9 +183,20 @@ public:
     /// Return a pointer to an attached area emitter instance (const version)
     const Emitter *getEmitter() const { return m_emitter; }
 
+    /**
+     * \brief Return the emitter responsible for the given triangle
+     *
+     * This is the attached emitter itself, unless it has been split into
+     * per-triangle light primitives (see \ref Emitter::getPrimitive())
+     */
+    const Emitter *getEmitter(n_UINT index) const;
+
     /// Return a pointer to the BSDF associated with this mesh
     const BSDF *getBSDF() const { return m_bsdf; }
 
+    /// Replace the BSDF associated with this mesh (takes ownership)
+    void setBSDF(BSDF *bsdf);
+
     /// Register a child object (e.g. a BSDF) with the mesh
     virtual void addChild(NoriObject *child, const std::string& name = "none");
 
@@ -190,7 +225,7 @@ protected:
     BSDF         *m_bsdf = nullptr;      ///< BSDF of the surface
     Emitter      *m_emitter = nullptr;   ///< Associated emitter, if any
     BoundingBox3f m_bbox;                ///< Bounding box of the mesh
-    DiscretePDF  m_pdf;                  ///< Discrete pdf for sampling triangles uniformly wrt their area. 
+    DiscreteAliasPDF m_pdf;              ///< Discrete pdf for sampling triangles uniformly wrt their area. 
 };
 
 NORI_NAMESPACE_END
@@ -43,6 +43,7 @@ public:
         ESampler,
         ETest,
         EReconstructionFilter,
+        EDenoiser,
         EClassTypeCount
     };
 
@@ -99,6 +100,7 @@ public:
             case EIntegrator: return "integrator";
             case ESampler:    return "sampler";
             case ETest:       return "test";
+            case EDenoiser:   return "denoiser";
             default:          return "<unknown>";
         }
     }
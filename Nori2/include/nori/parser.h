@@ -19,13 +19,43 @@
 #pragma once
 
 #include <nori/object.h>
+#include <map>
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Property overrides, mapping "path.property" to a value
+ *
+ * The path consists of the tag names of the objects leading from the root
+ * of the scene file to the object in question, e.g. "camera.fov" or
+ * "mesh.bsdf.alpha". A tag name matches all objects of that kind; an
+ * index selects one of them in the order of the file, e.g. "mesh[1]".
+ * The special property "type" replaces the plugin name of an object,
+ * e.g. "integrator.type=path_mis".
+ */
+typedef std::map<std::string, std::string> PropertyOverrides;
+
 /**
  * \brief Load a scene from the specified filename and
  * return its root object
+ *
+ * The given property overrides take precedence over the values in the
+ * file. An exception is thrown when an override does not refer to any
+ * object of the scene.
+ */
+extern NoriObject *loadFromXML(const std::string &filename,
+    const PropertyOverrides &overrides = PropertyOverrides());
+
+/**
+ * \brief Instantiate only the objects of a scene file that match a path
+ *
+ * Returns the matching objects (e.g. "mesh.bsdf" selects the BSDFs of
+ * all meshes) together with their full path, e.g. "mesh[1].bsdf[0]".
+ * This allows re-creating parts of a scene without reloading its meshes.
+ * The caller takes ownership of the returned objects.
  */
-extern NoriObject *loadFromXML(const std::string &filename);
+extern std::vector<std::pair<std::string, NoriObject *>> loadObjectsFromXML(
+    const std::string &filename, const std::string &path,
+    const PropertyOverrides &overrides = PropertyOverrides());
 
 NORI_NAMESPACE_END
@@ -0,0 +1,105 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/vector.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/// A photon stored on a surface
+struct Photon {
+    Point3f p;
+    /// Direction towards the previous vertex of the photon path
+    Vector3f wi;
+    Color3f power;
+
+    Photon() { }
+    Photon(const Point3f &p, const Vector3f &wi, const Color3f &power)
+        : p(p), wi(wi), power(power) { }
+};
+
+/**
+ * \brief Photon map for fixed-radius gathers
+ *
+ * The photons are sorted into a hashed uniform grid whose cells are twice
+ * as large as the gather radius, so that a query visits 2x2x2 cells. The
+ * photons of a cell are stored contiguously, which keeps the gathers
+ * cache-friendly. After \ref build(), the map is read-only and can be
+ * queried concurrently.
+ */
+class PhotonMap {
+public:
+    PhotonMap() { }
+
+    /// Take ownership of the photons and sort them into the grid
+    void build(std::vector<Photon> &&photons, float radius);
+
+    /// Call \c f for every photon within the gather radius of \c p
+    template <typename Functor> void query(const Point3f &p, const Functor &f) const {
+        if (m_photons.empty())
+            return;
+
+        float radius2 = m_radius * m_radius;
+        Point3i base = getCell(p - Vector3f::Constant(m_radius));
+        uint32_t visited[8];
+        for (int cell = 0; cell < 8; ++cell) {
+            uint32_t bucket = hash(base + Point3i(cell & 1, (cell >> 1) & 1, cell >> 2));
+
+            /* Different cells can share a bucket, visit it only once */
+            visited[cell] = bucket;
+            if (std::find(visited, visited + cell, bucket) != visited + cell)
+                continue;
+
+            for (uint32_t i = m_bucketStart[bucket]; i < m_bucketStart[bucket + 1]; ++i) {
+                const Photon &photon = m_photons[i];
+                if ((photon.p - p).squaredNorm() <= radius2)
+                    f(photon);
+            }
+        }
+    }
+
+    /// Return the gather radius
+    float getRadius() const { return m_radius; }
+
+    /// Return the number of photons
+    size_t size() const { return m_photons.size(); }
+
+private:
+    Point3i getCell(const Point3f &p) const {
+        return Point3i((int) std::floor(p.x() * m_invCellSize),
+            (int) std::floor(p.y() * m_invCellSize), (int) std::floor(p.z() * m_invCellSize));
+    }
+
+    uint32_t hash(const Point3i &cell) const {
+        /* Teschner et al. 2003, "Optimized Spatial Hashing for Collision Detection" */
+        return ((uint32_t) cell.x() * 73856093u ^ (uint32_t) cell.y() * 19349663u
+            ^ (uint32_t) cell.z() * 83492791u) & m_bucketMask;
+    }
+
+    float m_radius = 0.f;
+    float m_invCellSize = 0.f;
+    uint32_t m_bucketMask = 0;
+    std::vector<Photon> m_photons;       ///< Photons, sorted by bucket
+    std::vector<uint32_t> m_bucketStart; ///< First photon of every bucket (plus an end marker)
+};
+
+NORI_NAMESPACE_END
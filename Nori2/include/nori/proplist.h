@@ -103,13 +103,22 @@ public:
 
     /// Get a transform property, and use a default value if it does not exist
     Transform getTransform(const std::string &name, const Transform &defaultValue) const;
+
+    /**
+     * \brief Set (or replace) a property from its textual representation
+     *
+     * The value is converted when it is first queried, so the same string
+     * can be used for boolean, integer, float, color, point, vector and
+     * string properties. This is used by the command line overrides.
+     */
+    void setUntyped(const std::string &name, const std::string &value);
 private:
     /* Custom variant data type (stores one of boolean/integer/float/...) */
     struct Property {
         enum {
             boolean_type, integer_type, float_type,
             string_type, color_type, point_type,
-            vector_type, transform_type
+            vector_type, transform_type, untyped_type
         } type;
 
         /* Visual studio lacks support for unrestricted unions (as of ver. 2013) */
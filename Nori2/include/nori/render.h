@@ -0,0 +1,103 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/block.h>
+#include <functional>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Allocate an (empty) image block that covers the camera's crop
+ * window, i.e. the part of the image that will be rendered
+ */
+extern ImageBlock *createImageBlock(const Camera *camera);
+
+/**
+ * \brief Render a scene into an image block
+ *
+ * Runs the integrator's preprocess step and then renders all image blocks
+ * within the camera's crop window in parallel on the TBB worker pool.
+ * \c result must be created by \ref createImageBlock() and is cleared
+ * before rendering starts; it can be displayed while rendering.
+ *
+ * \param sampler
+ *    Optional prototype that is cloned for every worker thread instead of
+ *    the scene's sampler. This allows a job to e.g. change the sample
+ *    count without modifying the (shared) scene.
+ *
+ * \param shardIndex, shardCount
+ *    Only render the blocks of the given shard (see \ref BlockGenerator).
+ *    The unnormalized result of every shard can be written with
+ *    \ref ImageBlock::savePartialEXR() and combined later on.
+ *
+ * \param features
+ *    Optional feature buffers of the size of the crop window, which are
+ *    computed along with the radiance (e.g. for a \ref Denoiser)
+ *
+ * When \c result has layers (see \ref ImageBlock::setLayers()), they must
+ * be named after the AOVs of the integrator, which are rendered into them.
+ */
+extern void renderScene(Scene *scene, ImageBlock &result,
+    const Sampler *sampler = nullptr, int shardIndex = 0, int shardCount = 1,
+    FeatureBuffers *features = nullptr);
+
+/**
+ * \brief Render a scene straight into "<outputName>.exr"
+ *
+ * Like \ref renderScene(), but the blocks are rendered from top to bottom
+ * and written by an \ref ImageStream as soon as they are complete, so that
+ * the whole image is never kept in memory. The integrator must not need
+ * the whole image (see \ref Integrator::needsWholeImage()).
+ */
+extern void renderSceneStreaming(Scene *scene, const std::string &outputName,
+    const EXRSettings &settings = EXRSettings(), const Sampler *sampler = nullptr);
+
+/**
+ * \brief Trace camera rays through every pixel of the crop window in
+ * parallel without accumulating an image
+ *
+ * Used by integrators that need to train or populate data structures
+ * during their preprocess step. \c sampler is cloned for every worker
+ * thread and determines the number of rays per pixel; \c trace is
+ * called concurrently with the thread's sampler and each camera ray.
+ */
+extern void traceCameraRays(const Scene *scene, const Sampler *sampler,
+    const std::function<void(Sampler *, const Ray3f &)> &trace);
+
+/**
+ * \brief Normalize the contents of an image block and write them
+ * to "<outputName>.exr" and a tonemapped "<outputName>.png"
+ *
+ * The additional layers of the block (the AOVs of the integrator) and
+ * the optional \c features are stored as layers of the OpenEXR file,
+ * which is written with the given \c settings.
+ */
+extern void saveImage(const ImageBlock &result, const std::string &outputName,
+    const FeatureBuffers *features = nullptr, const EXRSettings &settings = EXRSettings());
+
+/**
+ * \brief Normalize the contents of an image block and paste them into a
+ * bitmap at the block's offset, e.g. to update the crop window of a
+ * previous full render
+ */
+extern void compositeImage(const ImageBlock &result, Bitmap &target);
+
+NORI_NAMESPACE_END
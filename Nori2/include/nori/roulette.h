@@ -0,0 +1,105 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/proplist.h>
+#include <nori/color.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Russian roulette and splitting for the path tracers
+ *
+ * The roulette is based on the accumulated throughput of a path: from
+ * bounce \c rrDepth on, a path survives with probability
+ * max(throughput) / window, which is at most 0.95 so that every path ends
+ * (e.g. rays trapped by total internal reflection). Survivors are
+ * reweighted by the inverse probability. Paths are never extended past
+ * \c maxDepth bounces (negative means no limit).
+ *
+ * With splitting, a path that reaches a non-specular surface in one of the
+ * first \c splitDepth bounces continues as \c splitFactor independent
+ * copies, each carrying a fraction of the throughput. The weight window of
+ * the copies is reduced by the same factor, so the roulette does not kill
+ * them right away. This is the weight window of ADRRS (Vorba and Křivánek
+ * 2016) with a constant estimate of the incident radiance, as the path
+ * tracers don't keep a cache of it.
+ *
+ * The settings are read from the properties of the integrator.
+ */
+class PathRoulette {
+public:
+    PathRoulette(const PropertyList &props) {
+        /* First bounce at which the roulette is played */
+        m_rrDepth = props.getInteger("rrDepth", 3);
+        /* Maximum number of bounces (-1: unlimited) */
+        m_maxDepth = props.getInteger("maxDepth", -1);
+        /* Number of copies a split path continues with (1: no splitting) */
+        m_splitFactor = props.getInteger("splitFactor", 1);
+        /* Paths are only split in the first bounces */
+        m_splitDepth = props.getInteger("splitDepth", 1);
+
+        if (m_rrDepth < 0 || m_splitFactor < 1 || m_splitDepth < 0)
+            throw NoriException("PathRoulette: invalid roulette or splitting settings!");
+    }
+
+    /// Return whether the path can't be extended from the vertex at \c bounce
+    bool reachedMaxDepth(int bounce) const {
+        return m_maxDepth >= 0 && bounce >= m_maxDepth;
+    }
+
+    /// Return the number of copies a path continues with from a vertex at \c bounce
+    int splitCount(int bounce, bool diffuse) const {
+        return diffuse && bounce < m_splitDepth ? m_splitFactor : 1;
+    }
+
+    /**
+     * \brief Play Russian roulette after the path scattered at the vertex
+     * at \c bounce
+     *
+     * \param throughput  Throughput of the path, divided by the survival
+     *                    probability if the path survives
+     * \param window      Weight window of the path (one unless it was split)
+     * \param rnd         A uniformly distributed sample on [0, 1)
+     * \return \c false if the path is terminated
+     */
+    bool survive(int bounce, Color3f &throughput, float window, float rnd) const {
+        if (bounce < m_rrDepth)
+            return true;
+        float prob = std::min(0.95f, throughput.maxCoeff() / window);
+        if (!(rnd < prob))
+            return false;
+        throughput /= prob;
+        return true;
+    }
+
+    std::string toString() const {
+        return tfm::format("rrDepth = %i, maxDepth = %i, splitFactor = %i, splitDepth = %i",
+            m_rrDepth, m_maxDepth, m_splitFactor, m_splitDepth);
+    }
+
+protected:
+    int m_rrDepth;
+    int m_maxDepth;
+    int m_splitFactor;
+    int m_splitDepth;
+};
+
+NORI_NAMESPACE_END
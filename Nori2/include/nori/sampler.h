@@ -77,6 +77,17 @@ public:
      */
     virtual void prepare(const ImageBlock &block) = 0;
 
+    /**
+     * \brief Set the pixel whose samples are generated next
+     *
+     * This function is called before \ref generate() when the
+     * integrator starts rendering a new pixel. Samplers that
+     * correlate samples within a pixel (e.g. low-discrepancy
+     * sequences) use it to decorrelate neighboring pixels. The
+     * default implementation does nothing.
+     */
+    virtual void setPixel(const Point2i &pixel) { }
+
     /**
      * \brief Prepare to generate new samples
      * 
@@ -22,6 +22,7 @@
 #pragma once
 
 #include <nori/accel.h>
+#include <nori/lightbvh.h>
 #include <random>
 
 NORI_NAMESPACE_BEGIN
@@ -53,6 +54,9 @@ public:
     /// Return a pointer to the scene's camera
     const Camera *getCamera() const { return m_camera; }
 
+    /// Return a pointer to the scene's denoiser (\c nullptr if there is none)
+    const Denoiser *getDenoiser() const { return m_denoiser; }
+
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
 
@@ -75,6 +79,23 @@ public:
 
     float pdfEmitter(const Emitter *em) const;
 
+    /**
+     * \brief Sample an emitter for the shading point \c p with normal \c n
+     *
+     * Emitters are chosen with the light hierarchy, proportionally to an
+     * estimate of their contribution to \c p (or uniformly when the scene
+     * sets \c lightSampling to \c uniform). Returns \c nullptr when no
+     * emitter can contribute to \c p.
+     *
+     * Area emitters that are split into triangles are never returned
+     * themselves: one of their light primitives is chosen instead (see
+     * \ref Emitter::getLightPrimitives() and \ref Mesh::getEmitter(n_UINT)).
+     */
+    const Emitter *sampleEmitter(const Point3f &p, const Normal3f &n, float rnd, float &pdf) const;
+
+    /// Return the probability of choosing \c em in the shading point version of \ref sampleEmitter()
+    float pdfEmitter(const Emitter *em, const Point3f &p, const Normal3f &n) const;
+
 	/// Get enviromental emmiter
 	const Emitter *getEnvironmentalEmitter() const
 	{
@@ -135,6 +156,27 @@ public:
     /// Add a child object to the scene (meshes, integrators etc.)
     void addChild(NoriObject *obj, const std::string& name = "none");
 
+    /**
+     * \brief Return the path of the object that must be re-instantiated
+     * when the given property override (e.g. "camera.fov") changes
+     *
+     * The camera, sampler, integrator and denoiser as well as the BSDFs of meshes can
+     * be swapped without reloading the geometry (see \ref replaceChild()).
+     * An empty string is returned for all other overrides, in which case
+     * the scene has to be reloaded.
+     */
+    static std::string getReplaceablePath(const std::string &key);
+
+    /**
+     * \brief Replace the camera, sampler, integrator or the BSDF of a mesh
+     * by a new instance
+     *
+     * \param path
+     *    Path of the object as returned by \ref loadObjectsFromXML(),
+     *    e.g. "camera[0]" or "mesh[1].bsdf[0]"
+     */
+    void replaceChild(NoriObject *obj, const std::string &path);
+
     /// Return a string summary of the scene (for debugging purposes)
     std::string toString() const;
 
@@ -142,13 +184,17 @@ public:
 private:
     std::vector<Mesh *> m_meshes;
 	std::vector<Emitter *> m_emitters;
+    std::vector<const Emitter *> m_lightPrimitives;
 	Emitter *m_enviromentalEmitter = nullptr;
 
-    DiscretePDF *impSampling = nullptr;
+    DiscreteAliasPDF *impSampling = nullptr;
+    LightBVH *m_lightBVH = nullptr;
+    bool m_uniformLightSampling = false;
 	
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
     Camera *m_camera = nullptr;
+    Denoiser *m_denoiser = nullptr;
     Accel *m_accel = nullptr;
 };
 
@@ -0,0 +1,134 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <atomic>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Quadtree over the sphere of directions that learns the incident
+ * radiance at a region of the scene (see "Practical Path Guiding for
+ * Efficient Light-Transport Simulation", Müller et al. 2017)
+ *
+ * Directions are mapped to the unit square with the area preserving
+ * cylindrical mapping (cos theta, phi). Every node stores the energy
+ * recorded in each of its four quadrants. Recording uses atomics and can
+ * happen concurrently from the render threads; sampling, pdf queries and
+ * refinement must not overlap with recording.
+ */
+class DTree {
+public:
+    DTree();
+
+    /// Record the energy estimate \c value for the direction \c dir
+    void record(const Vector3f &dir, float value);
+
+    /// Sample a direction proportionally to the recorded energy
+    Vector3f sample(Point2f sample) const;
+
+    /// Return the solid angle density of \ref sample()
+    float pdf(const Vector3f &dir) const;
+
+    /// Return the total recorded energy
+    float getTotal() const;
+
+    /// Return the number of nodes
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /**
+     * \brief Rebuild the tree for the next iteration from the energy
+     * recorded in \c previous
+     *
+     * Quadrants holding more than \c threshold of the total energy are
+     * subdivided (up to \c maxDepth levels), the others are merged. The
+     * energy of the new tree is zero.
+     */
+    void refine(const DTree &previous, float threshold, int maxDepth);
+
+private:
+    struct Node {
+        std::atomic<float> sum[4];
+        uint32_t child[4];  ///< Index of the child node per quadrant, 0 for leaves
+
+        Node();
+        Node(const Node &other);
+        Node &operator=(const Node &other);
+
+        float getTotal() const;
+    };
+
+    std::vector<Node> m_nodes;
+};
+
+/**
+ * \brief Spatial binary tree over the scene whose leaves hold a pair of
+ * directional quadtrees
+ *
+ * Guiding is trained in iterations: during each one, samples are drawn
+ * from the \c sampling trees while the radiance of the paths is recorded
+ * into the \c building trees. \ref refine() then turns the building trees
+ * into the sampling trees of the next iteration.
+ */
+class SDTree {
+public:
+    struct Leaf {
+        DTree sampling;
+        DTree building;
+        /// Number of records during the current iteration
+        std::atomic<uint32_t> count;
+
+        Leaf() : count(0) { }
+    };
+
+    /// Create a tree with a single leaf that covers \c bounds
+    SDTree(const BoundingBox3f &bounds);
+
+    /// Return the leaf containing \c p
+    Leaf *lookup(const Point3f &p) const;
+
+    /**
+     * \brief Finish an iteration
+     *
+     * Leaves that received more than \c spatialThreshold records are
+     * split, then every building tree becomes a sampling tree and a new
+     * building tree is refined with the given \c directionalThreshold.
+     */
+    void refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth = 20);
+
+    /// Return the number of leaves
+    size_t getLeafCount() const { return m_leaves.size(); }
+
+private:
+    struct Node {
+        int axis;             ///< Split axis, -1 for leaves
+        uint32_t index;       ///< First child (second child = index + 1), or leaf index
+    };
+
+    void split(uint32_t nodeIndex, int depth, uint32_t spatialThreshold);
+
+    BoundingBox3f m_bounds;
+    std::vector<Node> m_nodes;
+    std::vector<std::unique_ptr<Leaf>> m_leaves;
+};
+
+NORI_NAMESPACE_END
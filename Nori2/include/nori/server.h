@@ -0,0 +1,121 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/parser.h>
+#include <tbb/task_group.h>
+#include <tbb/mutex.h>
+#include <deque>
+#include <map>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Headless render server that keeps parsed scenes resident
+ *
+ * The server reads one command per line and answers on the provided
+ * output stream. Scenes are parsed once (XML, meshes and BVH) and then
+ * reused by all subsequent jobs. Supported commands:
+ *
+ * <tt>render <scene.xml> [samples=<n>] [output=<name>] [composite=<image.exr>]
+ * [<path.property>=<value> ...]</tt>:
+ * Queue a render job. The server immediately answers <tt>queued <id></tt>
+ * and later <tt>done <id> <name>.exr <name>.png <milliseconds></tt> or
+ * <tt>failed <id> <message></tt>. Property overrides (see \ref
+ * PropertyOverrides) of the camera, sampler, integrator or mesh BSDFs
+ * re-create just these objects in the resident scene; any other override
+ * makes a separate, modified copy of the scene resident. With a crop window
+ * (camera.cropOffsetX etc.), \c composite pastes the result over a previous
+ * full render instead of writing just the cropped image.
+ *
+ * <tt>load <scene.xml></tt>: Make a scene resident ahead of time.
+ *
+ * <tt>unload <scene.xml></tt>: Release a scene once its queued jobs are done.
+ *
+ * <tt>list</tt>: List all resident scenes (one <tt>scene <scene.xml> [overrides]</tt>
+ * line each), followed by <tt>scenes <count></tt>.
+ *
+ * <tt>wait</tt>: Block until all queued jobs have finished.
+ *
+ * <tt>quit</tt>: Wait for all jobs and exit (same as the end of the input).
+ *
+ * Jobs run concurrently on the shared TBB worker pool. Jobs that refer to
+ * the same scene are executed one after the other, since the integrator
+ * preprocess step operates on state shared by all of them.
+ */
+class RenderServer {
+public:
+    /// Create a server that writes its answers to \c out
+    RenderServer(std::ostream &out) : m_out(out) { }
+
+    /// Wait for all queued jobs to finish
+    ~RenderServer() { m_jobs.wait(); }
+
+    /// Process commands until \c quit or the end of the input is reached
+    void run(std::istream &in);
+
+protected:
+    struct Job {
+        int id;
+        uint32_t sampleCount;
+        std::string outputName;
+        std::string compositeName;
+        /// Re-created objects that are swapped into the scene before rendering
+        std::vector<std::pair<std::string, NoriObject *>> replacements;
+    };
+
+    struct ResidentScene {
+        std::string filename;
+        std::unique_ptr<NoriObject> root;
+        /// Overrides used when loading the scene (they affect its geometry)
+        PropertyOverrides overrides;
+        /// Overrides of replaceable objects in effect after the last queued job
+        PropertyOverrides replaced;
+        std::deque<Job> pending;
+        bool busy = false;
+    };
+
+    /// Return the resident scene for a file, loading it if necessary
+    std::shared_ptr<ResidentScene> getScene(const std::string &filename,
+        const PropertyOverrides &overrides = PropertyOverrides());
+
+    /// Queue a job and start processing the scene's queue if it is idle
+    void submit(const std::shared_ptr<ResidentScene> &scene, const Job &job);
+
+    /// Execute the queued jobs of a scene one after the other
+    void processQueue(std::shared_ptr<ResidentScene> scene);
+
+    /// Render a single job
+    void execute(ResidentScene &scene, const Job &job);
+
+    /// Write a line to the output stream
+    void reply(const std::string &message);
+
+private:
+    std::ostream &m_out;
+    tbb::mutex m_outputMutex;
+    tbb::mutex m_queueMutex;
+    std::map<std::string, std::shared_ptr<ResidentScene>> m_scenes;
+    tbb::task_group m_jobs;
+    int m_jobCount = 0;
+};
+
+NORI_NAMESPACE_END
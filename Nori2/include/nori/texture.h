@@ -38,6 +38,12 @@ public:
      */
     virtual Color3f eval(const Point2f& uv) const = 0;
 
+    /**
+     * \brief Return whether the texture has the same value at every
+     * position. BSDFs use this on \ref activate() to skip the lookups
+     */
+    virtual bool isConstant() const { return false; }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
     * provided by this instance
@@ -58,6 +64,8 @@ public:
 
     Color3f eval(const Point2f& uv) const { return m_color; }
 
+    bool isConstant() const { return true; }
+
     virtual std::string toString() const {
         return tfm::format("%s", m_color.toString());
     }
@@ -65,5 +73,29 @@ private:
     Color3f m_color;
 };
 
+/**
+ * \brief Texture parameter of a BSDF, bound on \ref NoriObject::activate().
+ * The value of a constant texture is stored in the binding, so that
+ * evaluating it does not need a virtual call
+ */
+class TextureBinding {
+public:
+    void bind(const Texture* texture) {
+        m_texture = texture;
+        m_constant = texture->isConstant();
+        m_value = m_constant ? texture->eval(Point2f(0.f)) : Color3f(0.f);
+    }
+
+    bool isConstant() const { return m_constant; }
+
+    Color3f eval(const Point2f& uv) const {
+        return m_constant ? m_value : m_texture->eval(uv);
+    }
+private:
+    const Texture* m_texture = nullptr;
+    bool m_constant = false;
+    Color3f m_value = Color3f(0.f);
+};
+
 
 NORI_NAMESPACE_END
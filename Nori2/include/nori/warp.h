@@ -50,6 +50,12 @@ public:
     /// Probability density of \ref squareToUniformTriangle()
     static float squareToUniformTrianglePdf(const Point2f& p);
 
+    /// Sample the bilinear density on [0,1]^2 with values proportional to 'w' at the corners (0,0), (1,0), (0,1) and (1,1)
+    static Point2f squareToBilinear(const Point2f &sample, const Vector4f &w);
+
+    /// Probability density of \ref squareToBilinear()
+    static float squareToBilinearPdf(const Point2f &p, const Vector4f &w);
+
 
     /// Uniformly sample a vector on the unit sphere with respect to solid angles
     static Vector3f squareToUniformSphere(const Point2f &sample);
@@ -74,6 +80,29 @@ public:
 
     /// Probability density of \ref squareToBeckmann()
     static float squareToBeckmannPdf(const Vector3f &m, float alpha);
+
+
+    /* Batch variants of the warps above, which process 'count' samples with a
+       single call. Only the cosine pdf loop is vectorized by the compiler, the
+       others call sqrt/exp/sin/cos and stay scalar (no -fno-math-errno) */
+
+    /// Batch version of \ref squareToUniformSphere()
+    static void squareToUniformSphere(const Point2f *samples, Vector3f *dirs, size_t count);
+
+    /// Batch version of \ref squareToUniformHemisphere()
+    static void squareToUniformHemisphere(const Point2f *samples, Vector3f *dirs, size_t count);
+
+    /// Batch version of \ref squareToCosineHemisphere()
+    static void squareToCosineHemisphere(const Point2f *samples, Vector3f *dirs, size_t count);
+
+    /// Batch version of \ref squareToCosineHemispherePdf()
+    static void squareToCosineHemispherePdf(const Vector3f *dirs, float *pdfs, size_t count);
+
+    /// Batch version of \ref squareToBeckmann()
+    static void squareToBeckmann(const Point2f *samples, float alpha, Vector3f *dirs, size_t count);
+
+    /// Batch version of \ref squareToBeckmannPdf()
+    static void squareToBeckmannPdf(const Vector3f *dirs, float alpha, float *pdfs, size_t count);
 };
 
 NORI_NAMESPACE_END
@@ -0,0 +1,31 @@
+# Renders a small scene as two shards and in one piece, merges the shards
+# with mergetool and checks that the result matches the single render.
+#
+# Usage: cmake -DNORI=<nori> -DMERGETOOL=<mergetool> -DWORK_DIR=<dir> -P shards.cmake
+
+foreach (var NORI MERGETOOL WORK_DIR)
+  if (NOT DEFINED ${var})
+    message(FATAL_ERROR "${var} is not set")
+  endif()
+endforeach()
+
+# nori writes the images next to the scene, so render a copy of it
+set(SCENE_DIR ${CMAKE_CURRENT_LIST_DIR})
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(COPY ${SCENE_DIR}/cbox_shards.xml DESTINATION ${WORK_DIR})
+file(COPY ${SCENE_DIR}/../../assignment-4/cbox/meshes DESTINATION ${WORK_DIR})
+
+function(run)
+  execute_process(COMMAND ${ARGN} WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    string(REPLACE ";" " " command "${ARGN}")
+    message(FATAL_ERROR "\"${command}\" failed (${result})")
+  endif()
+endfunction()
+
+run(${NORI} -b cbox_shards.xml)
+run(${NORI} -b --shard 0/2 cbox_shards.xml)
+run(${NORI} -b --shard 1/2 cbox_shards.xml)
+run(${MERGETOOL} merged.exr cbox_shards_16_shard0-2.exr cbox_shards_16_shard1-2.exr)
+run(${MERGETOOL} --compare cbox_shards_16.exr merged.exr)
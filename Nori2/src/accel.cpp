@@ -439,6 +439,7 @@ bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) c
 					ray.maxt = its.t = t;
 					its.uv = Point2f(u, v);
 					its.mesh = mesh;
+					its.triIndex = idx;
 					f = idx;
 				}
 			}
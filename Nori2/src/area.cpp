@@ -23,15 +23,343 @@
 #include <nori/warp.h>
 #include <nori/mesh.h>
 #include <nori/texture.h>
+#include <nori/lightbvh.h>
+#include <Eigen/Geometry>
 
 NORI_NAMESPACE_BEGIN
 
+/// Triangles subtending smaller or larger solid angles are sampled by area
+static const float MinSphericalSampleArea = 3e-4f;
+static const float MaxSphericalSampleArea = 6.22f;
+
+/// Cosine of the smallest cone around 'axis' that contains all 'normals'
+static float boundNormals(const Vector3f &axis, const std::vector<Vector3f> &normals) {
+	float cosTheta = 1.f;
+	for (const Vector3f &n : normals)
+		cosTheta = std::min(cosTheta, axis.dot(n));
+	return std::max(cosTheta, -1.f);
+}
+
+/// Angle between two unit vectors, accurate for small and large angles
+static float angleBetween(const Vector3f &v1, const Vector3f &v2) {
+	if (v1.dot(v2) < 0)
+		return M_PI - 2 * std::asin(std::min((v1 + v2).norm() / 2, 1.f));
+	return 2 * std::asin(std::min((v2 - v1).norm() / 2, 1.f));
+}
+
+/// Solid angle of the spherical triangle with unit vertices a, b and c
+static float sphericalTriangleArea(const Vector3f &a, const Vector3f &b, const Vector3f &c) {
+	return std::abs(2 * std::atan2(a.dot(b.cross(c)), 1 + a.dot(b) + a.dot(c) + b.dot(c)));
+}
+
+/// Component of v orthogonal to the unit vector w, normalized
+static Vector3f orthogonalize(const Vector3f &v, const Vector3f &w) {
+	Vector3f d = v - v.dot(w) * w;
+	float length = d.norm();
+	return length > 0 ? Vector3f(d / length) : Vector3f(Vector3f::Zero());
+}
+
+// Sample a direction uniformly within the solid angle subtended by the triangle
+// (p0, p1, p2) as seen from 'ref' (Arvo 1995, as described in PBRT v4, Sec. 6.5.4).
+// Returns the barycentric coordinates of the point seen in the sampled direction.
+static bool sampleSphericalTriangle(const Point3f &p0, const Point3f &p1, const Point3f &p2,
+	const Point3f &ref, const Point2f &sample, Vector3f &bary) {
+	Vector3f a = (p0 - ref).normalized(), b = (p1 - ref).normalized(), c = (p2 - ref).normalized();
+	Vector3f n_ab = a.cross(b), n_bc = b.cross(c), n_ca = c.cross(a);
+	if (n_ab.squaredNorm() == 0 || n_bc.squaredNorm() == 0 || n_ca.squaredNorm() == 0)
+		return false;
+	n_ab.normalize();
+	n_bc.normalize();
+	n_ca.normalize();
+
+	// Interior angles of the spherical triangle
+	float alpha = angleBetween(n_ab, -n_ca);
+	float beta = angleBetween(n_bc, -n_ab);
+	float gamma = angleBetween(n_ca, -n_bc);
+
+	// Choose the area of the sub-triangle (a, b, c') and find its vertex c'
+	float Ap_pi = M_PI + sample.x() * (alpha + beta + gamma - M_PI);
+	float cosAlpha = std::cos(alpha), sinAlpha = std::sin(alpha);
+	float sinPhi = std::sin(Ap_pi) * cosAlpha - std::cos(Ap_pi) * sinAlpha;
+	float cosPhi = std::cos(Ap_pi) * cosAlpha + std::sin(Ap_pi) * sinAlpha;
+	float k1 = cosPhi + cosAlpha;
+	float k2 = sinPhi - sinAlpha * a.dot(b);
+	float cosBp = (k2 + (k2 * cosPhi - k1 * sinPhi) * cosAlpha) / ((k2 * sinPhi + k1 * cosPhi) * sinAlpha);
+	cosBp = clamp(cosBp, -1.f, 1.f);
+	float sinBp = std::sqrt(std::max(0.f, 1 - cosBp * cosBp));
+	Vector3f cp = cosBp * a + sinBp * orthogonalize(c, a);
+
+	// Choose a direction on the arc between b and c'
+	float cosTheta = 1 - sample.y() * (1 - cp.dot(b));
+	float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+	Vector3f w = cosTheta * b + sinTheta * orthogonalize(cp, b);
+
+	// Intersect the direction with the triangle
+	Vector3f e1 = p1 - p0, e2 = p2 - p0;
+	Vector3f s1 = w.cross(e2);
+	float divisor = s1.dot(e1);
+	if (divisor == 0)
+		return false;
+	Vector3f s = ref - p0;
+	float b1 = clamp(s.dot(s1) / divisor, 0.f, 1.f);
+	float b2 = clamp(w.dot(s.cross(e1)) / divisor, 0.f, 1.f);
+	if (b1 + b2 > 1) {
+		float sum = b1 + b2;
+		b1 /= sum;
+		b2 /= sum;
+	}
+	bary = Vector3f(1 - b1 - b2, b1, b2);
+	return true;
+}
+
+// Inverse of sampleSphericalTriangle(): the sample that maps to the unit direction w
+static Point2f invertSphericalTriangleSample(const Point3f &p0, const Point3f &p1, const Point3f &p2,
+	const Point3f &ref, const Vector3f &w) {
+	Vector3f a = (p0 - ref).normalized(), b = (p1 - ref).normalized(), c = (p2 - ref).normalized();
+	Vector3f n_ab = a.cross(b), n_bc = b.cross(c), n_ca = c.cross(a);
+	if (n_ab.squaredNorm() == 0 || n_bc.squaredNorm() == 0 || n_ca.squaredNorm() == 0)
+		return Point2f(0.5f, 0.5f);
+	n_ab.normalize();
+	n_bc.normalize();
+	n_ca.normalize();
+
+	float alpha = angleBetween(n_ab, -n_ca);
+	float beta = angleBetween(n_bc, -n_ab);
+	float gamma = angleBetween(n_ca, -n_bc);
+
+	// Vertex c' on the arc between a and c that lies on the great circle through b and w
+	Vector3f cp = b.cross(w).cross(c.cross(a));
+	if (cp.squaredNorm() == 0)
+		return Point2f(0.5f, 0.5f);
+	cp.normalize();
+	if (cp.dot(a + c) < 0)
+		cp = -cp;
+
+	// Area of the sub-triangle (a, b, c') relative to the whole triangle
+	float u0 = 0.f;
+	if (a.dot(cp) < 0.99999847691f) {
+		Vector3f n_cpb = cp.cross(b), n_acp = a.cross(cp);
+		if (n_cpb.squaredNorm() == 0 || n_acp.squaredNorm() == 0)
+			return Point2f(0.5f, 0.5f);
+		n_cpb.normalize();
+		n_acp.normalize();
+		float Ap = alpha + angleBetween(n_ab, n_cpb) + angleBetween(n_acp, -n_cpb) - M_PI;
+		u0 = Ap / (alpha + beta + gamma - M_PI);
+	}
+	float u1 = (1 - w.dot(b)) / (1 - cp.dot(b));
+	return Point2f(clamp(u0, 0.f, 1.f), clamp(u1, 0.f, 1.f));
+}
+
+/// Strategies for sampling a point on a triangle of an area emitter
+enum class TriangleSampling {
+	Area,               ///< Uniformly by area
+	Spherical,          ///< Uniformly in the solid angle subtended by the triangle
+	ProjectedSpherical  ///< As above, warped to approximate the cosine at the shading point
+};
+
+static TriangleSampling parseTriangleSampling(const std::string &name) {
+	if (name == "area")
+		return TriangleSampling::Area;
+	if (name == "spherical")
+		return TriangleSampling::Spherical;
+	if (name == "projected")
+		return TriangleSampling::ProjectedSpherical;
+	throw NoriException("AreaEmitter: unknown sampling strategy \"%s\"!", name);
+}
+
+static const char *triangleSamplingName(TriangleSampling strategy) {
+	switch (strategy) {
+	case TriangleSampling::Spherical: return "spherical";
+	case TriangleSampling::ProjectedSpherical: return "projected";
+	default: return "area";
+	}
+}
+
+static void getTriangleVertices(const Mesh *mesh, n_UINT index, Point3f &p0, Point3f &p1, Point3f &p2) {
+	const MatrixXf &V = mesh->getVertexPositions();
+	const MatrixXu &F = mesh->getIndices();
+	p0 = V.col(F(0, index));
+	p1 = V.col(F(1, index));
+	p2 = V.col(F(2, index));
+}
+
+// Solid angle sampling pays off for triangles that are neither tiny nor huge as seen from 'ref'
+static bool useSolidAngleSampling(TriangleSampling strategy, const Point3f &p0, const Point3f &p1,
+	const Point3f &p2, const Point3f &ref, float &solidAngle) {
+	if (strategy == TriangleSampling::Area)
+		return false;
+	solidAngle = sphericalTriangleArea((p0 - ref).normalized(), (p1 - ref).normalized(), (p2 - ref).normalized());
+	return solidAngle >= MinSphericalSampleArea && solidAngle <= MaxSphericalSampleArea;
+}
+
+// Cosines at the shading point for the corners of the spherical triangle sample domain:
+// u.y = 0 maps to p1, while (0, 1) and (1, 1) map to p0 and p2 respectively
+static bool getCosineWeights(TriangleSampling strategy, const Point3f &p0, const Point3f &p1,
+	const Point3f &p2, const EmitterQueryRecord &lRec, Vector4f &weights) {
+	if (strategy != TriangleSampling::ProjectedSpherical || lRec.refNormal == Normal3f::Zero())
+		return false;
+	float cos0 = std::max(0.01f, std::abs(lRec.refNormal.dot((p0 - lRec.ref).normalized())));
+	float cos1 = std::max(0.01f, std::abs(lRec.refNormal.dot((p1 - lRec.ref).normalized())));
+	float cos2 = std::max(0.01f, std::abs(lRec.refNormal.dot((p2 - lRec.ref).normalized())));
+	weights = Vector4f(cos1, cos1, cos0, cos2);
+	return true;
+}
+
+// Sample a point on triangle 'index' of 'mesh' as seen from lRec.ref (fills in p, n, uv, dist and wi)
+static bool sampleTriangle(TriangleSampling strategy, const Mesh *mesh, n_UINT index,
+	EmitterQueryRecord &lRec, const Point2f &sample) {
+	Point3f p0, p1, p2;
+	getTriangleVertices(mesh, index, p0, p1, p2);
+
+	Vector3f bary;
+	float solidAngle;
+	if (useSolidAngleSampling(strategy, p0, p1, p2, lRec.ref, solidAngle)) {
+		Point2f u = sample;
+		Vector4f weights;
+		if (getCosineWeights(strategy, p0, p1, p2, lRec, weights))
+			u = Warp::squareToBilinear(u, weights);
+		if (!sampleSphericalTriangle(p0, p1, p2, lRec.ref, u, bary))
+			return false;
+	}
+	else {
+		Point2f t = Warp::squareToUniformTriangle(sample);
+		bary = Vector3f(1 - t.x() - t.y(), t.x(), t.y());
+	}
+
+	mesh->getSurfacePoint(index, bary, lRec.p, lRec.n, lRec.uv);
+	lRec.triIndex = index;
+	lRec.dist = (lRec.p - lRec.ref).norm();
+	lRec.wi = (lRec.p - lRec.ref) / lRec.dist;
+	return lRec.dist > 0;
+}
+
+// Average luminance of 'radiance' over triangle 'index' of 'mesh', from a stratified grid of
+// points (a single evaluation would miss, e.g., textured emission that is dark at its center)
+static float averageLuminance(const Texture *radiance, const Mesh *mesh, n_UINT index) {
+	const MatrixXf &UV = mesh->getVertexTexCoords();
+	const MatrixXu &F = mesh->getIndices();
+	const int n = 4;
+	float sum = 0.f;
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) {
+			Point2f t = Warp::squareToUniformTriangle(Point2f((i + 0.5f) / n, (j + 0.5f) / n));
+			Point2f uv = t;
+			if (UV.size() != 0)
+				uv = (1 - t.x() - t.y()) * UV.col(F(0, index)) + t.x() * UV.col(F(1, index)) + t.y() * UV.col(F(2, index));
+			sum += radiance->eval(uv).getLuminance();
+		}
+	}
+	return sum / (n * n);
+}
+
+// Solid angle density of sampling lRec.p (on triangle 'index') as seen from lRec.ref
+static float pdfTriangle(TriangleSampling strategy, const Mesh *mesh, n_UINT index,
+	const EmitterQueryRecord &lRec) {
+	Point3f p0, p1, p2;
+	getTriangleVertices(mesh, index, p0, p1, p2);
+
+	float solidAngle;
+	if (useSolidAngleSampling(strategy, p0, p1, p2, lRec.ref, solidAngle)) {
+		float pdf = 1.f / solidAngle;
+		Vector4f weights;
+		if (getCosineWeights(strategy, p0, p1, p2, lRec, weights))
+			pdf *= Warp::squareToBilinearPdf(invertSphericalTriangleSample(p0, p1, p2, lRec.ref, lRec.wi), weights);
+		return pdf;
+	}
+
+	float cosTheta = std::abs((p1 - p0).cross(p2 - p0).normalized().dot(lRec.wi));
+	if (cosTheta == 0.f)
+		return 0.f;
+	return lRec.dist * lRec.dist / (mesh->surfaceArea(index) * cosTheta);
+}
+
+/**
+ * \brief A single triangle of an emissive mesh, used as a light of its own
+ *
+ * Created by \ref AreaEmitter when \c splitTriangles is set, so that the
+ * light hierarchy can choose among the triangles of a large emitter depending
+ * on the shading point. Points are sampled with the strategy of the parent
+ * emitter.
+ */
+class TriangleEmitter : public Emitter {
+public:
+	TriangleEmitter(const Emitter *parent, const Texture *radiance, Mesh *mesh, n_UINT index,
+		TriangleSampling strategy)
+		: m_parent(parent), m_radiance(radiance), m_index(index), m_strategy(strategy) {
+		m_type = EmitterType::EMITTER_AREA;
+		m_mesh = mesh;
+		m_area = mesh->surfaceArea(index);
+	}
+
+	virtual std::string toString() const {
+		return tfm::format("TriangleLight[index = %i]", m_index);
+	}
+
+	virtual Color3f eval(const EmitterQueryRecord & lRec) const {
+		return m_parent->eval(lRec);
+	}
+
+	virtual Color3f sample(EmitterQueryRecord & lRec, const Point2f & sample, float optional_u) const {
+		if (!sampleTriangle(m_strategy, m_mesh, m_index, lRec, sample)) {
+			lRec.pdf = 0.f;
+			return Color3f(0.f);
+		}
+		lRec.pdf = pdf(lRec);
+
+		return eval(lRec);
+	}
+
+	// Solid angle density of lRec.p as seen from lRec.ref (the point is assumed to lie on the triangle)
+	virtual float pdf(const EmitterQueryRecord &lRec) const {
+		return pdfTriangle(m_strategy, m_mesh, m_index, lRec);
+	}
+
+	virtual bool getLightBounds(LightBounds &bounds) const {
+		Point3f p0, p1, p2;
+		getTriangleVertices(m_mesh, m_index, p0, p1, p2);
+
+		Vector3f axis = (p1 - p0).cross(p2 - p0);
+		if (axis.squaredNorm() > 0)
+			axis.normalize();
+		else
+			axis = Vector3f(0, 0, 1);
+
+		std::vector<Vector3f> normals;
+		const MatrixXf &N = m_mesh->getVertexNormals();
+		if (N.size() > 0)
+			for (int i = 0; i < 3; ++i)
+				normals.push_back(Vector3f(N.col(m_mesh->getIndices()(i, m_index))).normalized());
+
+		bounds.bounds = m_mesh->getBoundingBox(m_index);
+		bounds.w = axis;
+		bounds.cosTheta_o = boundNormals(axis, normals);
+		bounds.cosTheta_e = 0.f;
+		bounds.phi = averageLuminance(m_radiance, m_mesh, m_index) * m_area * M_PI;
+		bounds.twoSided = false;
+		return true;
+	}
+
+protected:
+	const Emitter *m_parent;
+	const Texture *m_radiance;
+	n_UINT m_index;
+	float m_area;
+	TriangleSampling m_strategy;
+};
+
 class AreaEmitter : public Emitter {
 public:
 	AreaEmitter(const PropertyList &props) {
 		m_type = EmitterType::EMITTER_AREA;
 		m_radiance = new ConstantSpectrumTexture(props.getColor("radiance", Color3f(1.f)));
 		m_scale = props.getFloat("scale", 1.);
+		m_splitTriangles = props.getBoolean("splitTriangles", false);
+		m_strategy = parseTriangleSampling(props.getString("sampling", m_splitTriangles ? "spherical" : "area"));
+	}
+
+	virtual ~AreaEmitter() {
+		for (TriangleEmitter *triangle : m_triangles)
+			delete triangle;
 	}
 
 	virtual std::string toString() const {
@@ -39,8 +367,11 @@ public:
 			"AreaLight[\n"
 			"  radiance = %s,\n"
 			"  scale = %f,\n"
+			"  splitTriangles = %s,\n"
+			"  sampling = %s,\n"
 			"]",
-			m_radiance->toString(), m_scale);
+			m_radiance->toString(), m_scale, m_splitTriangles ? "true" : "false",
+			triangleSamplingName(m_strategy));
 	}
 
 	// We don't assume anything about the visibility of points specified in 'ref' and 'p' in the EmitterQueryRecord.
@@ -58,14 +389,44 @@ public:
 		if (!m_mesh)
 			throw NoriException("There is no shape attached to this Area light!");
 
-		m_mesh->samplePosition(sample, lRec.p, lRec.n, lRec.uv);
-        lRec.dist = (lRec.p - lRec.ref).norm();
-        lRec.wi = (lRec.p - lRec.ref) / lRec.dist;
+		if (m_strategy == TriangleSampling::Area) {
+			m_mesh->samplePosition(sample, lRec.p, lRec.n, lRec.uv);
+			lRec.dist = (lRec.p - lRec.ref).norm();
+			lRec.wi = (lRec.p - lRec.ref) / lRec.dist;
+		}
+		else {
+			// Choose a triangle by area, then sample it as seen from lRec.ref
+			float rnd = sample.x();
+			n_UINT index = m_mesh->sampleTriangle(rnd);
+			if (!sampleTriangle(m_strategy, m_mesh, index, lRec, Point2f(rnd, sample.y()))) {
+				lRec.pdf = 0.f;
+				return Color3f(0.f);
+			}
+		}
 		lRec.pdf = pdf(lRec);
 
 		return eval(lRec);
 	}
 
+	// Position uniform wrt. area, direction cosine-weighted around the normal:
+	// the power is the radiance times the area times pi
+	virtual Color3f samplePhoton(Ray3f &ray, Normal3f &n, const Point2f &sample1, const Point2f &sample2) const {
+		if (!m_mesh)
+			throw NoriException("There is no shape attached to this Area light!");
+
+		EmitterQueryRecord lRec;
+		m_mesh->samplePosition(sample1, lRec.p, lRec.n, lRec.uv);
+		ray = Ray3f(lRec.p, Frame(lRec.n).toWorld(Warp::squareToCosineHemisphere(sample2)));
+		n = lRec.n;
+		return m_radiance->eval(lRec.uv) * M_PI / m_mesh->pdf(lRec.p);
+	}
+
+	virtual void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+		float &pdfPos, float &pdfDir) const {
+		pdfPos = m_mesh->pdf(p);
+		pdfDir = std::max(0.f, n.dot(d)) * INV_PI;
+	}
+
 	// Returns probability with respect to solid angle given by all the information inside the emitterqueryrecord.
 	// Assumes all information about the intersection point is already provided inside.
 	// WARNING: Use with care. Malformed EmitterQueryRecords can result in undefined behavior. 
@@ -74,9 +435,67 @@ public:
 		if (!m_mesh)
 			throw NoriException("There is no shape attached to this Area light!");
 
-		return m_mesh->pdf(lRec.p) * (lRec.dist * lRec.dist) / abs(lRec.n.dot(lRec.wi));
+		if (m_strategy == TriangleSampling::Area)
+			return m_mesh->pdf(lRec.p) * (lRec.dist * lRec.dist) / abs(lRec.n.dot(lRec.wi));
+
+		// lRec.triIndex identifies the triangle containing lRec.p
+		return m_mesh->getTriangleProbability(lRec.triIndex) * pdfTriangle(m_strategy, m_mesh, lRec.triIndex, lRec);
+	}
+
+	// Bound the emitter by the mesh bounding box and a cone around its normals.
+	// Emission is one-sided, so directions reach up to 90 degrees from the normals.
+	virtual bool getLightBounds(LightBounds &bounds) const {
+		if (!m_mesh)
+			throw NoriException("There is no shape attached to this Area light!");
+
+		const MatrixXf &V = m_mesh->getVertexPositions();
+		const MatrixXf &N = m_mesh->getVertexNormals();
+		const MatrixXu &F = m_mesh->getIndices();
+
+		// Face normals and power, area weighted
+		std::vector<Vector3f> normals;
+		Vector3f axis = Vector3f::Zero();
+		float area = 0.f, power = 0.f;
+		for (n_UINT i = 0; i < m_mesh->getTriangleCount(); ++i) {
+			Vector3f p0 = V.col(F(0, i)), p1 = V.col(F(1, i)), p2 = V.col(F(2, i));
+			Vector3f n = (p1 - p0).cross(p2 - p0);
+			if (n.squaredNorm() == 0)
+				continue;
+			axis += n;
+			area += 0.5f * n.norm();
+			power += averageLuminance(m_radiance, m_mesh, i) * 0.5f * n.norm();
+			normals.push_back(n.normalized());
+		}
+		// Shading normals are used when evaluating the emitter
+		for (int i = 0; i < N.cols(); ++i)
+			normals.push_back(Vector3f(N.col(i)).normalized());
+
+		if (axis.squaredNorm() > 0)
+			axis.normalize();
+		else
+			axis = Vector3f(0, 0, 1);
+
+		bounds.bounds = m_mesh->getBoundingBox();
+		bounds.w = axis;
+		bounds.cosTheta_o = boundNormals(axis, normals);
+		bounds.cosTheta_e = 0.f;
+		bounds.phi = power * M_PI;
+		bounds.twoSided = false;
+		return true;
 	}
 
+	virtual void getLightPrimitives(std::vector<const Emitter *> &primitives) const {
+		if (m_triangles.empty())
+			primitives.push_back(this);
+		else
+			primitives.insert(primitives.end(), m_triangles.begin(), m_triangles.end());
+	}
+
+	virtual const Emitter *getPrimitive(uint32_t index) const {
+		if (m_triangles.empty())
+			return this;
+		return m_triangles[index];
+	}
 
 	// Get the parent mesh
 	void setParent(NoriObject *parent)
@@ -84,6 +503,11 @@ public:
 		auto type = parent->getClassType();
 		if (type == EMesh)
 			m_mesh = static_cast<Mesh*>(parent);
+
+		// Split the mesh into one light per triangle
+		if (m_mesh && m_splitTriangles && m_triangles.empty())
+			for (n_UINT i = 0; i < m_mesh->getTriangleCount(); ++i)
+				m_triangles.push_back(new TriangleEmitter(this, m_radiance, m_mesh, i, m_strategy));
 	}
 
 	// Set children
@@ -108,6 +532,9 @@ public:
 protected:
 	Texture* m_radiance;
 	float m_scale;
+	bool m_splitTriangles;
+	TriangleSampling m_strategy;
+	std::vector<TriangleEmitter *> m_triangles;
 };
 
 NORI_REGISTER_CLASS(AreaEmitter, "area")
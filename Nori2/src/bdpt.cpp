@@ -0,0 +1,476 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <nori/lightbvh.h>
+#include <nori/dpdf.h>
+#include <atomic>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Bidirectional path tracer (Veach 1997, following the formulation of pbrt-v3)
+ *
+ * For every camera sample, a camera subpath and a light subpath are traced
+ * and all their vertices are connected with each other. The strategies are
+ * combined with multiple importance sampling. Connections of light subpaths
+ * to the camera (light tracing) land on arbitrary pixels: they are splatted
+ * into a shared image that is added to the result after rendering.
+ *
+ * Only emitters that can emit photons (area and point lights) start light
+ * subpaths. The environment is only reached by camera subpaths.
+ */
+class BidirectionalPathTracer : public Integrator
+{
+public:
+    BidirectionalPathTracer(const PropertyList &props)
+    {
+        /* Maximum number of bounces of a path */
+        m_maxDepth = props.getInteger("maxDepth", 8);
+        /* MIS heuristic to combine the strategies: "balance" or "power" */
+        std::string heuristic = props.getString("heuristic", "balance");
+        if (heuristic == "balance")
+            m_powerHeuristic = false;
+        else if (heuristic == "power")
+            m_powerHeuristic = true;
+        else
+            throw NoriException("BidirectionalPathTracer: unknown heuristic \"%s\"!", heuristic);
+    }
+
+    virtual ~BidirectionalPathTracer()
+    {
+        delete m_splats;
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        // Light subpaths start on emitters chosen proportionally to their power
+        const std::vector<Emitter *> &lights = scene->getLights();
+        m_lightPdf.clear();
+        m_lightIndex.clear();
+        for (size_t i = 0; i < lights.size(); ++i) {
+            LightBounds bounds;
+            m_lightPdf.append(lights[i]->getLightBounds(bounds) ? bounds.phi : 0.f);
+            m_lightIndex[lights[i]] = i;
+        }
+        m_lightPdf.normalize();
+
+        const Camera *camera = scene->getCamera();
+        delete m_splats;
+        m_splats = new SplatBlock(camera->getCropOffset(), camera->getCropSize());
+        m_lightPaths = 0;
+    }
+
+    // The light paths are splatted to arbitrary pixels
+    bool needsWholeImage() const
+    {
+        return true;
+    }
+
+    void postprocess(const Scene *scene, ImageBlock &result)
+    {
+        // The camera importance is normalized over the whole film
+        size_t lightPaths = m_lightPaths;
+        if (lightPaths == 0)
+            return;
+        const Vector2i &outputSize = scene->getCamera()->getOutputSize();
+        m_splats->addTo(result, (float) outputSize.x() * outputSize.y() / lightPaths);
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        std::vector<PathVertex> cameraPath(m_maxDepth + 2), lightPath(m_maxDepth + 1);
+        Color3f L(0.f);
+
+        int nCamera = generateCameraSubpath(scene, sampler, ray, cameraPath, L);
+        int nLight = 0;
+        if (m_lightPdf.getSum() > 0) {
+            nLight = generateLightSubpath(scene, sampler, lightPath);
+            ++m_lightPaths;
+        }
+
+        for (int t = 1; t <= nCamera; ++t) {
+            for (int s = 0; s <= nLight; ++s) {
+                int depth = t + s - 2;
+                // A light vertex can't be connected directly to the camera (that is s = 0, t = 2)
+                if ((s == 1 && t == 1) || depth < 0 || depth > m_maxDepth)
+                    continue;
+
+                Point2f samplePosition;
+                Color3f value = connect(scene, sampler, lightPath, cameraPath, s, t, samplePosition);
+                if (t == 1) {
+                    if (!value.isZero())
+                        m_splats->splat(samplePosition, value);
+                }
+                else
+                    L += value;
+            }
+        }
+
+        return L;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "BidirectionalPathTracer[\n"
+            "  maxDepth = %i,\n"
+            "  heuristic = %s\n"
+            "]",
+            m_maxDepth, m_powerHeuristic ? "power" : "balance");
+    }
+
+protected:
+    enum class VertexType { Camera, Light, Surface };
+
+    struct PathVertex {
+        VertexType type = VertexType::Surface;
+        /// Throughput of the subpath up to (and excluding) this vertex
+        Color3f beta = Color3f(0.f);
+        Point3f p = Point3f(0.f);
+        /// Shading normal, zero for points that are not on a surface
+        Normal3f n = Normal3f(0.f);
+        /// Direction towards the previous vertex of the subpath (surfaces)
+        Vector3f wi = Vector3f(0.f);
+        /// Surface information (surfaces)
+        Intersection its;
+        /// Emitter of light vertices and emissive surfaces
+        const Emitter *emitter = nullptr;
+        /// Whether the vertex scattered specularly
+        bool delta = false;
+        /// Area densities of generating the vertex from its neighbours
+        float pdfFwd = 0.f, pdfRev = 0.f;
+
+        bool isOnSurface() const { return !n.isZero(); }
+        bool isDeltaLight() const { return type == VertexType::Light && emitter->isDelta(); }
+    };
+
+    /// Convert a solid angle density at 'from' into an area density at 'to'
+    static float convertDensity(float pdf, const PathVertex &from, const PathVertex &to)
+    {
+        Vector3f d = to.p - from.p;
+        float dist2 = d.squaredNorm();
+        if (dist2 == 0)
+            return 0.f;
+        if (to.isOnSurface())
+            pdf *= std::abs(to.n.dot(d)) / std::sqrt(dist2);
+        return pdf / dist2;
+    }
+
+    /// BSDF of a surface vertex for light leaving towards 'next'
+    static Color3f evalBSDF(const PathVertex &v, const PathVertex &next)
+    {
+        Vector3f wo = (next.p - v.p).normalized();
+        BSDFQueryRecord bRec(v.its.toLocal(v.wi), v.its.toLocal(wo), v.its.uv, ESolidAngle);
+        return v.its.mesh->getBSDF()->eval(bRec);
+    }
+
+    /// Radiance emitted by an emissive surface vertex towards 'to'
+    static Color3f evalEmitted(const PathVertex &v, const PathVertex &to)
+    {
+        EmitterQueryRecord emRecord(v.emitter, to.p, v.p, v.n, v.its.uv);
+        return v.emitter->eval(emRecord);
+    }
+
+    /// Probability of choosing the emitter of 'v' times the area density of its position
+    float pdfLightOrigin(const PathVertex &v) const
+    {
+        auto it = m_lightIndex.find(v.emitter);
+        if (it == m_lightIndex.end())
+            return 0.f;
+        float pdfPos, pdfDir;
+        v.emitter->pdfPhoton(v.p, v.n, Vector3f(0, 0, 1), pdfPos, pdfDir);
+        return m_lightPdf[it->second] * pdfPos;
+    }
+
+    /// Area density at 'to' of a light subpath leaving the emitter vertex 'v'
+    static float pdfLight(const PathVertex &v, const PathVertex &to)
+    {
+        float pdfPos, pdfDir;
+        v.emitter->pdfPhoton(v.p, v.n, (to.p - v.p).normalized(), pdfPos, pdfDir);
+        return convertDensity(pdfDir, v, to);
+    }
+
+    /// Area density at 'next' of sampling it from 'v', which was reached from 'prev'
+    float pdf(const Scene *scene, const PathVertex &v, const PathVertex *prev, const PathVertex &next) const
+    {
+        if (v.type == VertexType::Light)
+            return pdfLight(v, next);
+
+        Vector3f wn = (next.p - v.p).normalized();
+        float pdfDir;
+        if (v.type == VertexType::Camera) {
+            float pdfPos;
+            scene->getCamera()->pdfRay(Ray3f(v.p, wn), pdfPos, pdfDir);
+        }
+        else {
+            Vector3f wp = prev ? Vector3f((prev->p - v.p).normalized()) : v.wi;
+            BSDFQueryRecord bRec(v.its.toLocal(wp), v.its.toLocal(wn), v.its.uv, ESolidAngle);
+            pdfDir = v.its.mesh->getBSDF()->pdf(bRec);
+        }
+        return convertDensity(pdfDir, v, next);
+    }
+
+    /// Trace a subpath from 'ray', storing the surface vertices from path[start]
+    int randomWalk(const Scene *scene, Sampler *sampler, Ray3f ray, Color3f beta, float pdfDir,
+        int maxDepth, std::vector<PathVertex> &path, int start, Color3f *escaped) const
+    {
+        if (maxDepth == 0)
+            return 0;
+
+        int bounces = 0;
+        float pdfFwd = pdfDir, pdfRev = 0.f;
+        while (true) {
+            PathVertex &vertex = path[start + bounces], &prev = path[start + bounces - 1];
+            Intersection its;
+            if (!scene->rayIntersect(ray, its)) {
+                // The environment can only be reached by camera subpaths
+                if (escaped)
+                    *escaped += beta * scene->getBackground(ray);
+                break;
+            }
+
+            vertex = PathVertex();
+            vertex.type = VertexType::Surface;
+            vertex.beta = beta;
+            vertex.p = its.p;
+            vertex.n = its.shFrame.n;
+            vertex.wi = -ray.d;
+            vertex.its = its;
+            vertex.pdfFwd = convertDensity(pdfFwd, prev, vertex);
+            if (its.mesh->isEmitter())
+                vertex.emitter = its.mesh->getEmitter();
+            if (++bounces >= maxDepth)
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            BSDFQueryRecord bRec(its.toLocal(-ray.d), its.uv);
+            Color3f weight = bsdf->sample(bRec, sampler->next2D());
+            if (weight.isZero())
+                break;
+
+            if (bRec.measure == EDiscrete) {
+                vertex.delta = true;
+                pdfFwd = pdfRev = 0.f;
+            }
+            else {
+                pdfFwd = bsdf->pdf(bRec);
+                pdfRev = bsdf->pdf(BSDFQueryRecord(bRec.wo, bRec.wi, its.uv, ESolidAngle));
+            }
+            beta *= weight;
+            prev.pdfRev = convertDensity(pdfRev, vertex, prev);
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+        return bounces;
+    }
+
+    int generateCameraSubpath(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+        std::vector<PathVertex> &path, Color3f &escaped) const
+    {
+        PathVertex &camera = path[0];
+        camera = PathVertex();
+        camera.type = VertexType::Camera;
+        camera.beta = Color3f(1.f);
+        camera.p = ray.o;
+
+        float pdfPos, pdfDir;
+        scene->getCamera()->pdfRay(ray, pdfPos, pdfDir);
+        return randomWalk(scene, sampler, ray, camera.beta, pdfDir, m_maxDepth + 1, path, 1, &escaped) + 1;
+    }
+
+    int generateLightSubpath(const Scene *scene, Sampler *sampler, std::vector<PathVertex> &path) const
+    {
+        float lightPdf;
+        size_t index = m_lightPdf.sample(sampler->next1D(), lightPdf);
+        const Emitter *emitter = scene->getLights()[index];
+
+        Ray3f ray;
+        Normal3f n;
+        Point2f sample1 = sampler->next2D();
+        Point2f sample2 = sampler->next2D();
+        Color3f power = emitter->samplePhoton(ray, n, sample1, sample2);
+        float pdfPos, pdfDir;
+        emitter->pdfPhoton(ray.o, n, ray.d, pdfPos, pdfDir);
+        if (power.isZero() || pdfPos == 0 || pdfDir == 0)
+            return 0;
+
+        PathVertex &light = path[0];
+        light = PathVertex();
+        light.type = VertexType::Light;
+        light.p = ray.o;
+        light.n = n;
+        light.emitter = emitter;
+        light.pdfFwd = lightPdf * pdfPos;
+
+        Color3f beta = power / lightPdf;
+        return randomWalk(scene, sampler, ray, beta, pdfDir, m_maxDepth, path, 1, nullptr) + 1;
+    }
+
+    bool visible(const Scene *scene, const Point3f &a, const Point3f &b) const
+    {
+        Vector3f d = b - a;
+        float dist = d.norm();
+        return !scene->rayIntersect(Ray3f(a, d / dist, Epsilon, dist * (1 - Epsilon)));
+    }
+
+    /// Contribution of the path made of s light and t camera vertices, including its MIS weight
+    Color3f connect(const Scene *scene, Sampler *sampler, std::vector<PathVertex> &lightPath,
+        std::vector<PathVertex> &cameraPath, int s, int t, Point2f &samplePosition) const
+    {
+        Color3f L(0.f);
+        PathVertex sampled;
+
+        if (s == 0) {
+            // The camera subpath hit an emitter
+            const PathVertex &pt = cameraPath[t - 1];
+            if (pt.emitter)
+                L = pt.beta * evalEmitted(pt, cameraPath[t - 2]);
+        }
+        else if (t == 1) {
+            // Connect the light subpath to the camera
+            const PathVertex &qs = lightPath[s - 1];
+            if (qs.delta)
+                return Color3f(0.f);
+            Point3f origin;
+            float pdf;
+            Color3f We = scene->getCamera()->sampleImportance(qs.p, samplePosition, origin, pdf);
+            if (pdf <= 0 || We.isZero())
+                return Color3f(0.f);
+
+            sampled.type = VertexType::Camera;
+            sampled.p = origin;
+            sampled.beta = We / pdf;
+            Vector3f d = (origin - qs.p).normalized();
+            L = qs.beta * evalBSDF(qs, sampled) * sampled.beta * std::abs(qs.n.dot(d));
+            if (!L.isZero() && !visible(scene, qs.p, origin))
+                L = Color3f(0.f);
+        }
+        else if (s == 1) {
+            // Sample a point on an emitter (as in next event estimation)
+            const PathVertex &pt = cameraPath[t - 1];
+            if (pt.delta)
+                return Color3f(0.f);
+            float lightPdf;
+            size_t index = m_lightPdf.sample(sampler->next1D(), lightPdf);
+            const Emitter *emitter = scene->getLights()[index];
+
+            EmitterQueryRecord lRec(pt.p, pt.n);
+            lRec.emitter = emitter;
+            Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.);
+            if (lRec.pdf <= 0 || Le.isZero())
+                return Color3f(0.f);
+
+            sampled.type = VertexType::Light;
+            sampled.p = lRec.p;
+            sampled.n = emitter->isDelta() ? Normal3f(0.f) : lRec.n;
+            sampled.emitter = emitter;
+            sampled.beta = Le / (lightPdf * lRec.pdf);
+            sampled.pdfFwd = pdfLightOrigin(sampled);
+            L = pt.beta * evalBSDF(pt, sampled) * sampled.beta * std::abs(pt.n.dot(lRec.wi));
+            if (!L.isZero() && !visible(scene, pt.p, lRec.p))
+                L = Color3f(0.f);
+        }
+        else {
+            // Connect two surface vertices
+            const PathVertex &qs = lightPath[s - 1], &pt = cameraPath[t - 1];
+            if (qs.delta || pt.delta)
+                return Color3f(0.f);
+            Vector3f d = pt.p - qs.p;
+            float dist2 = d.squaredNorm();
+            d /= std::sqrt(dist2);
+            float G = std::abs(qs.n.dot(d)) * std::abs(pt.n.dot(d)) / dist2;
+            L = qs.beta * evalBSDF(qs, pt) * evalBSDF(pt, qs) * pt.beta * G;
+            if (!L.isZero() && !visible(scene, qs.p, pt.p))
+                L = Color3f(0.f);
+        }
+
+        if (L.isZero())
+            return L;
+        return L * misWeight(scene, lightPath, cameraPath, sampled, s, t);
+    }
+
+    float misRatio(float pdfRev, float pdfFwd) const
+    {
+        // Deltas are skipped by the caller, zero densities count as one
+        float ratio = (pdfRev != 0 ? pdfRev : 1.f) / (pdfFwd != 0 ? pdfFwd : 1.f);
+        return m_powerHeuristic ? ratio * ratio : ratio;
+    }
+
+    /**
+     * MIS weight of the strategy (s, t) among all strategies that generate
+     * the same path, computed from the ratios of their densities
+     */
+    float misWeight(const Scene *scene, std::vector<PathVertex> &lightPath,
+        std::vector<PathVertex> &cameraPath, const PathVertex &sampled, int s, int t) const
+    {
+        if (s + t == 2)
+            return 1.f;
+
+        // The densities of the vertices next to the connection change, remember them
+        PathVertex *qs = s > 0 ? &lightPath[s - 1] : nullptr;
+        PathVertex *pt = t > 0 ? &cameraPath[t - 1] : nullptr;
+        PathVertex *qsMinus = s > 1 ? &lightPath[s - 2] : nullptr;
+        PathVertex *ptMinus = t > 1 ? &cameraPath[t - 2] : nullptr;
+        PathVertex savedQs, savedPt, savedQsMinus, savedPtMinus;
+        if (qs) savedQs = *qs;
+        if (pt) savedPt = *pt;
+        if (qsMinus) savedQsMinus = *qsMinus;
+        if (ptMinus) savedPtMinus = *ptMinus;
+
+        // Vertices created by the connection replace the last vertex of the subpath
+        if (s == 1)
+            *qs = sampled;
+        else if (t == 1)
+            *pt = sampled;
+
+        // Vertices at the connection can't be specular
+        pt->delta = false;
+        if (qs)
+            qs->delta = false;
+
+        pt->pdfRev = s > 0 ? pdf(scene, *qs, qsMinus, *pt) : pdfLightOrigin(*pt);
+        if (ptMinus)
+            ptMinus->pdfRev = s > 0 ? pdf(scene, *pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+        if (qs)
+            qs->pdfRev = pdf(scene, *pt, ptMinus, *qs);
+        if (qsMinus)
+            qsMinus->pdfRev = pdf(scene, *qs, pt, *qsMinus);
+
+        float sumRi = 0.f;
+        float ri = 1.f;
+        for (int i = t - 1; i > 0; --i) {
+            ri *= misRatio(cameraPath[i].pdfRev, cameraPath[i].pdfFwd);
+            if (!cameraPath[i].delta && !cameraPath[i - 1].delta)
+                sumRi += ri;
+        }
+        ri = 1.f;
+        for (int i = s - 1; i >= 0; --i) {
+            ri *= misRatio(lightPath[i].pdfRev, lightPath[i].pdfFwd);
+            bool deltaLight = i > 0 ? lightPath[i - 1].delta : lightPath[0].isDeltaLight();
+            if (!lightPath[i].delta && !deltaLight)
+                sumRi += ri;
+        }
+
+        if (qs) *qs = savedQs;
+        if (pt) *pt = savedPt;
+        if (qsMinus) *qsMinus = savedQsMinus;
+        if (ptMinus) *ptMinus = savedPtMinus;
+
+        return 1.f / (1.f + sumRi);
+    }
+
+    int m_maxDepth;
+    bool m_powerHeuristic;
+    DiscretePDF m_lightPdf;
+    std::unordered_map<const Emitter *, size_t> m_lightIndex;
+    SplatBlock *m_splats = nullptr;
+    mutable std::atomic<size_t> m_lightPaths;
+};
+NORI_REGISTER_CLASS(BidirectionalPathTracer, "bdpt");
+NORI_NAMESPACE_END
@@ -20,12 +20,15 @@
 */
 
 #include <nori/bitmap.h>
+#include <nori/timer.h>
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
 #include <ImfChannelList.h>
 #include <ImfStringAttribute.h>
 #include <ImfVersion.h>
 #include <ImfIO.h>
+#include <half.h>
+#include <filesystem/path.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image.h>
@@ -83,38 +86,74 @@ Bitmap::Bitmap(const std::string &filename) {
     file.readPixels(dw.min.y, dw.max.y);
 }
 
-void Bitmap::saveEXR(const std::string &filename) {
-    cout << "Writing a " << cols() << "x" << rows()
-         << " OpenEXR file to \"" << filename << "\"" << endl;
+void Bitmap::saveEXR(const std::string &filename, const std::vector<BitmapLayer> &layers,
+        const EXRSettings &settings) {
+    cout << "Writing a " << cols() << "x" << rows() << " OpenEXR file ";
+    if (!layers.empty())
+        cout << "with " << layers.size() << " additional layers ";
+    cout << "to \"" << filename << "\" .. ";
+    cout.flush();
+    Timer timer;
 
     std::string path = filename + ".exr";
 
     Imf::Header header((int) cols(), (int) rows());
     header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.compression() = settings.compression;
 
     Imf::ChannelList &channels = header.channels();
-    channels.insert("R", Imf::Channel(Imf::FLOAT));
-    channels.insert("G", Imf::Channel(Imf::FLOAT));
-    channels.insert("B", Imf::Channel(Imf::FLOAT));
-
     Imf::FrameBuffer frameBuffer;
-    size_t compStride = sizeof(float),
-           pixelStride = 3 * compStride,
-           rowStride = pixelStride * cols();
+    Imf::PixelType type = settings.half ? Imf::HALF : Imf::FLOAT;
+
+    /* OpenEXR doesn't convert the pixel type when writing, so every
+       bitmap is copied to half floats if necessary */
+    std::vector<std::vector<half>> halves;
+    halves.reserve(layers.size() + 1);
+
+    auto insert = [&](const Bitmap &bitmap, const std::string &prefix, const std::string &names) {
+        char *ptr = const_cast<char *>(reinterpret_cast<const char *>(bitmap.data()));
+        size_t compStride = sizeof(float);
+        if (settings.half) {
+            const float *values = bitmap.data()->data();
+            halves.emplace_back(values, values + 3 * bitmap.size());
+            ptr = reinterpret_cast<char *>(halves.back().data());
+            compStride = sizeof(half);
+        }
 
-    char *ptr = reinterpret_cast<char *>(data());
-    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
-    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
-    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+        size_t pixelStride = 3 * compStride,
+               rowStride = pixelStride * bitmap.cols();
+        for (char c : names) {
+            std::string name = prefix + c;
+            channels.insert(name, Imf::Channel(type));
+            frameBuffer.insert(name, Imf::Slice(type, ptr, pixelStride, rowStride));
+            ptr += compStride;
+        }
+    };
+
+    insert(*this, "", "RGB");
+    for (const BitmapLayer &layer : layers) {
+        if (layer.bitmap->cols() != cols() || layer.bitmap->rows() != rows())
+            throw NoriException("Bitmap::saveEXR(): layer \"%s\" has a different size!", layer.name);
+        if (layer.channels.empty() || layer.channels.size() > 3)
+            throw NoriException("Bitmap::saveEXR(): layer \"%s\" must have 1 to 3 channels!", layer.name);
+        insert(*layer.bitmap, layer.name + ".", layer.channels);
+    }
 
-    Imf::OutputFile file(path.c_str(), header);
-    file.setFrameBuffer(frameBuffer);
-    file.writePixels((int) rows());
+    {
+        Imf::OutputFile file(path.c_str(), header);
+        file.setFrameBuffer(frameBuffer);
+        file.writePixels((int) rows());
+    }
+
+    cout << "done. (took " << timer.elapsedString() << ", "
+         << memString(filesystem::path(path).file_size()) << ")" << endl;
 }
 
 void Bitmap::savePNG(const std::string &filename) {
     cout << "Writing a " << cols() << "x" << rows()
-         << " PNG file to \"" << filename << "\"" << endl;
+         << " PNG file to \"" << filename << "\" .. ";
+    cout.flush();
+    Timer timer;
 
     std::string path = filename + ".png";
 
@@ -132,11 +171,24 @@ void Bitmap::savePNG(const std::string &filename) {
     int ret = stbi_write_png(path.c_str(), (int) cols(), (int) rows(), 3, rgb8, 3 * (int) cols());
     if (ret == 0) {
         cout << "Bitmap::savePNG(): Could not save PNG file \"" << path << "%s\"" << endl;
+    } else {
+        cout << "done. (took " << timer.elapsedString() << ", "
+             << memString(filesystem::path(path).file_size()) << ")" << endl;
     }
 
     delete[] rgb8;
 }
 
+Imf::Compression EXRSettings::parseCompression(const std::string &name) {
+    static const char *names[] = { "none", "rle", "zips", "zip", "piz",
+        "pxr24", "b44", "b44a", "dwaa", "dwab" };
+    for (int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); ++i) {
+        if (toLower(name) == names[i])
+            return (Imf::Compression) i;
+    }
+    throw NoriException("Unknown OpenEXR compression \"%s\"!", name);
+}
+
 Color3f Bitmap::eval(const Point2f& uv) const
 {
     float x = (1.f - uv[0]) * cols();;
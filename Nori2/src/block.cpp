@@ -21,6 +21,13 @@
 #include <nori/rfilter.h>
 #include <nori/bbox.h>
 #include <tbb/tbb.h>
+#include <ImfInputFile.h>
+#include <ImfOutputFile.h>
+#include <ImfFrameBuffer.h>
+#include <half.h>
+#include <ImfChannelList.h>
+#include <ImfIntAttribute.h>
+#include <ImfStringAttribute.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -62,6 +69,32 @@ Bitmap *ImageBlock::toBitmap() const {
     return result;
 }
 
+void ImageBlock::setLayers(const std::vector<std::string> &names) {
+    m_layerNames = names;
+    m_layers.assign(names.size(), Bitmap(Vector2i((int) cols(), (int) rows())));
+    for (Bitmap &layer : m_layers)
+        layer.setConstant(Color3f(0.f));
+}
+
+Bitmap *ImageBlock::layerToBitmap(size_t index) const {
+    const Bitmap &layer = m_layers.at(index);
+    Bitmap *result = new Bitmap(m_size);
+    for (int y=0; y<m_size.y(); ++y) {
+        for (int x=0; x<m_size.x(); ++x) {
+            float weight = coeff(y + m_borderSize, x + m_borderSize).w();
+            result->coeffRef(y, x) = weight != 0 ? Color3f(layer.coeff(y + m_borderSize, x + m_borderSize) / weight)
+                                                 : Color3f(0.f);
+        }
+    }
+    return result;
+}
+
+void ImageBlock::clear() {
+    setConstant(Color4f());
+    for (Bitmap &layer : m_layers)
+        layer.setConstant(Color3f(0.f));
+}
+
 void ImageBlock::fromBitmap(const Bitmap &bitmap) {
     if (bitmap.cols() != cols() || bitmap.rows() != rows())
         throw NoriException("Invalid bitmap dimensions!");
@@ -71,12 +104,110 @@ void ImageBlock::fromBitmap(const Bitmap &bitmap) {
             coeffRef(y, x) << bitmap.coeff(y, x), 1;
 }
 
-void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
+void ImageBlock::savePartialEXR(const std::string &filename, const Vector2i &outputSize,
+        int shardIndex, int shardCount) const {
+    cout << "Writing a " << m_size.x() << "x" << m_size.y()
+         << " partial OpenEXR file to \"" << filename << "\"" << endl;
+
+    std::string path = filename + ".exr";
+
+    /* The data window contains the block and its border, positioned
+       within the display window of the full image */
+    Imath::Box2i displayWindow(Imath::V2i(0, 0),
+        Imath::V2i(outputSize.x() - 1, outputSize.y() - 1));
+    Imath::Box2i dataWindow(
+        Imath::V2i(m_offset.x() - m_borderSize, m_offset.y() - m_borderSize),
+        Imath::V2i(m_offset.x() + m_size.x() + m_borderSize - 1,
+                   m_offset.y() + m_size.y() + m_borderSize - 1));
+
+    Imf::Header header(displayWindow, dataWindow);
+    header.insert("comments", Imf::StringAttribute("Generated by Nori (partial image)"));
+    header.insert("nori.borderSize", Imf::IntAttribute(m_borderSize));
+    header.insert("nori.shardIndex", Imf::IntAttribute(shardIndex));
+    header.insert("nori.shardCount", Imf::IntAttribute(shardCount));
+
+    Imf::ChannelList &channels = header.channels();
+    channels.insert("R", Imf::Channel(Imf::FLOAT));
+    channels.insert("G", Imf::Channel(Imf::FLOAT));
+    channels.insert("B", Imf::Channel(Imf::FLOAT));
+    channels.insert("W", Imf::Channel(Imf::FLOAT));
+
+    Imf::FrameBuffer frameBuffer;
+    size_t compStride = sizeof(float),
+           pixelStride = 4 * compStride,
+           rowStride = pixelStride * cols();
+
+    char *ptr = const_cast<char *>(reinterpret_cast<const char *>(data()))
+        - dataWindow.min.x * pixelStride - dataWindow.min.y * rowStride;
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("W", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+
+    Imf::OutputFile file(path.c_str(), header);
+    file.setFrameBuffer(frameBuffer);
+    file.writePixels((int) rows());
+}
+
+ImageBlock *ImageBlock::loadPartialEXR(const std::string &filename,
+        Vector2i *outputSize, int *shardIndex, int *shardCount) {
+    Imf::InputFile file(filename.c_str());
+    const Imf::Header &header = file.header();
+
+    const Imf::IntAttribute *borderSize = header.findTypedAttribute<Imf::IntAttribute>("nori.borderSize");
+    const Imf::IntAttribute *index = header.findTypedAttribute<Imf::IntAttribute>("nori.shardIndex");
+    const Imf::IntAttribute *count = header.findTypedAttribute<Imf::IntAttribute>("nori.shardCount");
+    if (!borderSize || !index || !count || !header.channels().findChannel("W"))
+        throw NoriException("\"%s\" is not a partial image written by Nori!", filename);
+
+    Imath::Box2i dw = header.dataWindow(), disp = header.displayWindow();
+    int border = borderSize->value();
+    Vector2i size(dw.max.x - dw.min.x + 1 - 2 * border, dw.max.y - dw.min.y + 1 - 2 * border);
+
+    ImageBlock *block = new ImageBlock(size, nullptr);
+    block->m_borderSize = border;
+    block->resize(size.y() + 2 * border, size.x() + 2 * border);
+    block->setOffset(Point2i(dw.min.x + border, dw.min.y + border));
+    block->clear();
+
+    size_t compStride = sizeof(float),
+           pixelStride = 4 * compStride,
+           rowStride = pixelStride * block->cols();
+
+    char *ptr = reinterpret_cast<char *>(block->data())
+        - dw.min.x * pixelStride - dw.min.y * rowStride;
+    Imf::FrameBuffer frameBuffer;
+    frameBuffer.insert("R", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("W", Imf::Slice(Imf::FLOAT, ptr, pixelStride, rowStride));
+    file.setFrameBuffer(frameBuffer);
+    file.readPixels(dw.min.y, dw.max.y);
+
+    if (outputSize)
+        *outputSize = Vector2i(disp.max.x - disp.min.x + 1, disp.max.y - disp.min.y + 1);
+    if (shardIndex)
+        *shardIndex = index->value();
+    if (shardCount)
+        *shardCount = count->value();
+    return block;
+}
+
+void ImageBlock::put(const Point2f &_pos, const Color3f &value, const Color3f *layers) {
     if (!value.isValid()) {
         /* If this happens, go fix your code instead of removing this warning ;) */
         cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
         return;
     }
+    if (layers) {
+        for (size_t i = 0; i < m_layers.size(); ++i) {
+            if (!layers[i].isValid()) {
+                cerr << "Integrator: computed an invalid \"" << m_layerNames[i]
+                     << "\" value: " << layers[i].toString() << endl;
+                return;
+            }
+        }
+    }
 
     /* Convert to pixel coordinates within the image block */
     Point2f pos(
@@ -100,17 +231,103 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value) {
     for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr) 
         for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr) 
             coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
+
+    if (!layers)
+        return;
+    for (size_t i = 0; i < m_layers.size(); ++i) {
+        Bitmap &layer = m_layers[i];
+        for (int y=bbox.min.y(), yr=0; y<=bbox.max.y(); ++y, ++yr)
+            for (int x=bbox.min.x(), xr=0; x<=bbox.max.x(); ++x, ++xr)
+                layer.coeffRef(y, x) += layers[i] * m_weightsX[xr] * m_weightsY[yr];
+    }
 }
     
+SplatBlock::SplatBlock(const Point2i &offset, const Vector2i &size)
+        : m_offset(offset), m_size(size), m_data(new std::atomic<float>[3 * size.x() * size.y()]) {
+    clear();
+}
+
+void SplatBlock::clear() {
+    for (int i = 0; i < 3 * m_size.x() * m_size.y(); ++i)
+        m_data[i] = 0.f;
+}
+
+void SplatBlock::splat(const Point2f &pos, const Color3f &value) {
+    if (!value.isValid()) {
+        cerr << "Integrator: splatted an invalid radiance value: " << value.toString() << endl;
+        return;
+    }
+
+    int x = (int) std::floor(pos.x()) - m_offset.x(), y = (int) std::floor(pos.y()) - m_offset.y();
+    if (x < 0 || y < 0 || x >= m_size.x() || y >= m_size.y())
+        return;
+
+    std::atomic<float> *pixel = &m_data[3 * (y * m_size.x() + x)];
+    for (int i = 0; i < 3; ++i) {
+        float current = pixel[i].load();
+        while (!pixel[i].compare_exchange_weak(current, current + value[i]))
+            ;
+    }
+}
+
+Color3f SplatBlock::get(int x, int y) const {
+    const std::atomic<float> *pixel = &m_data[3 * (y * m_size.x() + x)];
+    return Color3f(pixel[0].load(), pixel[1].load(), pixel[2].load());
+}
+
+void SplatBlock::addTo(ImageBlock &block, float scale) const {
+    int border = block.getBorderSize();
+    Vector2i offset = m_offset - block.getOffset();
+    for (int y = 0; y < m_size.y(); ++y) {
+        for (int x = 0; x < m_size.x(); ++x) {
+            int bx = x + offset.x(), by = y + offset.y();
+            if (bx < 0 || by < 0 || bx >= block.getSize().x() || by >= block.getSize().y())
+                continue;
+            Color4f &pixel = block.coeffRef(by + border, bx + border);
+            Color3f value = get(x, y) * scale * pixel.w();
+            pixel += Color4f(value.r(), value.g(), value.b(), 0.f);
+        }
+    }
+}
+
+void SplatBlock::putInto(ImageBlock &block, float scale) const {
+    int border = block.getBorderSize();
+    Vector2i offset = m_offset - block.getOffset();
+    for (int y = 0; y < m_size.y(); ++y) {
+        for (int x = 0; x < m_size.x(); ++x) {
+            int bx = x + offset.x(), by = y + offset.y();
+            if (bx < 0 || by < 0 || bx >= block.getSize().x() || by >= block.getSize().y())
+                continue;
+            Color3f value = get(x, y) * scale;
+            block.coeffRef(by + border, bx + border) += Color4f(value.r(), value.g(), value.b(), 1.f);
+        }
+    }
+}
+
 void ImageBlock::put(ImageBlock &b) {
-    Vector2i offset = b.getOffset() - m_offset +
-        Vector2i::Constant(m_borderSize - b.getBorderSize());
-    Vector2i size   = b.getSize()   + Vector2i(2*b.getBorderSize());
+    if (b.m_layerNames != m_layerNames)
+        throw NoriException("ImageBlock::put(): the blocks have different layers!");
+
+    /* Only merge the part of the other block (including the borders of
+       both) that overlaps this one, e.g. when samples are taken around
+       a crop window */
+    Point2i src = b.getOffset() - Vector2i::Constant(b.getBorderSize());
+    Point2i dst = m_offset - Vector2i::Constant(m_borderSize);
+    Point2i min = src.cwiseMax(dst);
+    Point2i max = (src + b.getSize() + Vector2i(2*b.getBorderSize())).cwiseMin(
+        dst + m_size + Vector2i(2*m_borderSize));
+    Vector2i size = max - min;
+    if ((size.array() <= 0).any())
+        return;
+    Vector2i from = min - src, to = min - dst;
 
     tbb::mutex::scoped_lock lock(m_mutex);
 
-    block(offset.y(), offset.x(), size.y(), size.x()) 
-        += b.topLeftCorner(size.y(), size.x());
+    block(to.y(), to.x(), size.y(), size.x()) 
+        += b.block(from.y(), from.x(), size.y(), size.x());
+    for (size_t i = 0; i < m_layers.size(); ++i)
+        m_layers[i].block(to.y(), to.x(), size.y(), size.x())
+            += b.m_layers[i].block(from.y(), from.x(), size.y(), size.x());
 }
 
 std::string ImageBlock::toString() const {
@@ -119,30 +336,63 @@ std::string ImageBlock::toString() const {
 }
 
 BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-        : m_size(size), m_blockSize(blockSize) {
+        : BlockGenerator(Point2i(0, 0), size, blockSize) { }
+
+BlockGenerator::BlockGenerator(const Point2i &offset, const Vector2i &size, int blockSize)
+        : BlockGenerator(offset, size, blockSize, 0, 1) { }
+
+BlockGenerator::BlockGenerator(const Point2i &offset, const Vector2i &size, int blockSize,
+        int shardIndex, int shardCount)
+        : m_offset(offset), m_size(size), m_blockSize(blockSize),
+          m_shardIndex(shardIndex), m_shardCount(shardCount) {
+    if (shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount)
+        throw NoriException("BlockGenerator: invalid shard %i/%i!", shardIndex, shardCount);
     m_numBlocks = Vector2i(
         (int) std::ceil(size.x() / (float) blockSize),
         (int) std::ceil(size.y() / (float) blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
+    int blockCount = m_numBlocks.x() * m_numBlocks.y();
+    m_blocksLeft = blockCount / shardCount + (shardIndex < blockCount % shardCount ? 1 : 0);
     m_direction = ERight;
     m_block = Point2i(m_numBlocks / 2);
     m_stepsLeft = 1;
     m_numSteps = 1;
 }
 
+void BlockGenerator::setScanlineOrder() {
+    m_scanline = true;
+    m_block = Point2i(0, 0);
+}
+
 bool BlockGenerator::next(ImageBlock &block) {
     tbb::mutex::scoped_lock lock(m_mutex);
 
     if (m_blocksLeft == 0)
         return false;
 
+    /* Skip the blocks of other shards */
+    while (!inShard())
+        advance();
+
     Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
+    block.setOffset(m_offset + pos);
     block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
 
     if (--m_blocksLeft == 0)
         return true;
 
+    advance();
+    return true;
+}
+
+void BlockGenerator::advance() {
+    if (m_scanline) {
+        if (++m_block.x() == m_numBlocks.x()) {
+            m_block.x() = 0;
+            ++m_block.y();
+        }
+        return;
+    }
+
     do {
         switch (m_direction) {
             case ERight: ++m_block.x(); break;
@@ -159,8 +409,152 @@ bool BlockGenerator::next(ImageBlock &block) {
         }
     } while ((m_block.array() < 0).any() ||
              (m_block.array() >= m_numBlocks.array()).any());
+}
+
+ImageStream::ImageStream(const std::string &filename, const Point2i &offset, const Vector2i &size,
+        const Point2i &blockOffset, const Vector2i &blockRegion, int blockSize, int borderSize,
+        const EXRSettings &settings)
+        : m_offset(offset), m_size(size), m_blockOffset(blockOffset - offset), m_blockSize(blockSize),
+          m_borderSize(borderSize), m_half(settings.half) {
+    m_blocksPerRow = (blockRegion.x() + blockSize - 1) / blockSize;
+    m_blockRowCount = (blockRegion.y() + blockSize - 1) / blockSize;
+    m_stripCount = (size.y() + blockSize - 1) / blockSize;
+    m_blocksDone.assign(m_blockRowCount, 0);
+
+    cout << "Streaming a " << size.x() << "x" << size.y()
+         << " OpenEXR file to \"" << filename << "\"" << endl;
+
+    std::string path = filename + ".exr";
+
+    Imf::Header header(size.x(), size.y());
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    header.compression() = settings.compression;
+
+    Imf::PixelType type = settings.half ? Imf::HALF : Imf::FLOAT;
+    Imf::ChannelList &channels = header.channels();
+    channels.insert("R", Imf::Channel(type));
+    channels.insert("G", Imf::Channel(type));
+    channels.insert("B", Imf::Channel(type));
+
+    m_file.reset(new Imf::OutputFile(path.c_str(), header));
+}
+
+ImageStream::~ImageStream() {
+    if (!isComplete())
+        cerr << "ImageStream: only " << m_writtenStrips << " of " << m_stripCount
+             << " strips were written!" << endl;
+}
+
+void ImageStream::put(const ImageBlock &block) {
+    int border = block.getBorderSize();
+    if (border != m_borderSize)
+        throw NoriException("ImageStream::put(): the block has a different border size!");
+    Point2i offset = block.getOffset() - m_offset;
+    Vector2i size = block.getSize();
+
+    /* Columns of the block (including its border) within the image */
+    int x0 = std::max(0, offset.x() - border);
+    int x1 = std::min(m_size.x(), offset.x() + size.x() + border);
 
+    tbb::mutex::scoped_lock lock(m_mutex);
+
+    for (int by = 0; by < size.y() + 2 * border; ++by) {
+        int y = offset.y() - border + by;
+        if (y < 0 || y >= m_size.y() || x0 >= x1)
+            continue;
+
+        int index = y / m_blockSize;
+        std::unique_ptr<Strip> &strip = m_strips[index];
+        if (!strip) {
+            strip.reset(new Strip(std::min(m_blockSize, m_size.y() - index * m_blockSize), m_size.x()));
+            strip->setConstant(Color4f());
+            m_peakStripCount = std::max(m_peakStripCount, (int) (m_strips.size() + m_finished.size()));
+        }
+
+        strip->block(y - index * m_blockSize, x0, 1, x1 - x0)
+            += block.block(by, x0 - (offset.x() - border), 1, x1 - x0);
+    }
+
+    ++m_blocksDone[(offset.y() - m_blockOffset.y()) / m_blockSize];
+
+    /* Hand the complete strips over to the writer */
+    bool finished = false;
+    while (m_nextStrip < m_stripCount && isDone(m_nextStrip)) {
+        auto it = m_strips.find(m_nextStrip);
+        m_finished.push_back(std::make_pair(m_nextStrip, std::move(it->second)));
+        m_strips.erase(it);
+        ++m_nextStrip;
+        finished = true;
+    }
+    lock.release();
+
+    if (finished)
+        write();
+}
+
+bool ImageStream::isDone(int strip) const {
+    /* Check every row of blocks that overlaps the strip with its border */
+    int y0 = strip * m_blockSize, y1 = std::min(m_size.y(), y0 + m_blockSize);
+    for (int i = 0; i < m_blockRowCount; ++i) {
+        int blockY0 = m_blockOffset.y() + i * m_blockSize - m_borderSize;
+        int blockY1 = m_blockOffset.y() + (i + 1) * m_blockSize + m_borderSize;
+        if (blockY0 < y1 && blockY1 > y0 && m_blocksDone[i] < m_blocksPerRow)
+            return false;
+    }
     return true;
 }
 
+void ImageStream::write() {
+    tbb::mutex::scoped_lock writeLock(m_writeMutex);
+
+    /* Another thread may have queued more strips while this one waited */
+    while (true) {
+        tbb::mutex::scoped_lock lock(m_mutex);
+        if (m_finished.empty())
+            return;
+        int index = m_finished.front().first;
+        std::unique_ptr<Strip> strip = std::move(m_finished.front().second);
+        m_finished.pop_front();
+        lock.release();
+
+        writeStrip(index, *strip);
+        ++m_writtenStrips;
+    }
+}
+
+void ImageStream::writeStrip(int index, const Strip &strip) {
+    Bitmap bitmap(Vector2i((int) strip.cols(), (int) strip.rows()));
+    for (int y = 0; y < strip.rows(); ++y)
+        for (int x = 0; x < strip.cols(); ++x)
+            bitmap.coeffRef(y, x) = strip.coeff(y, x).divideByFilterWeight();
+
+    /* The frame buffer must have the pixel type of the file */
+    Imf::PixelType type = Imf::FLOAT;
+    char *ptr = reinterpret_cast<char *>(bitmap.data());
+    size_t compStride = sizeof(float);
+    std::vector<half> halves;
+    if (m_half) {
+        halves.assign(bitmap.data()->data(), bitmap.data()->data() + 3 * bitmap.size());
+        type = Imf::HALF;
+        ptr = reinterpret_cast<char *>(halves.data());
+        compStride = sizeof(half);
+    }
+
+    /* The frame buffer is addressed with the rows of the whole image */
+    size_t pixelStride = 3 * compStride,
+           rowStride = pixelStride * bitmap.cols();
+    ptr -= index * m_blockSize * rowStride;
+
+    Imf::FrameBuffer frameBuffer;
+    frameBuffer.insert("R", Imf::Slice(type, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("G", Imf::Slice(type, ptr, pixelStride, rowStride)); ptr += compStride;
+    frameBuffer.insert("B", Imf::Slice(type, ptr, pixelStride, rowStride));
+    m_file->setFrameBuffer(frameBuffer);
+    m_file->writePixels((int) bitmap.rows());
+}
+
+size_t ImageStream::getStripMemory() const {
+    return sizeof(Color4f) * m_blockSize * m_size.x();
+}
+
 NORI_NAMESPACE_END
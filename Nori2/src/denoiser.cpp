@@ -0,0 +1,202 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/denoiser.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+FeatureBuffers::FeatureBuffers(const Vector2i &size)
+    : albedo(size), normal(size), depth(size), meshId(size), variance(size), sampleCount(size) {
+    albedo.setConstant(Color3f(0.f));
+    normal.setConstant(Color3f(0.f));
+    depth.setConstant(Color3f(0.f));
+    meshId.setConstant(Color3f(0.f));
+    variance.setConstant(Color3f(0.f));
+    sampleCount.setConstant(Color3f(0.f));
+}
+
+std::vector<BitmapLayer> FeatureBuffers::getLayers() const {
+    std::vector<BitmapLayer> layers = {
+        { "albedo", &albedo, "RGB" },
+        { "normal", &normal, "XYZ" },
+        { "depth", &depth, "Z" },
+        { "meshId", &meshId, "Y" }
+    };
+    if (hasVariance)
+        layers.push_back({ "variance", &variance, "RGB" });
+    if (hasSampleCount)
+        layers.push_back({ "sampleCount", &sampleCount, "Y" });
+    return layers;
+}
+
+/**
+ * \brief Joint (cross) bilateral filter driven by the feature buffers
+ *
+ * The radiance is first divided by the albedo, so that only the
+ * illumination is smoothed and textures stay sharp. Every pixel is then
+ * replaced by a weighted average over a square window. The weight of a
+ * neighbor falls off with its distance in the image, with the differences
+ * of normal, albedo and relative depth, and with the squared difference of
+ * the illumination minus Var_p + min(Var_p, Var_q), the noise term of the
+ * NL-means distance of Rousselle et al. Without a variance buffer, the
+ * variance is estimated from the 3x3 neighborhood of every pixel.
+ */
+class JointBilateralDenoiser : public Denoiser {
+public:
+    JointBilateralDenoiser(const PropertyList &propList) {
+        /* Half size of the filter window in pixels */
+        m_radius = propList.getInteger("radius", 8);
+        /* Standard deviation of the spatial weight in pixels */
+        m_sigmaSpatial = propList.getFloat("sigmaSpatial", 3.0f);
+        /* Standard deviations of the feature weights (the one of the
+           depth is relative to the depth of the center pixel) */
+        m_sigmaNormal = propList.getFloat("sigmaNormal", 0.3f);
+        m_sigmaAlbedo = propList.getFloat("sigmaAlbedo", 0.1f);
+        m_sigmaDepth = propList.getFloat("sigmaDepth", 0.05f);
+        /* Tolerance of the color weight, in standard deviations of the noise */
+        m_sigmaColor = propList.getFloat("sigmaColor", 2.0f);
+
+        if (m_radius < 0)
+            throw NoriException("JointBilateralDenoiser: the radius must be non-negative!");
+        if (m_sigmaSpatial <= 0 || m_sigmaNormal <= 0 || m_sigmaAlbedo <= 0 || m_sigmaDepth <= 0)
+            throw NoriException("JointBilateralDenoiser: the standard deviations must be positive!");
+    }
+
+    Bitmap *denoise(const Bitmap &image, const FeatureBuffers &features) const {
+        int width = (int) image.cols(), height = (int) image.rows();
+        if (features.albedo.cols() != width || features.albedo.rows() != height)
+            throw NoriException("JointBilateralDenoiser: the features don't match the image size!");
+        Vector2i size(width, height);
+
+        /* Demodulate the albedo, except where there is none (e.g. the background) */
+        Bitmap albedo(size), illumination(size), variance(size);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                Color3f a = features.albedo(y, x);
+                for (int c = 0; c < 3; ++c)
+                    a[c] = a[c] > 0.01f ? a[c] : 1.f;
+                albedo(y, x) = a;
+                illumination(y, x) = image(y, x) / a;
+                variance(y, x) = features.hasVariance ? Color3f(features.variance(y, x) / (a * a)) : Color3f(0.f);
+            }
+        }
+
+        /* The color weight compares the illumination averaged over the 3x3
+           neighborhood, which is much less noisy than single pixels. The
+           variance of these averages is estimated from the variance of the
+           pixels or, without it, from the spread of the neighborhood */
+        Bitmap guide(size), guideVariance(size);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                Color3f sum(0.f), sumSq(0.f), varSum(0.f);
+                int count = 0;
+                for (int j = std::max(0, y - 1); j <= std::min(height - 1, y + 1); ++j) {
+                    for (int i = std::max(0, x - 1); i <= std::min(width - 1, x + 1); ++i) {
+                        sum += illumination(j, i);
+                        sumSq += illumination(j, i) * illumination(j, i);
+                        varSum += variance(j, i);
+                        ++count;
+                    }
+                }
+                guide(y, x) = sum / (float) count;
+                if (features.hasVariance)
+                    guideVariance(y, x) = varSum / (float) (count * count);
+                else
+                    guideVariance(y, x) = (sumSq / (float) count - guide(y, x).square()).max(0.f) / (float) count;
+            }
+        }
+
+        Bitmap *result = new Bitmap(size);
+        float invSpatial = 1.f / (2 * m_sigmaSpatial * m_sigmaSpatial);
+        float invNormal = 1.f / (2 * m_sigmaNormal * m_sigmaNormal);
+        float invAlbedo = 1.f / (2 * m_sigmaAlbedo * m_sigmaAlbedo);
+        float colorScale = m_sigmaColor * m_sigmaColor;
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int> &range) {
+            for (int y = range.begin(); y < range.end(); ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const Color3f &ip = guide(y, x), &vp = guideVariance(y, x);
+                    const Color3f &np = features.normal(y, x), &ap = features.albedo(y, x);
+                    float dp = features.depth(y, x).x();
+                    float sigmaDepth = m_sigmaDepth * std::max(dp, 1e-4f);
+                    float invDepth = 1.f / (2 * sigmaDepth * sigmaDepth);
+
+                    Color3f sum(0.f);
+                    float weightSum = 0.f;
+                    for (int j = std::max(0, y - m_radius); j <= std::min(height - 1, y + m_radius); ++j) {
+                        for (int i = std::max(0, x - m_radius); i <= std::min(width - 1, x + m_radius); ++i) {
+                            const Color3f &iq = guide(j, i), &vq = guideVariance(j, i);
+
+                            /* Color distance after removing the expected contribution of the noise */
+                            float colorDist = 0.f;
+                            for (int c = 0; c < 3; ++c) {
+                                float diff = ip[c] - iq[c], var = vp[c] + vq[c];
+                                colorDist += std::max(0.f, diff * diff - (vp[c] + std::min(vp[c], vq[c])))
+                                    / (1e-4f + colorScale * var);
+                            }
+
+                            float dd = dp - features.depth(j, i).x();
+                            float exponent = ((i - x) * (i - x) + (j - y) * (j - y)) * invSpatial
+                                + (np - features.normal(j, i)).matrix().squaredNorm() * invNormal
+                                + (ap - features.albedo(j, i)).matrix().squaredNorm() * invAlbedo
+                                + dd * dd * invDepth
+                                + colorDist / 3.f;
+
+                            float weight = std::exp(-exponent);
+                            sum += weight * illumination(j, i);
+                            weightSum += weight;
+                        }
+                    }
+
+                    /* The center pixel always has a weight of one (the sigmas are positive) */
+                    (*result)(y, x) = sum / weightSum * albedo(y, x);
+                }
+            }
+        });
+
+        return result;
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "JointBilateralDenoiser[\n"
+            "  radius = %i,\n"
+            "  sigmaSpatial = %f,\n"
+            "  sigmaNormal = %f,\n"
+            "  sigmaAlbedo = %f,\n"
+            "  sigmaDepth = %f,\n"
+            "  sigmaColor = %f\n"
+            "]",
+            m_radius, m_sigmaSpatial, m_sigmaNormal, m_sigmaAlbedo,
+            m_sigmaDepth, m_sigmaColor
+        );
+    }
+
+protected:
+    int m_radius;
+    float m_sigmaSpatial;
+    float m_sigmaNormal;
+    float m_sigmaAlbedo;
+    float m_sigmaDepth;
+    float m_sigmaColor;
+};
+
+NORI_REGISTER_CLASS(JointBilateralDenoiser, "bilateral");
+NORI_NAMESPACE_END
@@ -35,6 +35,11 @@ public:
         m_albedo = new ConstantSpectrumTexture(propList.getColor("albedo", Color3f(0.5f)));
     }
 
+    /// Bind the albedo once all the children have been added
+    void activate() {
+        m_bound[0].bind(m_albedo);
+    }
+
     /// Evaluate the BRDF model
     Color3f eval(const BSDFQueryRecord &bRec) const {
         /* This is a smooth BRDF -- return zero if the measure
@@ -45,7 +50,7 @@ public:
             return Color3f(0.0f);
 
         /* The BRDF is simply the albedo / pi */
-        return m_albedo->eval(bRec.uv) * INV_PI;
+        return albedo(bRec) * INV_PI;
     }
 
     /// Compute the density of \ref sample() wrt. solid angles
@@ -83,13 +88,17 @@ public:
 
         /* eval() / pdf() * cos(theta) = albedo. There
            is no need to call these functions. */
-        return m_albedo->eval(bRec.uv);
+        return albedo(bRec);
     }
 
     bool isDiffuse() const {
         return true;
     }
 
+    bool isLambertian() const {
+        return true;
+    }
+
     /// Return a human-readable summary
     std::string toString() const {
         return tfm::format(
@@ -120,7 +129,15 @@ public:
 
     EClassType getClassType() const { return EBSDF; }
 private:
+    /// Albedo at the shading point of the record
+    Color3f albedo(const BSDFQueryRecord &bRec) const {
+        if (m_bound[0].isConstant())
+            return m_bound[0].eval(bRec.uv);
+        return fetchTextures(bRec, m_bound)[0];
+    }
+
     Texture *m_albedo;
+    TextureBinding m_bound[1];
 };
 
 NORI_REGISTER_CLASS(Diffuse, "diffuse");
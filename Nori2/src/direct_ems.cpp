@@ -20,7 +20,7 @@ public:
         if (!scene->rayIntersect(ray, its))
             return scene->getBackground(ray);
         float pdflight;
-        EmitterQueryRecord emitterRecord(its.p);
+        EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
         
         float rnd = sampler->next1D();
 
@@ -35,6 +35,9 @@ public:
             Lo += em->eval(emRecord);
         }
         
+        if (emitterRecord.pdf == 0)
+            return Lo;
+
         Ray3f sray(its.p, emitterRecord.wi);
         Intersection it_shadow;
         if (scene->rayIntersect(sray, it_shadow))
@@ -41,12 +41,16 @@ public:
         float pdflight;
 
         //Sample a ligh source
-        EmitterQueryRecord emitterRecord(its.p);
+        EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
         const std::vector<Emitter*> lights = scene->getLights();
         float rnd = sampler->next1D();
-        const Emitter* emit = scene->sampleEmitter(rnd, pdflight);
+        const Emitter* emit = scene->sampleEmitter(its.p, its.shFrame.n, rnd, pdflight);
+        if (!emit)
+            return Color3f(0.);
 
         Color3f Le = emit->sample(emitterRecord, sampler->next2D(), 0.);
+        if (emitterRecord.pdf == 0)
+            return Color3f(0.);
         
         //Check visibility
         Ray3f sray(its.p, emitterRecord.wi);
@@ -60,7 +64,8 @@ public:
             its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
 
         float emPdf = pdflight * emitterRecord.pdf;
-        float matPdf = its.mesh->getBSDF()->pdf(bsdfRecord);
+        // Delta emitters can't be reached by BSDF sampling
+        float matPdf = emit->isDelta() ? 0.f : its.mesh->getBSDF()->pdf(bsdfRecord);
         float base = emPdf + matPdf;
         float w = 0;
         if(base != 0 && !isinf(emPdf))
@@ -94,16 +99,19 @@ public:
 
             const Emitter* emEnv = scene->getEnvironmentalEmitter();
             if(emEnv != nullptr){
+                // There is no intersection: query the environment along the ray direction
                 EmitterQueryRecord emitter_intersection(
-					emEnv, wo.o, next_its.p, next_its.shFrame.n, next_its.uv);
-                emPdf = scene->pdfEmitter(emEnv) * emEnv->pdf(emitter_intersection);  
+					emEnv, wo.o, wo.o + wo.d, Normal3f(0, 0, 1), Vector2f());
+                emPdf = scene->pdfEmitter(emEnv, its.p, its.shFrame.n) * emEnv->pdf(emitter_intersection);  
             }
         }
         else if(next_its.mesh->isEmitter()){ // Intersected Emitter
             // Emitter light
-            const Emitter* em = next_its.mesh->getEmitter();
+            const Emitter* em = next_its.mesh->getEmitter(next_its.triIndex);
             EmitterQueryRecord emRecord(em, its.p, next_its.p, next_its.shFrame.n, next_its.uv);
-            emPdf = em->pdf(emRecord) * scene->pdfEmitter(em);
+            emRecord.refNormal = its.shFrame.n;
+            emRecord.triIndex = next_its.triIndex;
+            emPdf = em->pdf(emRecord) * scene->pdfEmitter(em, its.p, its.shFrame.n);
             Le = em->eval(emRecord);
         }
 
@@ -19,7 +19,7 @@ public:
         if (!scene->rayIntersect(ray, its))
             return scene->getBackground(ray);
         float pdflight;
-        EmitterQueryRecord emitterRecord(its.p);
+        EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
         // Get all lights in the scene
         const std::vector<Emitter*> lights = scene->getLights();
         // Let's iterate over all emitters
@@ -0,0 +1,91 @@
+/*
+	This file is part of Nori, a simple educational ray tracer
+	Copyright (c) 2020 by Adrian Jarabo
+	Nori is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License Version 3
+	as published by the Free Software Foundation.
+	Nori is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/distribution.h>
+
+NORI_NAMESPACE_BEGIN
+
+Distribution1D::Distribution1D(const float* f, int n) : cdf(n + 1), func(f, f + n) {
+    /* Integrate the piecewise-constant function */
+    cdf[0] = 0;
+    for (int i = 1; i < n + 1; ++i)
+        cdf[i] = cdf[i - 1] + func[i - 1] / n;
+
+    /* Normalize, falling back to a uniform distribution if the function is zero */
+    funcInt = cdf[n];
+    if (funcInt == 0) {
+        for (int i = 1; i < n + 1; ++i)
+            cdf[i] = float(i) / float(n);
+    } else {
+        for (int i = 1; i < n + 1; ++i)
+            cdf[i] /= funcInt;
+    }
+}
+
+float Distribution1D::SampleContinuous(float u, float* pdf, int* off) const {
+    /* Find the interval with cdf[offset] <= u < cdf[offset + 1] */
+    int offset = (int) (std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+    offset = clamp(offset, 0, (int) cdf.size() - 2);
+    if (off)
+        *off = offset;
+
+    /* Position within the interval */
+    float du = u - cdf[offset];
+    if (cdf[offset + 1] - cdf[offset] > 0)
+        du /= cdf[offset + 1] - cdf[offset];
+
+    if (pdf)
+        *pdf = funcInt > 0 ? func[offset] / funcInt : 1.f;
+
+    return std::min((offset + du) / Count(), 1.f - std::numeric_limits<float>::epsilon());
+}
+
+float Distribution1D::DiscretePdf(int index) const {
+    return funcInt > 0 ? func[index] / (funcInt * Count()) : 1.f / Count();
+}
+
+int Distribution1D::Count() const {
+    return (int) func.size();
+}
+
+Distribution2D::Distribution2D(const float* func, int nu, int nv) {
+    pConditionalV.reserve(nv);
+    for (int v = 0; v < nv; ++v)
+        pConditionalV.emplace_back(new Distribution1D(&func[v * nu], nu));
+
+    std::vector<float> marginalFunc(nv);
+    for (int v = 0; v < nv; ++v)
+        marginalFunc[v] = pConditionalV[v]->funcInt;
+    pMarginal.reset(new Distribution1D(marginalFunc.data(), nv));
+}
+
+Point2f Distribution2D::SampleContinuous2(const Point2f& u, float* pdf) const {
+    float pdfs[2];
+    int v;
+    float d1 = pMarginal->SampleContinuous(u[1], &pdfs[1], &v);
+    float d0 = pConditionalV[v]->SampleContinuous(u[0], &pdfs[0], nullptr);
+    if (pdf)
+        *pdf = pdfs[0] * pdfs[1];
+    return Point2f(d0, d1);
+}
+
+float Distribution2D::DiscretePdf2(const Point2f& p) const {
+    int iu = clamp(int(p[0] * pConditionalV[0]->Count()), 0, pConditionalV[0]->Count() - 1);
+    int iv = clamp(int(p[1] * pMarginal->Count()), 0, pMarginal->Count() - 1);
+    if (pMarginal->funcInt == 0)
+        return 1.f;
+    return pConditionalV[iv]->func[iu] / pMarginal->funcInt;
+}
+
+NORI_NAMESPACE_END
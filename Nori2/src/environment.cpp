@@ -15,6 +15,7 @@
 #include <nori/emitter.h>
 #include <nori/bitmap.h>
 #include <nori/warp.h>
+#include <nori/distribution.h>
 #include <filesystem/resolver.h>
 #include <fstream>
 
@@ -41,11 +42,15 @@ public:
 			cout << "Loaded " << m_environment_name << " - SIZE [" << m_environment->rows() << ", " << m_environment->cols() << "]" << endl;
 		}
 		m_radiance = props.getColor("radiance", Color3f(1.));
+
+		if (m_environment)
+			buildDistribution();
 	}
 	~EnvironmentEmitter()
 	{
 		if (m_environment)
 			delete m_environment;
+		delete m_distribution;
 	}
 
 	virtual std::string toString() const {
@@ -80,11 +85,28 @@ public:
 
 	virtual Color3f sample(EmitterQueryRecord& lRec, const Point2f& sample, float optional_u) const {
 
-		Vector3f sphSample = Warp::squareToUniformSphere(sample);
+		lRec.dist = std::numeric_limits<float>::max();
+
+		if (!m_distribution) {
+			lRec.wi = Warp::squareToUniformSphere(sample);
+			lRec.pdf = pdf(lRec);
+			return eval(lRec);
+		}
+
+		// Sample the (phi, theta) parameterization proportionally to luminance * sin(theta)
+		float mapPdf;
+		Point2f xy = m_distribution->SampleContinuous2(sample, &mapPdf);
+		float phi = xy.x() * 2 * M_PI, theta = xy.y() * M_PI;
+		float sinTheta = std::sin(theta);
+
+		lRec.wi = Vector3f(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+		if (mapPdf == 0 || sinTheta == 0) {
+			lRec.pdf = 0;
+			return Color3f(0.);
+		}
 
-        lRec.dist = std::numeric_limits<float>::max();
-        lRec.wi = sphSample;
-		lRec.pdf = pdf(lRec);
+		// Change of variables from [0,1]^2 to solid angle
+		lRec.pdf = mapPdf / (2 * M_PI * M_PI * sinTheta);
 
 		return eval(lRec);
 	}
@@ -93,7 +115,19 @@ public:
 	// Assumes all information about the intersection point is already provided inside.
 	// WARNING: Use with care. Malformed EmitterQueryRecords can result in undefined behavior. Plus no visibility is considered.
 	virtual float pdf(const EmitterQueryRecord& lRec) const {
-		return Warp::squareToUniformSpherePdf(lRec.wi);
+		if (!m_distribution)
+			return Warp::squareToUniformSpherePdf(lRec.wi);
+
+		float phi = atan2(lRec.wi[2], lRec.wi[0]);
+		float theta = acos(clamp(lRec.wi[1], -1.f, 1.f));
+		if (phi < 0) phi += 2 * M_PI;
+
+		float sinTheta = std::sin(theta);
+		if (sinTheta == 0)
+			return 0;
+
+		return m_distribution->DiscretePdf2(Point2f(phi / (2 * M_PI), theta / M_PI))
+			/ (2 * M_PI * M_PI * sinTheta);
 	}
 
 
@@ -104,9 +138,35 @@ public:
 
 
 protected:
+	/**
+	 * Build a piecewise-constant distribution over the lat-long parameterization
+	 * (x = phi / 2pi, y = theta / pi) proportional to luminance * sin(theta), so that
+	 * bright regions such as the sun are sampled proportionally to their power.
+	 *
+	 * eval() interpolates bilinearly, so cell (i, j) takes the maximum of the
+	 * pixels it interpolates; this keeps the pdf nonzero wherever radiance is.
+	 */
+	void buildDistribution() {
+		int nu = m_environment->cols(), nv = m_environment->rows();
+		std::vector<float> func(nu * nv);
+		for (int j = 0; j < nv; ++j) {
+			float sinTheta = std::sin(M_PI * (j + 0.5f) / nv);
+			int row0 = mod(nv - j - 1, nv), row1 = mod(nv - j, nv);
+			for (int i = 0; i < nu; ++i) {
+				int col0 = mod(nu - i - 1, nu), col1 = mod(nu - i, nu);
+				float luminance = std::max(
+					std::max((*m_environment)(row0, col0).getLuminance(), (*m_environment)(row0, col1).getLuminance()),
+					std::max((*m_environment)(row1, col0).getLuminance(), (*m_environment)(row1, col1).getLuminance()));
+				func[j * nu + i] = std::max(luminance, 0.f) * sinTheta;
+			}
+		}
+		m_distribution = new Distribution2D(func.data(), nu, nv);
+	}
+
 	Color3f m_radiance;
 	Bitmap *m_environment;
 	std::string m_environment_name;
+	Distribution2D *m_distribution = nullptr;
 };
 
 NORI_REGISTER_CLASS(EnvironmentEmitter, "environment")
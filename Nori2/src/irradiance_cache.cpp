@@ -0,0 +1,286 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/render.h>
+#include <nori/irradiancecache.h>
+#include <nori/timer.h>
+#include <nori/roulette.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Path tracer with emitter sampling (as path_nee) that stops at the first
+ * Lambertian surface after the camera vertex and looks up the indirect
+ * irradiance there in an irradiance cache.
+ *
+ * Missing cache records are computed on the fly with a stratified
+ * hemisphere gather (which also provides the gradients used for
+ * interpolation) and inserted concurrently by the render threads. An
+ * optional prepass traces one ray per pixel to populate the cache before
+ * the final gather, so the image does not depend on the order in which
+ * the blocks are rendered.
+ */
+class IrradianceCaching : public Integrator
+{
+public:
+    IrradianceCaching(const PropertyList &props) : m_roulette(props)
+    {
+        /* Maximum interpolation error (Ward's 'a') */
+        m_error = props.getFloat("error", 0.5f);
+        /* Number of hemisphere samples used to compute a record */
+        m_gatherSamples = props.getInteger("gatherSamples", 256);
+        /* Bounds of the record radius, relative to the scene's diagonal */
+        m_minSpacing = props.getFloat("minSpacing", 0.02f);
+        m_maxSpacing = props.getFloat("maxSpacing", 0.1f);
+        /* Populate the cache before rendering */
+        m_prepass = props.getBoolean("prepass", true);
+
+        /* Strata in theta and phi, with about pi times more in phi */
+        m_thetaStrata = std::max(1, (int) std::round(std::sqrt(m_gatherSamples / M_PI)));
+        m_phiStrata = std::max(1, (int) std::round(m_thetaStrata * M_PI));
+    }
+
+    virtual ~IrradianceCaching()
+    {
+        delete m_cache;
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        delete m_cache;
+        m_cache = new IrradianceCache(scene->getBoundingBox(), m_error);
+        m_sceneSize = scene->getBoundingBox().getExtents().norm();
+
+        if (!m_prepass)
+            return;
+
+        cout << "Populating the irradiance cache .. ";
+        cout.flush();
+        Timer timer;
+
+        std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+        sampler->setSampleCount(1);
+        traceCameraRays(scene, sampler.get(), [&](Sampler *sampler, const Ray3f &ray) {
+            trace(scene, sampler, ray, true, true);
+        });
+
+        cout << "done. (" << m_cache->getRecordCount() << " records, took "
+             << timer.elapsedString() << ")" << endl;
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        return trace(scene, sampler, ray, true, true);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "IrradianceCaching[\n"
+            "  error = %f,\n"
+            "  gatherSamples = %i,\n"
+            "  minSpacing = %f,\n"
+            "  maxSpacing = %f,\n"
+            "  prepass = %s,\n"
+            "  %s\n"
+            "]",
+            m_error, m_gatherSamples, m_minSpacing, m_maxSpacing, m_prepass ? "true" : "false",
+            m_roulette.toString());
+    }
+
+protected:
+    /**
+     * Path tracing with emitter sampling. Emission that is hit directly is
+     * only accounted for by the first segment (if \c countEmitted is set) and
+     * after specular bounces. With \c useCache, the path stops at the first
+     * Lambertian surface after the first bounce and uses the cache instead.
+     */
+    Color3f trace(const Scene* scene, Sampler* sampler, const Ray3f &ray,
+        bool useCache, bool countEmitted) const
+    {
+        Intersection its;
+        Ray3f iteRay(ray);
+        Color3f Le(0.);
+        Color3f bsdf(1.);
+
+        bool isSpecular = false;
+
+        for(int bounce = 0;;++bounce){
+            bool emitted = isSpecular || (bounce == 0 && countEmitted);
+
+            if (!scene->rayIntersect(iteRay, its)){
+                if(emitted)
+                    return Le + scene->getBackground(iteRay) * bsdf;
+
+                return Le;
+            }
+            else if (its.mesh->isEmitter()) {
+                if(emitted){
+                    const Emitter* em = its.mesh->getEmitter(its.triIndex);
+                    EmitterQueryRecord emRecord(em, iteRay.o, its.p, its.shFrame.n, its.uv);
+                    return Le + em->eval(emRecord) * bsdf;
+                }
+
+                return Le;
+            }
+
+            if (m_roulette.reachedMaxDepth(bounce))
+                return Le;
+
+            const BSDF *material = its.mesh->getBSDF();
+            Color3f Le_emiter(0.);
+            const Emitter* emit = nullptr;
+            float pdflight = 0;
+            if(!isSpecular) // Choose an emitter for the current shading point
+                emit = scene->sampleEmitter(its.p, its.shFrame.n, sampler->next1D(), pdflight);
+            if(emit){ // Emitter sampling for NEE
+
+                EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
+                emitterRecord.emitter = emit;
+                Color3f Le_em = emit->sample(emitterRecord, sampler->next2D(), 0.);
+
+                // A shadow ray that escapes the scene reaches the environment
+                Ray3f sray(its.p, emitterRecord.wi);
+                Intersection it_shadow;
+                if (emitterRecord.pdf > 0 &&
+                    (!scene->rayIntersect(sray, it_shadow) || it_shadow.t >= (emitterRecord.dist - 1.e-5))){
+                    BSDFQueryRecord bsdfRecord_emit(its.toLocal(-iteRay.d),
+                        its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+                    Le_emiter = Le_em * bsdf * its.shFrame.n.dot(emitterRecord.wi) * material->eval(bsdfRecord_emit) / (pdflight * emitterRecord.pdf);
+                }
+            }
+
+            // Indirect light at secondary diffuse hits comes from the cache
+            if (useCache && bounce > 0 && material->isLambertian()) {
+                Vector3f wi = its.toLocal(-iteRay.d);
+                if (Frame::cosTheta(wi) <= 0)
+                    return Le + Le_emiter;
+                Color3f E;
+                if (!m_cache->lookup(its.p, its.shFrame.n, E))
+                    E = computeRecord(scene, sampler, its);
+                BSDFQueryRecord bsdfRecord(wi, wi, its.uv, ESolidAngle);
+                return Le + Le_emiter + bsdf * material->eval(bsdfRecord) * E;
+            }
+
+            //Sample BSDF
+            BSDFQueryRecord bsdfRecord(its.toLocal(-iteRay.d), its.uv);
+            Color3f bsdf_aux = material->sample(bsdfRecord, sampler->next2D());
+            bsdf *= bsdf_aux;
+            Le += Le_emiter;
+
+            // Russian roulette on the accumulated throughput (as in path_nee)
+            if (bsdf.isZero() || !m_roulette.survive(bounce, bsdf, 1.f, sampler->next1D()))
+                return Le;
+
+            iteRay = Ray3f(its.p, its.toWorld(bsdfRecord.wo));
+            isSpecular = bsdfRecord.measure == EDiscrete;
+        }
+
+        return Le;
+    }
+
+    /**
+     * Compute the indirect irradiance at \c its with a stratified gather,
+     * estimate its gradients (Ward and Heckbert 1992) and add it to the cache
+     */
+    Color3f computeRecord(const Scene* scene, Sampler* sampler, const Intersection &its) const
+    {
+        const int M = m_thetaStrata, N = m_phiStrata;
+        std::vector<Color3f> L(M * N);
+        std::vector<float> r(M * N), sinTheta(M * N), cosTheta(M * N), phi(M * N);
+
+        Color3f E(0.f);
+        float invDistSum = 0.f;
+        for (int k = 0; k < N; ++k) {
+            for (int j = 0; j < M; ++j) {
+                // Cosine-weighted stratum (j, k)
+                Point2f sample = sampler->next2D();
+                int idx = j * N + k;
+                float sin2Theta = (j + sample.x()) / M;
+                sinTheta[idx] = std::sqrt(sin2Theta);
+                cosTheta[idx] = std::sqrt(std::max(0.f, 1.f - sin2Theta));
+                phi[idx] = 2 * M_PI * (k + sample.y()) / N;
+                Vector3f local(sinTheta[idx] * std::cos(phi[idx]), sinTheta[idx] * std::sin(phi[idx]), cosTheta[idx]);
+
+                Ray3f ray(its.p, its.toWorld(local));
+                Intersection gatherIts;
+                r[idx] = scene->rayIntersect(ray, gatherIts) ? gatherIts.t : std::numeric_limits<float>::infinity();
+                // Only the indirect light: direct emission is handled by emitter sampling
+                L[idx] = trace(scene, sampler, ray, false, false);
+                E += L[idx];
+                invDistSum += 1.f / r[idx];
+            }
+        }
+        E *= M_PI / (M * N);
+
+        IrradianceCache::Record record;
+        record.p = its.p;
+        record.n = its.shFrame.n;
+        record.E = E;
+        for (int c = 0; c < 3; ++c) {
+            Vector3f gradT(0.f), gradR(0.f);
+            for (int k = 0; k < N; ++k) {
+                int kPrev = (k + N - 1) % N;
+                float phiMinus = 2 * M_PI * k / N;
+                float phiCenter = 2 * M_PI * (k + 0.5f) / N;
+                Vector3f u(std::cos(phiCenter), std::sin(phiCenter), 0.f);
+                Vector3f vMinus(-std::sin(phiMinus), std::cos(phiMinus), 0.f);
+
+                // Change across the boundaries between theta strata
+                float sumU = 0.f;
+                for (int j = 1; j < M; ++j) {
+                    float sinThetaMinus = std::sqrt((float) j / M);
+                    float cos2ThetaMinus = 1.f - (float) j / M;
+                    float dist = std::min(r[j * N + k], r[(j - 1) * N + k]);
+                    sumU += sinThetaMinus * cos2ThetaMinus / dist * (L[j * N + k][c] - L[(j - 1) * N + k][c]);
+                }
+                // Change across the boundaries between phi strata
+                float sumV = 0.f;
+                for (int j = 0; j < M; ++j) {
+                    float cosThetaMinus = std::sqrt(1.f - (float) j / M);
+                    float cosThetaPlus = std::sqrt(1.f - (float) (j + 1) / M);
+                    float sinThetaCenter = std::sqrt((j + 0.5f) / M);
+                    float dist = std::min(r[j * N + k], r[j * N + kPrev]);
+                    sumV += (cosThetaMinus - cosThetaPlus) / (sinThetaCenter * dist) * (L[j * N + k][c] - L[j * N + kPrev][c]);
+                }
+                gradT += u * (2 * M_PI / N * sumU) + vMinus * sumV;
+
+                // Rotation of the hemisphere
+                for (int j = 0; j < M; ++j) {
+                    int idx = j * N + k;
+                    Vector3f v(-std::sin(phi[idx]), std::cos(phi[idx]), 0.f);
+                    gradR -= v * (sinTheta[idx] / std::max(cosTheta[idx], 1e-3f) * L[idx][c]);
+                }
+            }
+            gradR *= M_PI / (M * N);
+            record.gradT[c] = its.toWorld(gradT);
+            record.gradR[c] = its.toWorld(gradR);
+        }
+
+        // Harmonic mean distance, limited so that the gradient can't extrapolate below zero
+        float R = (M * N) / invDistSum;
+        for (int c = 0; c < 3; ++c) {
+            float grad = record.gradT[c].norm();
+            if (E[c] > 0 && grad > 0)
+                R = std::min(R, E[c] / grad);
+        }
+        record.R = clamp(R, m_minSpacing * m_sceneSize, m_maxSpacing * m_sceneSize);
+
+        m_cache->insert(record);
+        return E;
+    }
+
+    float m_error;
+    int m_gatherSamples;
+    float m_minSpacing, m_maxSpacing;
+    bool m_prepass;
+    int m_thetaStrata, m_phiStrata;
+    float m_sceneSize = 0.f;
+    IrradianceCache *m_cache = nullptr;
+    PathRoulette m_roulette;
+};
+NORI_REGISTER_CLASS(IrradianceCaching, "irradiance_cache");
+NORI_NAMESPACE_END
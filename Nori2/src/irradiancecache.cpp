@@ -0,0 +1,152 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/irradiancecache.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/// Records are not stored deeper than this in the octree
+static const int MaxDepth = 16;
+
+IrradianceCache::Node::Node() : entries(nullptr) {
+    for (int i = 0; i < 8; ++i)
+        children[i] = nullptr;
+}
+
+IrradianceCache::Node::~Node() {
+    for (int i = 0; i < 8; ++i)
+        delete children[i].load();
+    Entry *entry = entries.load();
+    while (entry) {
+        Entry *next = entry->next;
+        delete entry;
+        entry = next;
+    }
+}
+
+IrradianceCache::IrradianceCache(const BoundingBox3f &bounds, float error)
+    : m_error(error), m_recordCount(0) {
+    /* Use a cube that is slightly larger than the scene */
+    Point3f center = bounds.getCenter();
+    float extent = bounds.getExtents().maxCoeff() * 0.5f * 1.01f + Epsilon;
+    m_bounds = BoundingBox3f(center - Vector3f::Constant(extent),
+        center + Vector3f::Constant(extent));
+}
+
+IrradianceCache::~IrradianceCache() { }
+
+BoundingBox3f IrradianceCache::childBounds(const BoundingBox3f &bounds, int child) {
+    Point3f center = bounds.getCenter();
+    BoundingBox3f result;
+    for (int i = 0; i < 3; ++i) {
+        bool upper = (child >> i) & 1;
+        result.min[i] = upper ? center[i] : bounds.min[i];
+        result.max[i] = upper ? bounds.max[i] : center[i];
+    }
+    return result;
+}
+
+void IrradianceCache::insert(const Record &record) {
+    float radius = m_error * record.R;
+    BoundingBox3f dataBounds(record.p - Vector3f::Constant(radius),
+        record.p + Vector3f::Constant(radius));
+
+    insert(&m_root, m_bounds, record, dataBounds, 0);
+    ++m_recordCount;
+}
+
+void IrradianceCache::insert(Node *node, const BoundingBox3f &nodeBounds, const Record &record,
+        const BoundingBox3f &dataBounds, int depth) {
+    /* Store the record at the first level whose nodes are smaller
+       than its region of influence */
+    if (depth == MaxDepth || nodeBounds.getExtents().squaredNorm() < dataBounds.getExtents().squaredNorm()) {
+        /* Every overlapping node gets its own copy. Push it to the front
+           of the list; readers only ever see fully constructed entries */
+        Entry *entry = new Entry { record, node->entries.load() };
+        while (!node->entries.compare_exchange_weak(entry->next, entry))
+            ;
+        return;
+    }
+
+    for (int child = 0; child < 8; ++child) {
+        BoundingBox3f bounds = childBounds(nodeBounds, child);
+        if (!bounds.overlaps(dataBounds))
+            continue;
+
+        Node *childNode = node->children[child].load();
+        if (!childNode) {
+            /* Another thread may create the same child concurrently */
+            Node *created = new Node();
+            if (node->children[child].compare_exchange_strong(childNode, created))
+                childNode = created;
+            else
+                delete created;
+        }
+        insert(childNode, bounds, record, dataBounds, depth + 1);
+    }
+}
+
+bool IrradianceCache::lookup(const Point3f &p, const Normal3f &n, Color3f &E) const {
+    if (!m_bounds.contains(p))
+        return false;
+
+    Color3f sum(0.f);
+    float weightSum = 0.f;
+
+    const Node *node = &m_root;
+    BoundingBox3f nodeBounds = m_bounds;
+    while (node) {
+        for (const Entry *entry = node->entries.load(); entry; entry = entry->next) {
+            const Record &r = entry->record;
+            Vector3f d = p - r.p;
+
+            /* Skip records in front of the point, they see other geometry */
+            if (d.dot(r.n + n) * 0.5f < -0.01f * r.R)
+                continue;
+
+            float err = (d.norm() / r.R + std::sqrt(std::max(0.f, 1.f - n.dot(r.n)))) / m_error;
+            if (err >= 1.f)
+                continue;
+
+            /* Extrapolate the record with its gradients */
+            Vector3f rotation = r.n.cross(n);
+            Color3f value;
+            for (int c = 0; c < 3; ++c)
+                value[c] = std::max(0.f, r.E[c] + rotation.dot(r.gradR[c]) + d.dot(r.gradT[c]));
+
+            float w = (1.f - err) * (1.f - err);
+            sum += value * w;
+            weightSum += w;
+        }
+
+        /* Descend to the child that contains the point */
+        Point3f center = nodeBounds.getCenter();
+        int child = (p.x() > center.x() ? 1 : 0) | (p.y() > center.y() ? 2 : 0) | (p.z() > center.z() ? 4 : 0);
+        nodeBounds = childBounds(nodeBounds, child);
+        node = node->children[child].load();
+    }
+
+    if (weightSum <= 0.f)
+        return false;
+    E = sum / weightSum;
+    return true;
+}
+
+NORI_NAMESPACE_END
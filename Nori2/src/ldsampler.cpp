@@ -0,0 +1,485 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <pcg32.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Largest float that is strictly smaller than one
+static const float OneMinusEpsilon = 0.99999994f;
+
+/// Mix the bits of a 64-bit integer (finalizer of MurmurHash3)
+static inline uint64_t mixBits(uint64_t v) {
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+static inline uint32_t reverseBits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+/**
+ * \brief Owen scrambling of a 32-bit fixed point number in base 2
+ *
+ * Every bit is flipped depending on a hash of the more significant bits,
+ * which randomizes a (0,m,2)-net while preserving its stratification
+ * (Burley, "Practical Hash-based Owen Scrambling", JCGT 2020).
+ */
+static inline uint32_t owenScramble(uint32_t v, uint32_t seed) {
+    v = reverseBits(v);
+    v += seed;
+    v ^= v * 0x6c50b47cu;
+    v ^= v * 0xb82f1e52u;
+    v ^= v * 0xc7afe638u;
+    v ^= v * 0x8d22f6e6u;
+    return reverseBits(v);
+}
+
+/// Convert a 32-bit fixed point number to a float in [0, 1)
+static inline float toUnitFloat(uint32_t v) {
+    return std::min(v * 2.3283064365386963e-10f, OneMinusEpsilon);
+}
+
+/**
+ * \brief Base class of the low-discrepancy samplers
+ *
+ * Keeps track of the current pixel, sample index and dimension. Each
+ * \ref next1D() call consumes one dimension and each \ref next2D() call
+ * two. Every pixel and every dimension (or pair of dimensions) uses a
+ * differently randomized copy of the underlying point set, so that the
+ * error is uncorrelated between pixels and between e.g. the lens and the
+ * light samples. Dimensions past \ref getMaxDimension() fall back to
+ * independent random numbers.
+ */
+class LDSampler : public Sampler {
+public:
+    LDSampler(const PropertyList &propList) : m_sampleIndex(0), m_dimension(0) {
+        m_sampleCount = (size_t) propList.getInteger("sampleCount", 1);
+        m_seed = (uint32_t) propList.getInteger("seed", 0);
+    }
+
+    void prepare(const ImageBlock &block) {
+        m_random.seed(
+            block.getOffset().x() + m_seed,
+            block.getOffset().y() + m_seed
+        );
+    }
+
+    void setPixel(const Point2i &pixel) {
+        m_pixel = pixel;
+        m_pixelKey = (uint64_t) (uint32_t) pixel.x() << 32 | (uint32_t) pixel.y();
+    }
+
+    void generate() {
+        m_sampleIndex = 0;
+        m_dimension = 0;
+    }
+
+    void advance() {
+        m_sampleIndex++;
+        m_dimension = 0;
+    }
+
+    float next1D() {
+        if (m_dimension >= getMaxDimension())
+            return m_random.nextFloat();
+        return sample1D(m_dimension++);
+    }
+
+    Point2f next2D() {
+        if (m_dimension + 1 >= getMaxDimension())
+            return Point2f(m_random.nextFloat(), m_random.nextFloat());
+        Point2f result = sample2D(m_dimension);
+        m_dimension += 2;
+        return result;
+    }
+
+protected:
+    /// Return the number of dimensions that are sampled from the sequence
+    virtual int getMaxDimension() const = 0;
+
+    /// Return the current sample's component in the given dimension
+    virtual float sample1D(int dimension) const = 0;
+
+    /// Return the current sample's components in the given pair of dimensions
+    virtual Point2f sample2D(int dimension) const = 0;
+
+    /// Hash of the current pixel and the given dimension
+    uint32_t hash(int dimension, uint32_t salt = 0) const {
+        return (uint32_t) mixBits(m_pixelKey ^
+            mixBits(((uint64_t) m_seed << 32 | (uint32_t) dimension) ^ ((uint64_t) salt << 48)));
+    }
+
+    uint32_t m_seed;
+    pcg32 m_random;
+    Point2i m_pixel = Point2i::Zero();
+    uint64_t m_pixelKey = 0; ///< Decorrelates the randomization of the pixels
+    uint32_t m_sampleIndex;
+    int m_dimension;
+};
+
+/**
+ * Owen-scrambled Sobol sequence
+ *
+ * Uses the first two dimensions of the Sobol sequence, which form a
+ * (0,2)-sequence in base 2. Higher dimensions are "padded": every 1D or
+ * 2D request draws from an independently shuffled and scrambled copy of
+ * this sequence, which keeps each pair of dimensions well stratified
+ * without the poor projections of high-dimensional Sobol points.
+ *
+ * With <tt>blueNoise=true</tt>, the pixels of a 64x64 tile are not
+ * randomized independently but share one sequence: the pixel's Morton
+ * index within the tile selects a contiguous range of sample indices.
+ * Every aligned 2^k x 2^k group of pixels then uses a contiguous, aligned
+ * block of the (scrambled) sequence, i.e. a well stratified point set,
+ * so that neighboring pixels have complementary errors and the error is
+ * distributed as blue noise in screen space (Ahmed and Wonka, "Screen-
+ * Space Blue-Noise Diffusion of Monte Carlo Sampling Error via
+ * Hierarchical Ordering of Pixels", 2020). This makes previews at 1-4 spp
+ * look much less noisy. The index shuffle (a nested scramble) permutes
+ * the quadrants at every level, which avoids a visible Z-order pattern.
+ */
+class Sobol : public LDSampler {
+public:
+    Sobol(const PropertyList &propList) : LDSampler(propList) {
+        m_blueNoise = propList.getBoolean("blueNoise", false);
+    }
+
+    void setPixel(const Point2i &pixel) {
+        LDSampler::setPixel(pixel);
+        if (!m_blueNoise)
+            return;
+
+        /* Only decorrelate the tiles */
+        m_pixelKey = (uint64_t) (uint32_t) (pixel.x() >> TileBits) << 32 |
+            (uint32_t) (pixel.y() >> TileBits);
+
+        /* Reserve a power-of-two range of indices for every pixel */
+        m_sampleBits = 0;
+        while ((1u << m_sampleBits) < m_sampleCount && m_sampleBits < 32 - 2 * TileBits)
+            m_sampleBits++;
+
+        uint32_t morton = 0;
+        for (int i = 0; i < TileBits; ++i)
+            morton |= (((pixel.x() >> i) & 1) << (2 * i)) | (((pixel.y() >> i) & 1) << (2 * i + 1));
+        m_pixelOffset = morton << m_sampleBits;
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        return std::unique_ptr<Sampler>(new Sobol(*this));
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Sobol[\n"
+            "  sampleCount=%i,\n"
+            "  seed = %i,\n"
+            "  blueNoise = %s,\n"
+            "]",
+            m_sampleCount,
+            m_seed,
+            m_blueNoise ? "true" : "false");
+    }
+
+protected:
+    /// Size of the blue noise tiles (log2)
+    static const int TileBits = 6;
+
+    int getMaxDimension() const { return 1024; }
+
+    /// Shuffle the sample order (a nested uniform scramble of the index)
+    uint32_t shuffledIndex(int dimension) const {
+        uint32_t index = m_sampleIndex;
+        if (m_blueNoise)
+            index = m_pixelOffset + (index & ((1u << m_sampleBits) - 1));
+        return owenScramble(index, hash(dimension));
+    }
+
+    static uint32_t sobol0(uint32_t index) {
+        return reverseBits(index);
+    }
+
+    static uint32_t sobol1(uint32_t index) {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+        return result;
+    }
+
+    float sample1D(int dimension) const {
+        uint32_t index = shuffledIndex(dimension);
+        return toUnitFloat(owenScramble(sobol0(index), hash(dimension, 1)));
+    }
+
+    Point2f sample2D(int dimension) const {
+        uint32_t index = shuffledIndex(dimension);
+        return Point2f(
+            toUnitFloat(owenScramble(sobol0(index), hash(dimension, 1))),
+            toUnitFloat(owenScramble(sobol1(index), hash(dimension, 2)))
+        );
+    }
+
+    bool m_blueNoise;
+    int m_sampleBits = 0;
+    uint32_t m_pixelOffset = 0;
+};
+
+/**
+ * Progressive multi-jittered (0,2) sequence
+ *
+ * A table of pmj02 points is generated once with the construction of
+ * Christensen et al. ("Progressive Multi-Jittered Sample Sequences",
+ * EGSR 2018): every power-of-two prefix is stratified in all elementary
+ * intervals. Dimensions are decorrelated like in the \ref Sobol sampler,
+ * with a shuffled sample order and a random XOR of the digits (which
+ * preserves the (0,2) property) per pixel and dimension. Sample counts
+ * beyond the table size reuse the table with a different XOR.
+ */
+class PMJ02 : public LDSampler {
+public:
+    PMJ02(const PropertyList &propList) : LDSampler(propList) {
+        generateTable();
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        return std::unique_ptr<Sampler>(new PMJ02(*this));
+    }
+
+    void setSampleCount(int sampleCount) {
+        LDSampler::setSampleCount(sampleCount);
+        generateTable();
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "PMJ02[\n"
+            "  sampleCount=%i,\n"
+            "  tableSize=%i,\n"
+            "  seed = %i,\n"
+            "]",
+            m_sampleCount,
+            m_table->size(),
+            m_seed);
+    }
+
+protected:
+    /// Upper bound on the table size (the construction takes O(n^2) time)
+    static const uint32_t MaxTableSize = 4096;
+
+    typedef std::pair<uint32_t, uint32_t> Point2u;
+
+    /// Occupancy of the elementary intervals of the point set being built
+    struct Strata {
+        std::vector<std::vector<bool>> occupied;
+        int count;
+
+        Strata(const std::vector<Point2f> &points, int count) : count(count) {
+            int levels = 0;
+            while ((1 << levels) < count)
+                levels++;
+            occupied.assign(levels + 1, std::vector<bool>(count, false));
+            for (const Point2f &p : points)
+                mark(p);
+        }
+
+        int cell(const Point2f &p, int level) const {
+            int xdivs = 1 << level, ydivs = count >> level;
+            return (int) (p.x() * xdivs) + (int) (p.y() * ydivs) * xdivs;
+        }
+
+        bool isOccupied(const Point2f &p) const {
+            for (size_t level = 0; level < occupied.size(); ++level)
+                if (occupied[level][cell(p, (int) level)])
+                    return true;
+            return false;
+        }
+
+        void mark(const Point2f &p) {
+            for (size_t level = 0; level < occupied.size(); ++level)
+                occupied[level][cell(p, (int) level)] = true;
+        }
+    };
+
+    /// Draw a point within a sub-quadrant of cell (i, j) that does not hit an occupied stratum
+    static Point2f samplePoint(Strata &strata, pcg32 &random, int i, int j, int xhalf, int yhalf, int n) {
+        while (true) {
+            Point2f p(
+                (i + 0.5f * (xhalf + random.nextFloat())) / n,
+                (j + 0.5f * (yhalf + random.nextFloat())) / n);
+            if (!strata.isOccupied(p)) {
+                strata.mark(p);
+                return p;
+            }
+        }
+    }
+
+    void generateTable() {
+        uint32_t size = 1;
+        while (size < m_sampleCount && size < MaxTableSize)
+            size *= 2;
+        if (m_table && m_table->size() == size)
+            return;
+
+        pcg32 random(m_seed);
+        std::vector<Point2f> points(1, Point2f(random.nextFloat(), random.nextFloat()));
+
+        while (points.size() < size) {
+            int N = (int) points.size();
+            bool even = (N & 0x55555555) != 0; /* N is a power of four */
+            int n = (int) std::lround(std::sqrt(even ? N : N / 2));
+            Strata strata(points, 2 * N);
+            points.resize(2 * N);
+
+            for (int s = 0; s < (even ? N : N / 2); ++s) {
+                const Point2f &p = points[s];
+                int i = (int) (n * p.x()), j = (int) (n * p.y());
+                int xhalf = (int) (2 * (n * p.x() - i)), yhalf = (int) (2 * (n * p.y() - j));
+
+                if (even) {
+                    /* Place the new point in the diagonally opposite sub-quadrant */
+                    points[N + s] = samplePoint(strata, random, i, j, 1 - xhalf, 1 - yhalf, n);
+                } else {
+                    /* Fill the two remaining sub-quadrants in random order */
+                    int ax = 1 - xhalf, ay = yhalf, bx = xhalf, by = 1 - yhalf;
+                    if (random.nextUInt() & 1) {
+                        std::swap(ax, bx);
+                        std::swap(ay, by);
+                    }
+                    points[N + s] = samplePoint(strata, random, i, j, ax, ay, n);
+                    points[N + N / 2 + s] = samplePoint(strata, random, i, j, bx, by, n);
+                }
+            }
+        }
+
+        std::shared_ptr<std::vector<Point2u>> table(new std::vector<Point2u>(size));
+        for (uint32_t k = 0; k < size; ++k)
+            (*table)[k] = Point2u((uint32_t) (points[k].x() * 4294967296.0), (uint32_t) (points[k].y() * 4294967296.0));
+        m_table = table;
+    }
+
+    int getMaxDimension() const { return 1024; }
+
+    const Point2u &lookup(int dimension, uint32_t &round) const {
+        uint32_t size = (uint32_t) m_table->size();
+        round = m_sampleIndex / size;
+        /* The low bits of a scrambled index are a permutation of the table */
+        uint32_t index = owenScramble(m_sampleIndex % size, hash(dimension, 3 * round)) & (size - 1);
+        return (*m_table)[index];
+    }
+
+    float sample1D(int dimension) const {
+        uint32_t round;
+        const Point2u &p = lookup(dimension, round);
+        return toUnitFloat(p.first ^ hash(dimension, 3 * round + 1));
+    }
+
+    Point2f sample2D(int dimension) const {
+        uint32_t round;
+        const Point2u &p = lookup(dimension, round);
+        return Point2f(
+            toUnitFloat(p.first ^ hash(dimension, 3 * round + 1)),
+            toUnitFloat(p.second ^ hash(dimension, 3 * round + 2))
+        );
+    }
+
+    std::shared_ptr<const std::vector<Point2u>> m_table;
+};
+
+/**
+ * Owen-scrambled Halton sequence
+ *
+ * Dimension \c d uses the radical inverse in the d-th prime base, with
+ * the digits randomly permuted depending on the pixel (a nested random
+ * digit shift, i.e. a variant of Owen scrambling in base b).
+ */
+class Halton : public LDSampler {
+public:
+    Halton(const PropertyList &propList) : LDSampler(propList) { }
+
+    std::unique_ptr<Sampler> clone() const {
+        return std::unique_ptr<Sampler>(new Halton(*this));
+    }
+
+    std::string toString() const {
+        return tfm::format(
+            "Halton[\n"
+            "  sampleCount=%i,\n"
+            "  seed = %i,\n"
+            "]",
+            m_sampleCount,
+            m_seed);
+    }
+
+protected:
+    static const int PrimeCount = 64;
+    static const int Primes[PrimeCount];
+
+    int getMaxDimension() const { return PrimeCount; }
+
+    float radicalInverse(int dimension) const {
+        uint32_t base = (uint32_t) Primes[dimension];
+        uint32_t seed = hash(dimension);
+        uint64_t index = m_sampleIndex, prefix = 0;
+        double invBase = 1.0 / base, invBaseM = 1.0, result = 0.0;
+
+        /* Keep going after the index runs out of digits, since the
+           scrambled zeros contribute as well */
+        while (invBaseM > 1e-9) {
+            uint32_t digit = (uint32_t) (index % base);
+            index /= base;
+            uint32_t shift = (uint32_t) mixBits(prefix ^ ((uint64_t) seed << 32)) % base;
+            digit = (digit + shift) % base;
+            prefix = prefix * base + digit + 1;
+            invBaseM *= invBase;
+            result += digit * invBaseM;
+        }
+        return std::min((float) result, OneMinusEpsilon);
+    }
+
+    float sample1D(int dimension) const {
+        return radicalInverse(dimension);
+    }
+
+    Point2f sample2D(int dimension) const {
+        return Point2f(radicalInverse(dimension), radicalInverse(dimension + 1));
+    }
+};
+
+const int Halton::Primes[Halton::PrimeCount] = {
+      2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+     59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+
+NORI_REGISTER_CLASS(Sobol, "sobol");
+NORI_REGISTER_CLASS(PMJ02, "pmj02");
+NORI_REGISTER_CLASS(Halton, "halton");
+NORI_NAMESPACE_END
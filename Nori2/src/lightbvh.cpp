@@ -0,0 +1,333 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/lightbvh.h>
+#include <nori/emitter.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/// Number of buckets for evaluating split candidates
+static const int LightBVHBuckets = 12;
+
+static inline float safeSqrt(float value) {
+    return std::sqrt(std::max(value, 0.f));
+}
+
+static inline float safeAcos(float value) {
+    return std::acos(clamp(value, -1.f, 1.f));
+}
+
+/// cos(max(0, a - b)) given the sines and cosines of two angles
+static inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    if (cosA > cosB)
+        return 1;
+    return cosA * cosB + sinA * sinB;
+}
+
+/// sin(max(0, a - b)) given the sines and cosines of two angles
+static inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    if (cosA > cosB)
+        return 0;
+    return sinA * cosB - cosA * sinB;
+}
+
+float LightBounds::importance(const Point3f &p, const Normal3f &n) const {
+    /* Clamp the distance to the center to avoid huge values inside the bounds */
+    Point3f center = bounds.getCenter();
+    float d2 = (p - center).squaredNorm();
+    d2 = std::max(d2, bounds.getExtents().norm() / 2);
+
+    /* Angle between the cone axis and the direction towards p */
+    Vector3f wi = (p - center).normalized();
+    float cosTheta_w = w.dot(wi);
+    if (twoSided)
+        cosTheta_w = std::abs(cosTheta_w);
+    float sinTheta_w = safeSqrt(1 - cosTheta_w * cosTheta_w);
+
+    /* Angle subtended by the bounding sphere of the bounds as seen from p */
+    float radius2 = (bounds.max - center).squaredNorm();
+    float cosTheta_b = -1;
+    if ((p - center).squaredNorm() >= radius2)
+        cosTheta_b = safeSqrt(1 - radius2 / (p - center).squaredNorm());
+    float sinTheta_b = safeSqrt(1 - cosTheta_b * cosTheta_b);
+
+    /* Minimum angle between an emission direction and the direction to p */
+    float sinTheta_o = safeSqrt(1 - cosTheta_o * cosTheta_o);
+    float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float cosThetap = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap <= cosTheta_e)
+        return 0;
+
+    float result = phi * cosThetap / d2;
+
+    /* Bound the cosine at the receiver */
+    if (n != Normal3f::Zero()) {
+        float cosTheta_i = std::abs(wi.dot(n));
+        float sinTheta_i = safeSqrt(1 - cosTheta_i * cosTheta_i);
+        result *= cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+    }
+
+    return std::max(result, 0.f);
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b) {
+    if (!a.bounds.isValid())
+        return b;
+    if (!b.bounds.isValid())
+        return a;
+
+    LightBounds result;
+    result.bounds = BoundingBox3f::merge(a.bounds, b.bounds);
+    result.phi = a.phi + b.phi;
+    result.cosTheta_e = std::min(a.cosTheta_e, b.cosTheta_e);
+    result.twoSided = a.twoSided || b.twoSided;
+
+    /* Smallest cone that contains both direction cones */
+    float theta_a = safeAcos(a.cosTheta_o), theta_b = safeAcos(b.cosTheta_o);
+    float theta_d = safeAcos(a.w.dot(b.w));
+    if (std::min(theta_d + theta_b, (float) M_PI) <= theta_a) {
+        result.w = a.w;
+        result.cosTheta_o = a.cosTheta_o;
+    } else if (std::min(theta_d + theta_a, (float) M_PI) <= theta_b) {
+        result.w = b.w;
+        result.cosTheta_o = b.cosTheta_o;
+    } else {
+        float theta_o = (theta_a + theta_d + theta_b) / 2;
+        Vector3f axis = a.w.cross(b.w);
+        if (theta_o >= M_PI || axis.squaredNorm() == 0) {
+            result.w = a.w;
+            result.cosTheta_o = -1;
+        } else {
+            /* Rotate a's axis towards b's */
+            result.w = Eigen::AngleAxis<float>(theta_o - theta_a, axis.normalized()) * a.w;
+            result.cosTheta_o = std::cos(theta_o);
+        }
+    }
+    return result;
+}
+
+/// Depth of a balanced tree over \c count leaves, i.e. ceil(log2(count))
+static int balancedDepth(size_t count) {
+    int depth = 0;
+    while (depth < 64 && ((uint64_t) 1 << depth) < count)
+        ++depth;
+    return depth;
+}
+
+/// Cost of a subtree in the surface area orientation heuristic (SAOH)
+static float evaluateCost(const LightBounds &b, const BoundingBox3f &bounds, int axis) {
+    float theta_o = safeAcos(b.cosTheta_o), theta_e = safeAcos(b.cosTheta_e);
+    float theta_w = std::min(theta_o + theta_e, (float) M_PI);
+    float sinTheta_o = safeSqrt(1 - b.cosTheta_o * b.cosTheta_o);
+    float M_omega = 2 * M_PI * (1 - b.cosTheta_o) +
+        M_PI / 2 * (2 * theta_w * sinTheta_o - std::cos(theta_o - 2 * theta_w) -
+                    2 * theta_o * sinTheta_o + b.cosTheta_o);
+
+    /* Penalize thin splits */
+    Vector3f extents = bounds.getExtents();
+    float Kr = extents.maxCoeff() / std::max(extents[axis], 1e-6f);
+    return b.phi * M_omega * Kr * b.bounds.getSurfaceArea();
+}
+
+LightBVH::LightBVH(const std::vector<const Emitter *> &emitters) {
+    std::vector<std::pair<uint32_t, LightBounds>> lights;
+    for (const Emitter *emitter : emitters) {
+        LightBounds bounds;
+        if (!emitter->getLightBounds(bounds)) {
+            m_infinite.push_back(emitter);
+            continue;
+        }
+        if (!(bounds.phi > 0))
+            continue;
+        lights.push_back(std::make_pair((uint32_t) m_emitters.size(), bounds));
+        m_emitters.push_back(emitter);
+    }
+
+    if (!lights.empty())
+        build(lights, 0, lights.size(), 0, 0);
+}
+
+uint32_t LightBVH::build(std::vector<std::pair<uint32_t, LightBounds>> &lights,
+        size_t start, size_t end, uint64_t bitTrail, int depth) {
+    uint32_t nodeIndex = (uint32_t) m_nodes.size();
+
+    if (end - start == 1) {
+        m_nodes.push_back(Node { lights[start].second, lights[start].first, true });
+        m_bitTrails[m_emitters[lights[start].first]] = bitTrail;
+        return nodeIndex;
+    }
+
+    BoundingBox3f bounds, centroidBounds;
+    for (size_t i = start; i < end; ++i) {
+        bounds.expandBy(lights[i].second.bounds);
+        centroidBounds.expandBy(lights[i].second.bounds.getCenter());
+    }
+
+    /* Find the split with the lowest SAOH cost */
+    float minCost = std::numeric_limits<float>::infinity();
+    int minAxis = -1, minBucket = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+        float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        if (!(extent > 0))
+            continue;
+
+        LightBounds buckets[LightBVHBuckets];
+        for (size_t i = start; i < end; ++i) {
+            float t = (lights[i].second.bounds.getCenter()[axis] - centroidBounds.min[axis]) / extent;
+            int b = std::min((int) (t * LightBVHBuckets), LightBVHBuckets - 1);
+            buckets[b] = LightBounds::merge(buckets[b], lights[i].second);
+        }
+
+        for (int split = 1; split < LightBVHBuckets; ++split) {
+            LightBounds below, above;
+            for (int b = 0; b < split; ++b)
+                below = LightBounds::merge(below, buckets[b]);
+            for (int b = split; b < LightBVHBuckets; ++b)
+                above = LightBounds::merge(above, buckets[b]);
+            if (!below.bounds.isValid() || !above.bounds.isValid())
+                continue;
+            float cost = evaluateCost(below, bounds, axis) + evaluateCost(above, bounds, axis);
+            if (cost < minCost) {
+                minCost = cost;
+                minAxis = axis;
+                minBucket = split;
+            }
+        }
+    }
+
+    /* Partition the emitters; fall back to an even split for coincident
+       centroids and when a child could no longer be split evenly within the
+       64 bits of the bit trails. As even splits halve the emitters, every
+       leaf then lies at most 64 levels deep */
+    size_t mid = start;
+    if (minAxis >= 0) {
+        float extent = centroidBounds.max[minAxis] - centroidBounds.min[minAxis];
+        mid = std::partition(lights.begin() + start, lights.begin() + end,
+            [&](const std::pair<uint32_t, LightBounds> &light) {
+                float t = (light.second.bounds.getCenter()[minAxis] - centroidBounds.min[minAxis]) / extent;
+                return std::min((int) (t * LightBVHBuckets), LightBVHBuckets - 1) < minBucket;
+            }) - lights.begin();
+    }
+    if (mid == start || mid == end ||
+            depth + 1 + balancedDepth(std::max(mid - start, end - mid)) > 64) {
+        int axis = centroidBounds.getMajorAxis();
+        mid = (start + end) / 2;
+        std::nth_element(lights.begin() + start, lights.begin() + mid, lights.begin() + end,
+            [axis](const std::pair<uint32_t, LightBounds> &a, const std::pair<uint32_t, LightBounds> &b) {
+                return a.second.bounds.getCenter()[axis] < b.second.bounds.getCenter()[axis];
+            });
+    }
+
+    m_nodes.push_back(Node());
+    build(lights, start, mid, bitTrail, depth + 1);
+    uint32_t second = build(lights, mid, end, bitTrail | (1ull << depth), depth + 1);
+
+    m_nodes[nodeIndex].bounds = LightBounds::merge(m_nodes[nodeIndex + 1].bounds, m_nodes[second].bounds);
+    m_nodes[nodeIndex].index = second;
+    m_nodes[nodeIndex].leaf = false;
+    return nodeIndex;
+}
+
+const Emitter *LightBVH::sample(const Point3f &p, const Normal3f &n, float rnd, float &pmf) const {
+    const float OneMinusEpsilon = 0.99999994f;
+
+    if (m_nodes.empty() && m_infinite.empty()) {
+        pmf = 0;
+        return nullptr;
+    }
+
+    /* Choose between the infinite emitters and the hierarchy */
+    float pHierarchy = hierarchyProbability();
+    if (rnd < 1 - pHierarchy) {
+        size_t index = std::min((size_t) (rnd / (1 - pHierarchy) * m_infinite.size()),
+            m_infinite.size() - 1);
+        pmf = (1 - pHierarchy) / m_infinite.size();
+        return m_infinite[index];
+    }
+    rnd = std::min((rnd - (1 - pHierarchy)) / pHierarchy, OneMinusEpsilon);
+    pmf = pHierarchy;
+
+    uint32_t nodeIndex = 0;
+    while (true) {
+        const Node &node = m_nodes[nodeIndex];
+        if (node.leaf) {
+            if (nodeIndex > 0 || node.bounds.importance(p, n) > 0)
+                return m_emitters[node.index];
+            pmf = 0;
+            return nullptr;
+        }
+
+        /* Choose a child proportionally to its importance */
+        float importance0 = m_nodes[nodeIndex + 1].bounds.importance(p, n);
+        float importance1 = m_nodes[node.index].bounds.importance(p, n);
+        if (importance0 == 0 && importance1 == 0) {
+            pmf = 0;
+            return nullptr;
+        }
+
+        float p0 = importance0 / (importance0 + importance1);
+        if (rnd < p0) {
+            rnd = std::min(rnd / p0, OneMinusEpsilon);
+            pmf *= p0;
+            nodeIndex = nodeIndex + 1;
+        } else {
+            rnd = std::min((rnd - p0) / (1 - p0), OneMinusEpsilon);
+            pmf *= 1 - p0;
+            nodeIndex = node.index;
+        }
+    }
+}
+
+float LightBVH::pmf(const Point3f &p, const Normal3f &n, const Emitter *emitter) const {
+    float pHierarchy = hierarchyProbability();
+    if (std::find(m_infinite.begin(), m_infinite.end(), emitter) != m_infinite.end())
+        return (1 - pHierarchy) / m_infinite.size();
+
+    auto it = m_bitTrails.find(emitter);
+    if (it == m_bitTrails.end())
+        return 0;
+
+    /* Follow the path to the emitter and multiply the child probabilities */
+    uint64_t bitTrail = it->second;
+    float pmf = pHierarchy;
+    uint32_t nodeIndex = 0;
+    while (true) {
+        const Node &node = m_nodes[nodeIndex];
+        if (node.leaf)
+            return (nodeIndex > 0 || node.bounds.importance(p, n) > 0) ? pmf : 0;
+
+        float importance0 = m_nodes[nodeIndex + 1].bounds.importance(p, n);
+        float importance1 = m_nodes[node.index].bounds.importance(p, n);
+        if (importance0 == 0 && importance1 == 0)
+            return 0;
+
+        if (bitTrail & 1) {
+            pmf *= importance1 / (importance0 + importance1);
+            nodeIndex = node.index;
+        } else {
+            pmf *= importance0 / (importance0 + importance1);
+            nodeIndex = nodeIndex + 1;
+        }
+        bitTrail >>= 1;
+    }
+}
+
+NORI_NAMESPACE_END
@@ -24,59 +24,85 @@
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
+#include <nori/render.h>
+#include <nori/denoiser.h>
+#include <nori/server.h>
 #include <nori/gui.h>
-#include <tbb/parallel_for.h>
-#include <tbb/blocked_range.h>
 #include <tbb/task_scheduler_init.h>
+#include <ImfThreading.h>
 #include <filesystem/resolver.h>
 #include <thread>
 
 using namespace nori;
 
 static int threadCount = -1;
+static std::string compositeName;
+static int shardIndex = 0, shardCount = 1;
+static bool denoise = false, saveFeatures = false;
+static bool streamOutput = false;
+static EXRSettings exrSettings;
+
+/// Split a "path.property=value" argument into its key and value
+static bool splitOverride(const std::string &arg, std::string &key, std::string &value) {
+    size_t pos = arg.find('=');
+    if (pos == std::string::npos || pos == 0)
+        return false;
+    key = arg.substr(0, pos);
+    value = arg.substr(pos + 1);
+    return true;
+}
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
-    Point2i offset = block.getOffset();
-    Vector2i size  = block.getSize();
+/// Add the default denoiser to a scene without one when requested by "--denoise"
+static void addDefaultDenoiser(Scene *scene) {
+    if (!denoise || scene->getDenoiser())
+        return;
+    NoriObject *denoiser = NoriObjectFactory::createInstance("bilateral", PropertyList());
+    scene->addChild(denoiser);
+    denoiser->setParent(scene);
+    denoiser->activate();
+}
 
-    /* Clear the block contents */
-    block.clear();
+static void render(Scene* scene, const std::string& filename, bool nogui,
+        const std::string &suffix = "") {
+    const Camera* camera = scene->getCamera();
 
-    /* For each pixel and pixel sample sample */
-    for (int y=0; y<size.y(); ++y) {
-        for (int x=0; x<size.x(); ++x) {
-            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
-                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+    /* Determine the filename of the output bitmap */
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+    outputName += "_" + std::to_string(scene->getSampler()->getSampleCount()) + suffix;
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+    bool fullImage = shardCount == 1 && compositeName.empty();
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
+    /* Write the image while it is rendered, without keeping it in memory */
+    if (streamOutput) {
+        if (!fullImage || scene->getDenoiser() || saveFeatures)
+            cout << "Only full renders without a denoiser or AOVs can be streamed, rendering the whole image" << endl;
+        else if (scene->getIntegrator()->needsWholeImage())
+            cout << "The integrator needs the whole image, rendering it without streaming" << endl;
+        else {
+            tbb::task_scheduler_init init(threadCount);
+            renderSceneStreaming(scene, outputName, exrSettings);
+            return;
         }
     }
-}
 
-static void render(Scene* scene, const std::string& filename, bool nogui) {
-    const Camera* camera = scene->getCamera();
-    Vector2i outputSize = camera->getOutputSize();
-    scene->getIntegrator()->preprocess(scene);
+    /* Allocate memory for the output image (or its crop window) and clear it */
+    std::unique_ptr<ImageBlock> resultPtr(createImageBlock(camera));
+    ImageBlock &result = *resultPtr;
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    /* Feature buffers for the denoiser and the AOV output (not for partial images) */
+    std::unique_ptr<FeatureBuffers> features;
+    if ((scene->getDenoiser() || saveFeatures) && !fullImage)
+        cout << "Shards and composited crops are neither denoised nor written with AOVs" << endl;
+    if ((scene->getDenoiser() || saveFeatures) && fullImage)
+        features.reset(new FeatureBuffers(camera->getCropSize()));
 
-    /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    result.clear();
+    /* Render the AOVs of the integrator into layers of the result */
+    if (saveFeatures && fullImage)
+        result.setLayers(scene->getIntegrator()->getAOVNames());
 
     /* Create a window that visualizes the partially rendered result */
     NoriScreen* screen = 0;
@@ -89,45 +115,7 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
     /* Do the following in parallel and asynchronously */
     std::thread render_thread([&] {
         tbb::task_scheduler_init init(threadCount);
-
-        cout << "Rendering .. ";
-        cout.flush();
-        Timer timer;
-
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
-
-        auto map = [&](const tbb::blocked_range<int>& range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
-
-            /* Create a clone of the sampler for the current thread */
-            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
-
-            for (int i = range.begin(); i < range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
-
-                /* Inform the sampler about the block to be rendered */
-                sampler->prepare(block);
-
-                /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
-
-                /* The image block has been processed. Now add it to
-                   the "big" block that represents the entire image */
-                result.put(block);
-            }
-        };
-
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
-
-        /// (equivalent to the following single-threaded call)
-        // map(range);
-
-        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        renderScene(scene, result, nullptr, shardIndex, shardCount, features.get());
     });
 
     if (!nogui)
@@ -146,33 +134,64 @@ static void render(Scene* scene, const std::string& filename, bool nogui) {
     else
         render_thread.join();
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    if (shardCount > 1) {
+        /* Keep the weights so that the shards can be merged later on */
+        outputName += "_shard" + std::to_string(shardIndex) + "-" + std::to_string(shardCount);
+        result.savePartialEXR(outputName, camera->getOutputSize(), shardIndex, shardCount);
+        return;
+    }
 
-    /* Determine the filename of the output bitmap */
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
+    if (!compositeName.empty()) {
+        /* Paste the crop window over a previous full render */
+        Bitmap bitmap(compositeName);
+        if (bitmap.cols() != camera->getOutputSize().x() || bitmap.rows() != camera->getOutputSize().y())
+            throw NoriException("\"%s\" does not match the output size %s",
+                compositeName, camera->getOutputSize().toString());
+        compositeImage(result, bitmap);
+        bitmap.saveEXR(outputName, std::vector<BitmapLayer>(), exrSettings);
+        bitmap.savePNG(outputName);
+        return;
+    }
+
+    /* Save using the OpenEXR and PNG formats (with the AOVs as layers of the former) */
+    saveImage(result, outputName, saveFeatures ? features.get() : nullptr, exrSettings);
 
-    outputName += "_" + std::to_string(scene->getSampler()->getSampleCount());
-    /* Save using the OpenEXR format */
-    bitmap->saveEXR(outputName);
+    if (features && scene->getDenoiser()) {
+        cout << "Denoising .. ";
+        cout.flush();
+        Timer timer;
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        std::unique_ptr<Bitmap> denoised(scene->getDenoiser()->denoise(*bitmap, *features));
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
 
-    /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName);
+        denoised->saveEXR(outputName + "_denoised", std::vector<BitmapLayer>(), exrSettings);
+        denoised->savePNG(outputName + "_denoised");
+    }
 }
 
 int main(int argc, char **argv) {
     if (argc < 2) {
         cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
+        cerr << "        " << argv[0] << " --server (read render jobs from stdin)" << endl;
+        cerr << "Options: -D <path.property>=<value> (override a scene property)" << endl;
+        cerr << "         --sweep <path.property>=<value1>;<value2>;... (render once per value)" << endl;
+        cerr << "         --crop <x>,<y>,<width>,<height> (only render a part of the image)" << endl;
+        cerr << "         --composite <image.exr> (paste the crop window over a previous render)" << endl;
+        cerr << "         --shard <index>/<count> (only render a part of the blocks, see mergetool)" << endl;
+        cerr << "         --denoise (also write a denoised image, see <denoiser> in the scene)" << endl;
+        cerr << "         --aovs (also write the features and the AOVs of the integrator as layers of the EXR file)" << endl;
+        cerr << "         --stream (write the EXR file while rendering instead of keeping the image in memory, no GUI or PNG)" << endl;
+        cerr << "         --half, --compression <none|zip|piz|dwaa|...> (pixel type and compression of the EXR files)" << endl;
         return -1;
     }
 
     bool nogui = false;
+    bool server = false;
     std::string sceneName = "";
     int sampleCount = 0;
+    PropertyOverrides overrides;
+    std::string sweepKey;
+    std::vector<std::string> sweepValues;
 
     for (int i = 1; i < argc; ++i) {
         std::string token(argv[i]);
@@ -204,8 +223,98 @@ int main(int argc, char **argv) {
 
             continue;
         }
+        else if (token == "-D" || token == "--define") {
+            std::string key, value;
+            if (i+1 >= argc || !splitOverride(argv[i+1], key, value)) {
+                cerr << "\"--define\" argument expects a \"path.property=value\" pair following it." << endl;
+                return -1;
+            }
+            overrides[key] = value;
+            i++;
+
+            continue;
+        }
+        else if (token == "--crop") {
+            std::vector<std::string> values;
+            if (i+1 < argc)
+                values = tokenize(argv[i+1], ", ");
+            if (values.size() != 4) {
+                cerr << "\"--crop\" argument expects a \"x,y,width,height\" window following it." << endl;
+                return -1;
+            }
+            /* The crop window is a property of the camera */
+            overrides["camera.cropOffsetX"] = values[0];
+            overrides["camera.cropOffsetY"] = values[1];
+            overrides["camera.cropWidth"] = values[2];
+            overrides["camera.cropHeight"] = values[3];
+            i++;
+
+            continue;
+        }
+        else if (token == "--composite") {
+            if (i+1 >= argc) {
+                cerr << "\"--composite\" argument expects an OpenEXR file following it." << endl;
+                return -1;
+            }
+            compositeName = argv[i+1];
+            i++;
+
+            continue;
+        }
+        else if (token == "--shard") {
+            std::vector<std::string> values;
+            if (i+1 < argc)
+                values = tokenize(argv[i+1], "/");
+            if (values.size() != 2) {
+                cerr << "\"--shard\" argument expects an \"index/count\" pair following it." << endl;
+                return -1;
+            }
+            shardIndex = atoi(values[0].c_str());
+            shardCount = atoi(values[1].c_str());
+            if (shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount) {
+                cerr << "Invalid shard \"" << argv[i+1] << "\"." << endl;
+                return -1;
+            }
+            i++;
+
+            continue;
+        }
+        else if (token == "--sweep") {
+            std::string values;
+            if (i+1 >= argc || !splitOverride(argv[i+1], sweepKey, values)) {
+                cerr << "\"--sweep\" argument expects a \"path.property=value1;value2;...\" list following it." << endl;
+                return -1;
+            }
+            sweepValues = tokenize(values, ";");
+            i++;
+
+            continue;
+        }
+        else if (token == "--denoise")
+            denoise = true;
+        else if (token == "--aovs")
+            saveFeatures = true;
+        else if (token == "--stream")
+            streamOutput = true;
+        else if (token == "--half")
+            exrSettings.half = true;
+        else if (token == "--compression") {
+            try {
+                if (i+1 >= argc)
+                    throw NoriException("no compression method given");
+                exrSettings.compression = EXRSettings::parseCompression(argv[i+1]);
+            } catch (const std::exception &e) {
+                cerr << "\"--compression\" argument expects an OpenEXR compression method following it (" << e.what() << ")." << endl;
+                return -1;
+            }
+            i++;
+
+            continue;
+        }
         else if(token == "--nogui" || token == "-b")
             nogui = true;
+        else if (token == "--server")
+            server = true;
         else
         {
             filesystem::path path(argv[i]);
@@ -221,7 +330,7 @@ int main(int argc, char **argv) {
                 }
                 else if (path.extension() == "exr") {
                     /* Alternatively, provide a basic OpenEXR image viewer */
-                    Bitmap bitmap(argv[1]);
+                    Bitmap bitmap(argv[i]);
                     ImageBlock block(Vector2i((int)bitmap.cols(), (int)bitmap.rows()), nullptr);
                     block.fromBitmap(bitmap);
                     nanogui::init();
@@ -231,7 +340,7 @@ int main(int argc, char **argv) {
                     nanogui::shutdown();
                 }
                 else {
-                    cerr << "Fatal error: unknown file \"" << argv[1]
+                    cerr << "Fatal error: unknown file \"" << argv[i]
                         << "\", expected an extension of type .xml or .exr" << endl;
                 }
             }
@@ -246,19 +355,71 @@ int main(int argc, char **argv) {
         threadCount = tbb::task_scheduler_init::automatic;
     }
 
+    /* Compress the OpenEXR output with as many threads as are used for rendering */
+    Imf::setGlobalThreadCount(threadCount == tbb::task_scheduler_init::automatic
+        ? tbb::task_scheduler_init::default_num_threads() : threadCount);
+
+    if (server) {
+        tbb::task_scheduler_init init(threadCount);
+
+        /* Answer on stdout and send all log output to stderr */
+        std::ostream protocol(cout.rdbuf());
+        cout.rdbuf(cerr.rdbuf());
+        RenderServer(protocol).run(std::cin);
+        cout.rdbuf(protocol.rdbuf());
+        return 0;
+    }
+
     if (sceneName != "") {
         try {
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
-
-            /* When the XML root object is a scene, start rendering it .. */
-            if (root->getClassType() == NoriObject::EScene){
-                Scene* scene = static_cast<Scene*>(root.get());
-                if(sampleCount > 0){
-                    scene->getSampler()->setSampleCount(sampleCount);
+            if (sweepValues.empty()) {
+                std::unique_ptr<NoriObject> root(loadFromXML(sceneName, overrides));
+
+                /* When the XML root object is a scene, start rendering it .. */
+                if (root->getClassType() == NoriObject::EScene){
+                    Scene* scene = static_cast<Scene*>(root.get());
+                    if(sampleCount > 0){
+                        scene->getSampler()->setSampleCount(sampleCount);
+                    }
+                    addDefaultDenoiser(scene);
+                    render(scene, sceneName, nogui);
+                }
+            } else {
+                /* Render once per value. When only the camera, sampler, integrator
+                   or BSDFs change, these are re-created while the meshes and the
+                   BVH of the loaded scene are reused */
+                std::string path = Scene::getReplaceablePath(sweepKey);
+                std::unique_ptr<NoriObject> root;
+
+                for (size_t i = 0; i < sweepValues.size(); ++i) {
+                    overrides[sweepKey] = sweepValues[i];
+                    cout << "Sweep: " << sweepKey << " = " << sweepValues[i] << endl;
+
+                    if (!root || path.empty()) {
+                        root.reset();
+                        root.reset(loadFromXML(sceneName, overrides));
+                        if (root->getClassType() != NoriObject::EScene)
+                            throw NoriException("\"%s\" does not describe a scene", sceneName);
+                    } else {
+                        Scene *scene = static_cast<Scene *>(root.get());
+                        for (auto &entry : loadObjectsFromXML(sceneName, path, overrides))
+                            scene->replaceChild(entry.second, entry.first);
+                    }
+
+                    Scene *scene = static_cast<Scene *>(root.get());
+                    if (sampleCount > 0)
+                        scene->getSampler()->setSampleCount(sampleCount);
+                    addDefaultDenoiser(scene);
+
+                    /* Name the output after the swept property and its value */
+                    std::string suffix = "_" + tokenize(sweepKey, ".").back() + "-" + sweepValues[i];
+                    for (char &c : suffix) {
+                        if (!std::isalnum((unsigned char) c) && c != '-' && c != '.')
+                            c = '_';
+                    }
+                    render(scene, sceneName, nogui, suffix);
                 }
-                render(scene, argv[1], nogui);
             }
-                
         }
         catch (const std::exception& e) {
             cerr << "[FATAL ERROR]: " << e.what() << endl;
@@ -0,0 +1,138 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/block.h>
+#include <nori/bitmap.h>
+
+using namespace nori;
+
+/**
+ * Compares an image against a reference and returns whether the largest
+ * relative difference of any channel stays below \c tolerance. The sums of
+ * overlapping filter footprints may be accumulated in a different order,
+ * so a merged image only matches a single render up to rounding.
+ */
+static bool compareImages(const std::string &referenceName, const std::string &imageName, float tolerance) {
+    Bitmap reference(referenceName), image(imageName);
+    if (reference.rows() != image.rows() || reference.cols() != image.cols())
+        throw NoriException("\"%s\" and \"%s\" have different sizes!", referenceName, imageName);
+
+    float maxError = 0.f;
+    Vector2i maxPixel(0, 0);
+    for (int y = 0; y < reference.rows(); ++y) {
+        for (int x = 0; x < reference.cols(); ++x) {
+            const Color3f &ref = reference(y, x), &value = image(y, x);
+            for (int c = 0; c < 3; ++c) {
+                float error = std::abs(value[c] - ref[c]) / std::max(std::abs(ref[c]), 1e-3f);
+                if (!(error <= maxError)) {
+                    maxError = error;
+                    maxPixel = Vector2i(x, y);
+                }
+            }
+        }
+    }
+
+    cout << "Maximum relative difference: " << maxError << " at pixel ("
+         << maxPixel.x() << ", " << maxPixel.y() << ")" << endl;
+    return maxError <= tolerance;
+}
+
+/**
+ * Combines the partial images written by "nori --shard i/n" into the final
+ * image. The shards contain disjoint sets of blocks along with their filter
+ * weights, so summing them up and normalizing afterwards gives the same
+ * result as a single render of the whole image.
+ *
+ * With "--compare", checks instead that an image matches a reference (e.g.
+ * a merged image and an unsharded render of the same scene).
+ */
+int main(int argc, char **argv) {
+    if (argc >= 2 && std::string(argv[1]) == "--compare") {
+        if (argc != 4 && argc != 5) {
+            cerr << "Syntax: " << argv[0] << " --compare <reference.exr> <image.exr> [tolerance]" << endl;
+            return -1;
+        }
+        try {
+            return compareImages(argv[2], argv[3], argc == 5 ? toFloat(argv[4]) : 1e-4f) ? 0 : 1;
+        } catch (const std::exception &e) {
+            cerr << "Fatal error: " << e.what() << endl;
+            return -1;
+        }
+    }
+
+    if (argc < 3) {
+        cerr << "Syntax: " << argv[0] << " <output> <shard.exr> [<shard.exr> ...]" << endl;
+        cerr << "        " << argv[0] << " --compare <reference.exr> <image.exr> [tolerance]" << endl;
+        return -1;
+    }
+
+    try {
+        std::vector<std::unique_ptr<ImageBlock>> shards;
+        Vector2i outputSize;
+        int shardCount = 0;
+
+        for (int i = 2; i < argc; ++i) {
+            Vector2i size;
+            int index, count;
+            std::unique_ptr<ImageBlock> block(ImageBlock::loadPartialEXR(argv[i], &size, &index, &count));
+
+            if (count <= 0 || index < 0 || index >= count)
+                throw NoriException("\"%s\" has an invalid shard %i/%i!", argv[i], index, count);
+            if (shards.empty()) {
+                outputSize = size;
+                shardCount = count;
+                shards.resize(count);
+            }
+
+            if (count != shardCount || size != outputSize)
+                throw NoriException("\"%s\" was rendered with a different image size or shard count!", argv[i]);
+            if (shards[index])
+                throw NoriException("\"%s\": shard %i/%i was specified twice!", argv[i], index, count);
+            shards[index] = std::move(block);
+        }
+
+        for (int i = 0; i < shardCount; ++i) {
+            if (!shards[i])
+                throw NoriException("Shard %i/%i is missing!", i, shardCount);
+            if (shards[i]->getOffset() != shards[0]->getOffset() ||
+                shards[i]->getSize() != shards[0]->getSize() ||
+                shards[i]->getBorderSize() != shards[0]->getBorderSize())
+                throw NoriException("Shard %i/%i covers a different crop window!", i, shardCount);
+        }
+
+        /* Accumulate in a fixed order so that the result does not depend
+           on the order of the arguments */
+        ImageBlock &result = *shards[0];
+        for (int i = 1; i < shardCount; ++i)
+            result += *shards[i];
+
+        std::string outputName = argv[1];
+        size_t lastdot = outputName.find_last_of(".");
+        if (lastdot != std::string::npos)
+            outputName.erase(lastdot, std::string::npos);
+
+        std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+        bitmap->saveEXR(outputName);
+        bitmap->savePNG(outputName);
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
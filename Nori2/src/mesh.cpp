@@ -42,6 +42,7 @@ void Mesh::activate() {
         /* If no material was assigned, instantiate a diffuse BRDF */
         m_bsdf = static_cast<BSDF *>(
             NoriObjectFactory::createInstance("diffuse", PropertyList()));
+        m_bsdf->activate();
     }
 
     m_pdf.reserve(m_F.cols());
@@ -120,22 +121,26 @@ Point3f Mesh::getCentroid(n_UINT index) const {
  */
 void Mesh::samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2f &uv) const
 {
+    // Choose a triangle and reuse the rescaled sample within it
     float rnd = sample[0];
     n_UINT index = m_pdf.sampleReuse(rnd);
-	Point2f tSample = Warp::squareToUniformTriangle(sample);
-    
-    n_UINT i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
-    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+	Point2f tSample = Warp::squareToUniformTriangle(Point2f(rnd, sample[1]));
 
     //Compute barycentric coordinates
-    Point3f delta{tSample.x(), tSample.y(), rnd};
+    Vector3f bary(1 - tSample.x() - tSample.y(), tSample.x(), tSample.y());
 
-    delta /= delta.sum();
+    getSurfacePoint(index, bary, p, n, uv);
+}
 
-    p = p0 * delta[0] + p1 * delta[1] + p2 * delta[2];
+void Mesh::getSurfacePoint(n_UINT index, const Vector3f &bary, Point3f &p, Normal3f &n, Point2f &uv) const
+{
+    n_UINT i0 = m_F(0, index), i1 = m_F(1, index), i2 = m_F(2, index);
+    const Point3f p0 = m_V.col(i0), p1 = m_V.col(i1), p2 = m_V.col(i2);
+
+    p = p0 * bary[0] + p1 * bary[1] + p2 * bary[2];
 
     if(m_N.size() != 0){
-        n = (delta.x() * m_N.col(i0) + delta.y() * m_N.col(i1) + delta.z() * m_N.col(i2)).normalized(); 
+        n = (bary.x() * m_N.col(i0) + bary.y() * m_N.col(i1) + bary.z() * m_N.col(i2)).normalized(); 
     }else
     {
         n = (p1 - p0).cross(p2 - p0).normalized();
@@ -143,9 +148,16 @@ void Mesh::samplePosition(const Point2f &sample, Point3f &p, Normal3f &n, Point2
     
     if(m_UV.size() != 0){
 
-        uv = delta.x() * m_UV.col(i0) + delta.y() * m_UV.col(i1) + delta.z() * m_UV.col(i2); 
+        uv = bary.x() * m_UV.col(i0) + bary.y() * m_UV.col(i1) + bary.z() * m_UV.col(i2); 
+    }else
+    {
+        uv = Point2f(bary.y(), bary.z());
     }
-    
+}
+
+const Emitter *Mesh::getEmitter(n_UINT index) const
+{
+    return m_emitter ? m_emitter->getPrimitive(index) : nullptr;
 }
 
 /// Return the surface area of the given triangle
@@ -155,6 +167,11 @@ float Mesh::pdf(const Point3f &p) const
 }
 
 
+void Mesh::setBSDF(BSDF *bsdf) {
+    delete m_bsdf;
+    m_bsdf = bsdf;
+}
+
 void Mesh::addChild(NoriObject *obj, const std::string& name) {
     switch (obj->getClassType()) {
         case EBSDF:
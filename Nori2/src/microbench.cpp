@@ -0,0 +1,466 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <nori/bitmap.h>
+#include <nori/block.h>
+#include <nori/bsdf.h>
+#include <nori/dpdf.h>
+#include <nori/rfilter.h>
+#include <nori/warp.h>
+#include <filesystem/resolver.h>
+#include <pcg32.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+/*
+ * Microbenchmarks for the isolated kernels that dominate rendering time.
+ *
+ * Every benchmark runs its kernel over a precomputed table of inputs, so
+ * that the time spent generating random numbers is not part of the
+ * measurement. The iteration count is doubled until a run takes at least
+ * the requested minimum time, after which the average cost per call is
+ * reported in nanoseconds.
+ *
+ * Usage: microbench [-d <scene directory>] [-m <min. time in ms>] [filter]
+ *
+ * Only benchmarks whose name contains \c filter are run. Benchmarks on
+ * bundled data (bunny.obj and the assignment-0 images) are skipped when
+ * the scene directory cannot be found.
+ */
+
+#if !defined(NORI_SCENE_DIR)
+#define NORI_SCENE_DIR "scenes"
+#endif
+
+using namespace nori;
+
+/// Number of precomputed inputs per benchmark (must be a power of two)
+static const uint32_t kInputCount = 4096;
+
+/// Prevent the compiler from discarding a result that is otherwise unused
+template <typename T> inline void doNotOptimize(const T &value) {
+#if defined(_MSC_VER)
+    const volatile char *ptr = reinterpret_cast<const volatile char *>(&value);
+    (void) *ptr;
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+struct Benchmark {
+    std::string name;
+    /// Run the kernel the given number of times
+    std::function<void(size_t)> run;
+};
+
+/// Triangle soup with randomly placed triangles inside the unit cube
+class SyntheticMesh : public Mesh {
+public:
+    SyntheticMesh(n_UINT triangleCount, float size, pcg32 &rng) {
+        m_name = "synthetic";
+        m_V.resize(3, 3 * triangleCount);
+        m_F.resize(3, triangleCount);
+        for (n_UINT i = 0; i < triangleCount; ++i) {
+            Point3f center(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+            for (int k = 0; k < 3; ++k) {
+                Point3f p = center + size * Vector3f(rng.nextFloat() - 0.5f,
+                    rng.nextFloat() - 0.5f, rng.nextFloat() - 0.5f);
+                m_V.col(3 * i + k) = p;
+                m_F(k, i) = 3 * i + k;
+                m_bbox.expandBy(p);
+            }
+        }
+        activate();
+    }
+};
+
+/// Random rays that pass through the given bounding box
+static std::vector<Ray3f> randomRays(const BoundingBox3f &bbox, pcg32 &rng) {
+    Point3f center = bbox.getCenter();
+    float radius = bbox.getExtents().norm();
+    std::vector<Ray3f> rays;
+    rays.reserve(kInputCount);
+    for (uint32_t i = 0; i < kInputCount; ++i) {
+        Vector3f dir = Warp::squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat()));
+        Point3f target = bbox.min + bbox.getExtents().cwiseProduct(
+            Vector3f(rng.nextFloat(), rng.nextFloat(), rng.nextFloat()));
+        Point3f origin = center + radius * dir;
+        rays.push_back(Ray3f(origin, (target - origin).normalized()));
+    }
+    return rays;
+}
+
+/// Camera-like rays, in scanline order, looking at the given bounding box
+static std::vector<Ray3f> coherentRays(const BoundingBox3f &bbox) {
+    Point3f center = bbox.getCenter();
+    float radius = bbox.getExtents().norm();
+    Point3f origin = center - Vector3f(0.f, 0.f, 2.f * radius);
+    int res = (int) std::sqrt((float) kInputCount);
+    std::vector<Ray3f> rays;
+    rays.reserve(kInputCount);
+    for (int y = 0; y < res; ++y) {
+        for (int x = 0; x < res; ++x) {
+            Point3f target = center + 0.5f * Vector3f(
+                bbox.getExtents().x() * ((x + 0.5f) / res - 0.5f),
+                bbox.getExtents().y() * ((y + 0.5f) / res - 0.5f), 0.f);
+            rays.push_back(Ray3f(origin, (target - origin).normalized()));
+        }
+    }
+    return rays;
+}
+
+static std::vector<Point2f> randomPoints(pcg32 &rng) {
+    std::vector<Point2f> points(kInputCount);
+    for (auto &p : points)
+        p = Point2f(rng.nextFloat(), rng.nextFloat());
+    return points;
+}
+
+static std::vector<Vector3f> randomHemisphereDirections(pcg32 &rng) {
+    std::vector<Vector3f> dirs(kInputCount);
+    for (auto &d : dirs)
+        d = Warp::squareToCosineHemisphere(Point2f(rng.nextFloat(), rng.nextFloat()));
+    return dirs;
+}
+
+static void addAccelBenchmarks(std::vector<Benchmark> &benchmarks,
+        const std::string &name, std::shared_ptr<Accel> accel, pcg32 &rng) {
+    auto random = std::make_shared<std::vector<Ray3f>>(randomRays(accel->getBoundingBox(), rng));
+    auto coherent = std::make_shared<std::vector<Ray3f>>(coherentRays(accel->getBoundingBox()));
+
+    for (int shadow = 0; shadow < 2; ++shadow) {
+        std::string suffix = shadow ? "/shadow" : "";
+        benchmarks.push_back({ "accel/rayIntersect/" + name + "/random" + suffix,
+            [accel, random, shadow](size_t n) {
+                Intersection its;
+                for (size_t i = 0; i < n; ++i)
+                    doNotOptimize(accel->rayIntersect((*random)[i & (kInputCount - 1)], its, shadow != 0));
+            }});
+        benchmarks.push_back({ "accel/rayIntersect/" + name + "/coherent" + suffix,
+            [accel, coherent, shadow](size_t n) {
+                Intersection its;
+                for (size_t i = 0; i < n; ++i)
+                    doNotOptimize(accel->rayIntersect((*coherent)[i & (kInputCount - 1)], its, shadow != 0));
+            }});
+    }
+}
+
+static std::vector<Benchmark> createBenchmarks(const filesystem::path &sceneDir) {
+    std::vector<Benchmark> benchmarks;
+    pcg32 rng;
+
+    /* Ray-triangle and ray-box intersection */
+    {
+        auto mesh = std::make_shared<SyntheticMesh>(kInputCount, 0.2f, rng);
+        auto rays = std::make_shared<std::vector<Ray3f>>(randomRays(mesh->getBoundingBox(), rng));
+        benchmarks.push_back({ "mesh/rayIntersect", [mesh, rays](size_t n) {
+            float u, v, t;
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t idx = i & (kInputCount - 1);
+                doNotOptimize(mesh->rayIntersect(idx, (*rays)[idx], u, v, t));
+            }
+        }});
+
+        auto boxes = std::make_shared<std::vector<BoundingBox3f>>();
+        for (uint32_t i = 0; i < kInputCount; ++i)
+            boxes->push_back(mesh->getBoundingBox(i));
+        benchmarks.push_back({ "bbox/rayIntersect", [boxes, rays](size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t idx = i & (kInputCount - 1);
+                doNotOptimize((*boxes)[idx].rayIntersect((*rays)[idx]));
+            }
+        }});
+        benchmarks.push_back({ "bbox/rayIntersect/nearfar", [boxes, rays](size_t n) {
+            float nearT, farT;
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t idx = i & (kInputCount - 1);
+                doNotOptimize((*boxes)[idx].rayIntersect((*rays)[idx], nearT, farT));
+            }
+        }});
+    }
+
+    /* BVH traversal */
+    {
+        auto accel = std::make_shared<Accel>();
+        accel->addMesh(new SyntheticMesh(100000, 0.05f, rng));
+        accel->build();
+        addAccelBenchmarks(benchmarks, "synthetic", accel, rng);
+
+        filesystem::path bunny = sceneDir / "assignment-0" / "bunny.obj";
+        if (bunny.exists()) {
+            /* The OBJ loader resolves file names relative to the search path */
+            getFileResolver()->prepend(bunny.parent_path());
+            PropertyList props;
+            props.setString("filename", bunny.filename());
+            auto bunnyAccel = std::make_shared<Accel>();
+            Mesh *mesh = static_cast<Mesh *>(NoriObjectFactory::createInstance("obj", props));
+            mesh->activate();
+            bunnyAccel->addMesh(mesh);
+            bunnyAccel->build();
+            addAccelBenchmarks(benchmarks, "bunny", bunnyAccel, rng);
+        } else {
+            cout << "Skipping bunny benchmarks: \"" << bunny << "\" not found" << endl;
+        }
+    }
+
+    /* Splatting samples into an image block */
+    {
+        for (auto filterName : { "box", "tent", "gaussian", "mitchell" }) {
+            std::shared_ptr<ReconstructionFilter> rfilter(static_cast<ReconstructionFilter *>(
+                NoriObjectFactory::createInstance(filterName, PropertyList())));
+            auto block = std::make_shared<ImageBlock>(Vector2i(NORI_BLOCK_SIZE, NORI_BLOCK_SIZE), rfilter.get());
+            auto positions = std::make_shared<std::vector<Point2f>>(randomPoints(rng));
+            for (auto &p : *positions)
+                p *= (float) NORI_BLOCK_SIZE;
+            benchmarks.push_back({ std::string("block/put/") + filterName,
+                [rfilter, block, positions](size_t n) {
+                    for (size_t i = 0; i < n; ++i)
+                        block->put((*positions)[i & (kInputCount - 1)], Color3f(1.f));
+                    doNotOptimize(block->data());
+                }});
+        }
+    }
+
+    /* Discrete distribution sampling */
+    {
+        auto samples = std::make_shared<std::vector<Point2f>>(randomPoints(rng));
+        for (size_t size : { 16, 1024, 65536, 1048576 }) {
+            auto pdf = std::make_shared<DiscretePDF>(size);
+            for (size_t i = 0; i < size; ++i)
+                pdf->append(rng.nextFloat());
+            pdf->normalize();
+            benchmarks.push_back({ tfm::format("dpdf/sample/%i", size), [pdf, samples](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    doNotOptimize(pdf->sample((*samples)[i & (kInputCount - 1)].x()));
+            }});
+
+            auto alias = std::make_shared<DiscreteAliasPDF>(size);
+            for (size_t i = 0; i < size; ++i)
+                alias->append((*pdf)[i]);
+            alias->normalize();
+            benchmarks.push_back({ tfm::format("dpdf/alias/%i", size), [alias, samples](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    doNotOptimize(alias->sample((*samples)[i & (kInputCount - 1)].x()));
+            }});
+        }
+    }
+
+    /* Sample warping functions (Warp::squareToTent is not implemented) */
+    {
+        auto samples = std::make_shared<std::vector<Point2f>>(randomPoints(rng));
+        auto dirs = std::make_shared<std::vector<Vector3f>>(randomHemisphereDirections(rng));
+
+        #define NORI_WARP_BENCHMARK(name, warp, pdf, input) \
+            benchmarks.push_back({ "warp/" name, [samples](size_t n) { \
+                for (size_t i = 0; i < n; ++i) \
+                    doNotOptimize(warp((*samples)[i & (kInputCount - 1)])); \
+            }}); \
+            benchmarks.push_back({ "warp/" name "Pdf", [samples, dirs](size_t n) { \
+                for (size_t i = 0; i < n; ++i) \
+                    doNotOptimize(pdf((*input)[i & (kInputCount - 1)])); \
+            }});
+
+        NORI_WARP_BENCHMARK("squareToUniformSquare", Warp::squareToUniformSquare, Warp::squareToUniformSquarePdf, samples)
+        NORI_WARP_BENCHMARK("squareToUniformDisk", Warp::squareToUniformDisk, Warp::squareToUniformDiskPdf, samples)
+        NORI_WARP_BENCHMARK("squareToUniformTriangle", Warp::squareToUniformTriangle, Warp::squareToUniformTrianglePdf, samples)
+        NORI_WARP_BENCHMARK("squareToUniformSphere", Warp::squareToUniformSphere, Warp::squareToUniformSpherePdf, dirs)
+        NORI_WARP_BENCHMARK("squareToUniformHemisphere", Warp::squareToUniformHemisphere, Warp::squareToUniformHemispherePdf, dirs)
+        NORI_WARP_BENCHMARK("squareToCosineHemisphere", Warp::squareToCosineHemisphere, Warp::squareToCosineHemispherePdf, dirs)
+        #undef NORI_WARP_BENCHMARK
+
+        benchmarks.push_back({ "warp/squareToBeckmann", [samples](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                doNotOptimize(Warp::squareToBeckmann((*samples)[i & (kInputCount - 1)], 0.2f));
+        }});
+        benchmarks.push_back({ "warp/squareToBeckmannPdf", [dirs](size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                doNotOptimize(Warp::squareToBeckmannPdf((*dirs)[i & (kInputCount - 1)], 0.2f));
+        }});
+
+        /* Batch variants, reported per sample */
+        auto outDirs = std::make_shared<std::vector<Vector3f>>(kInputCount);
+        auto outPdfs = std::make_shared<std::vector<float>>(kInputCount);
+        benchmarks.push_back({ "warp/batch/squareToUniformSphere", [samples, outDirs](size_t n) {
+            for (size_t i = 0; i < n; i += kInputCount) {
+                Warp::squareToUniformSphere(samples->data(), outDirs->data(), kInputCount);
+                doNotOptimize(outDirs->front());
+            }
+        }});
+        benchmarks.push_back({ "warp/batch/squareToCosineHemisphere", [samples, outDirs](size_t n) {
+            for (size_t i = 0; i < n; i += kInputCount) {
+                Warp::squareToCosineHemisphere(samples->data(), outDirs->data(), kInputCount);
+                doNotOptimize(outDirs->front());
+            }
+        }});
+        benchmarks.push_back({ "warp/batch/squareToCosineHemispherePdf", [dirs, outPdfs](size_t n) {
+            for (size_t i = 0; i < n; i += kInputCount) {
+                Warp::squareToCosineHemispherePdf(dirs->data(), outPdfs->data(), kInputCount);
+                doNotOptimize(outPdfs->front());
+            }
+        }});
+        benchmarks.push_back({ "warp/batch/squareToBeckmann", [samples, outDirs](size_t n) {
+            for (size_t i = 0; i < n; i += kInputCount) {
+                Warp::squareToBeckmann(samples->data(), 0.2f, outDirs->data(), kInputCount);
+                doNotOptimize(outDirs->front());
+            }
+        }});
+        benchmarks.push_back({ "warp/batch/squareToBeckmannPdf", [dirs, outPdfs](size_t n) {
+            for (size_t i = 0; i < n; i += kInputCount) {
+                Warp::squareToBeckmannPdf(dirs->data(), 0.2f, outPdfs->data(), kInputCount);
+                doNotOptimize(outPdfs->front());
+            }
+        }});
+    }
+
+    /* Bilinear texture lookups */
+    {
+        auto uvs = std::make_shared<std::vector<Point2f>>(randomPoints(rng));
+
+        auto bitmap = std::make_shared<Bitmap>(Vector2i(1024, 512));
+        auto ldrBitmap = std::make_shared<LDRBitmap>(Vector2i(1024, 512));
+        for (int y = 0; y < bitmap->rows(); ++y) {
+            for (int x = 0; x < bitmap->cols(); ++x) {
+                (*bitmap)(y, x) = Color3f(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+                (*ldrBitmap)(y, x) = Color3b((uint8_t) rng.nextUInt(256),
+                    (uint8_t) rng.nextUInt(256), (uint8_t) rng.nextUInt(256));
+            }
+        }
+
+        filesystem::path exrFile = sceneDir / "assignment-0" / "bunny-normals.exr";
+        filesystem::path pngFile = sceneDir / "assignment-0" / "bunny-normals.png";
+        std::vector<std::pair<std::string, std::shared_ptr<Bitmap>>> bitmaps { { "synthetic", bitmap } };
+        std::vector<std::pair<std::string, std::shared_ptr<LDRBitmap>>> ldrBitmaps { { "synthetic", ldrBitmap } };
+        if (exrFile.exists())
+            bitmaps.push_back({ "bundled", std::make_shared<Bitmap>(exrFile.str()) });
+        if (pngFile.exists())
+            ldrBitmaps.push_back({ "bundled", std::make_shared<LDRBitmap>(pngFile.str()) });
+
+        for (auto &entry : bitmaps) {
+            auto bmp = entry.second;
+            benchmarks.push_back({ "bitmap/eval/" + entry.first, [bmp, uvs](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    doNotOptimize(bmp->eval((*uvs)[i & (kInputCount - 1)]));
+            }});
+        }
+        for (auto &entry : ldrBitmaps) {
+            auto bmp = entry.second;
+            benchmarks.push_back({ "ldrbitmap/eval/" + entry.first, [bmp, uvs](size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    doNotOptimize(bmp->eval((*uvs)[i & (kInputCount - 1)]));
+            }});
+        }
+    }
+
+    /* BSDF sampling and evaluation (roughdielectric is not implemented) */
+    {
+        auto samples = std::make_shared<std::vector<Point2f>>(randomPoints(rng));
+        auto wi = std::make_shared<std::vector<Vector3f>>(randomHemisphereDirections(rng));
+        auto wo = std::make_shared<std::vector<Vector3f>>(randomHemisphereDirections(rng));
+
+        for (auto bsdfName : { "diffuse", "mirror", "dielectric", "roughconductor", "roughsubstrate" }) {
+            std::shared_ptr<BSDF> bsdf(static_cast<BSDF *>(
+                NoriObjectFactory::createInstance(bsdfName, PropertyList())));
+            bsdf->activate();
+
+            benchmarks.push_back({ std::string("bsdf/") + bsdfName + "/sample",
+                [bsdf, samples, wi](size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        uint32_t idx = i & (kInputCount - 1);
+                        BSDFQueryRecord bRec((*wi)[idx]);
+                        doNotOptimize(bsdf->sample(bRec, (*samples)[idx]));
+                        doNotOptimize(bRec.wo);
+                    }
+                }});
+            benchmarks.push_back({ std::string("bsdf/") + bsdfName + "/eval",
+                [bsdf, wi, wo](size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        uint32_t idx = i & (kInputCount - 1);
+                        BSDFQueryRecord bRec((*wi)[idx], (*wo)[(idx + 1) & (kInputCount - 1)],
+                            Vector2f(), ESolidAngle);
+                        doNotOptimize(bsdf->eval(bRec));
+                    }
+                }});
+            benchmarks.push_back({ std::string("bsdf/") + bsdfName + "/pdf",
+                [bsdf, wi, wo](size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        uint32_t idx = i & (kInputCount - 1);
+                        BSDFQueryRecord bRec((*wi)[idx], (*wo)[(idx + 1) & (kInputCount - 1)],
+                            Vector2f(), ESolidAngle);
+                        doNotOptimize(bsdf->pdf(bRec));
+                    }
+                }});
+        }
+    }
+
+    return benchmarks;
+}
+
+/// Time a benchmark and return the average cost per call in nanoseconds
+static double runBenchmark(const Benchmark &benchmark, double minTime) {
+    typedef std::chrono::high_resolution_clock Clock;
+
+    /* Warm up caches and branch predictors */
+    benchmark.run(kInputCount);
+
+    for (size_t n = kInputCount; ; n *= 2) {
+        auto start = Clock::now();
+        benchmark.run(n);
+        double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (elapsed >= minTime || n >= ((size_t) 1 << 40))
+            return elapsed * 1e6 / (double) n;
+    }
+}
+
+int main(int argc, char **argv) {
+    filesystem::path sceneDir(NORI_SCENE_DIR);
+    double minTime = 250.0;
+    std::string filter;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string token(argv[i]);
+        if ((token == "-d" || token == "--data") && i + 1 < argc) {
+            sceneDir = filesystem::path(argv[++i]);
+        } else if ((token == "-m" || token == "--mintime") && i + 1 < argc) {
+            minTime = toFloat(argv[++i]);
+        } else if (token == "-h" || token == "--help") {
+            cout << "Syntax: " << argv[0] << " [-d <scene directory>] [-m <min. time in ms>] [filter]" << endl;
+            return 0;
+        } else {
+            filter = token;
+        }
+    }
+
+    try {
+        std::vector<Benchmark> benchmarks = createBenchmarks(sceneDir);
+
+        cout << endl << tfm::format("%-50s %14s", "Benchmark", "ns/call") << endl;
+        cout << std::string(65, '-') << endl;
+        for (const Benchmark &benchmark : benchmarks) {
+            if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+                continue;
+            double ns = runBenchmark(benchmark, minTime);
+            cout << tfm::format("%-50s %14.2f", benchmark.name, ns) << endl;
+        }
+    } catch (const std::exception &e) {
+        cerr << "Fatal error: " << e.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -39,43 +39,29 @@ public:
         /* Reflectance at direction of normal incidence.
            To be used when defining the Fresnel term using the Schlick's approximation*/
         m_R0 = new ConstantSpectrumTexture(propList.getColor("R0", Color3f(0.5f)));
+
+        activate();
     }
 
+    /// Bind the textures once all the children have been added
+    void activate() {
+        m_bound[EAlpha].bind(m_alpha);
+        m_bound[ER0].bind(m_R0);
+
+        /* With constant textures every query shares the same values */
+        m_constant = m_bound[EAlpha].isConstant() && m_bound[ER0].isConstant();
+        for (int i = 0; i < ETextureCount; ++i)
+            m_values[i] = m_bound[i].eval(Point2f(0.f));
+    }
 
     /// Evaluate the BRDF for the given pair of directions
     Color3f eval(const BSDFQueryRecord& bRec) const {
-        /* This is a smooth BRDF -- return zero if the measure
-        is wrong, or when queried for illumination on the backside */
-        if (bRec.measure != ESolidAngle
-            || Frame::cosTheta(bRec.wi) <= 0
-            || Frame::cosTheta(bRec.wo) <= 0)
-            return Color3f(0.0f);
-        
-        Vector3f wh = (bRec.wi + bRec.wo).normalized();
-        if(wh[0] == 0 && wh[1] == 0 && wh[2] == 0)
-            return Color3f(0.0f);
-        
-        float alpha = m_alpha->eval(bRec.uv).x();
-        Color3f f = Reflectance::BeckmannNDF(wh, alpha)
-            * Reflectance::fresnel(wh.dot(bRec.wo), m_R0->eval(bRec.uv)) 
-            * Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha)
-            / (4 * abs(Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo)));
-
-        return f;
+        return evalKernel(bRec, textures(bRec));
     }
 
     /// Evaluate the sampling density of \ref sample() wrt. solid angles
     float pdf(const BSDFQueryRecord& bRec) const {
-        /* This is a smooth BRDF -- return zero if the measure
-        is wrong, or when queried for illumination on the backside */
-        if (bRec.measure != ESolidAngle
-            || Frame::cosTheta(bRec.wi) <= 0
-            || Frame::cosTheta(bRec.wo) <= 0)
-            return 0.0f;
-
-        Vector3f wh = (bRec.wi + bRec.wo).normalized();    
-
-        return Warp::squareToBeckmannPdf(wh, m_alpha->eval(bRec.uv).x());
+        return pdfKernel(bRec, textures(bRec));
     }
 
     /// Sample the BRDF
@@ -88,20 +74,20 @@ public:
         if (Frame::cosTheta(bRec.wi) <= 0)
             return Color3f(0.0f);
 
+        const Color3f* tex = textures(bRec);
         bRec.measure = ESolidAngle;
-        float alpha = m_alpha->eval(bRec.uv).x();
-        Vector3f wh = Warp::squareToBeckmann(_sample, alpha);
+        Vector3f wh = Warp::squareToBeckmann(_sample, tex[EAlpha].x());
         bRec.eta = 1.0f;
 
         if(wh.dot(bRec.wi) > 0)
             wh = -wh;
         bRec.wo = Reflectance::reflect(bRec.wi, wh);
 
-        float p = pdf(bRec);
+        float p = pdfKernel(bRec, tex);
         if(p <= 0)
             return Color3f(0.0f);
 
-        return eval(bRec) * Frame::cosTheta(bRec.wo) / p;
+        return evalKernel(bRec, tex) * Frame::cosTheta(bRec.wo) / p;
     }
 
     bool isDiffuse() const {
@@ -145,8 +131,54 @@ public:
         );
     }
 private:
+    enum ETextureSlot { EAlpha = 0, ER0, ETextureCount };
+
+    /// Texture values for the query: constant ones don't need any lookup
+    const Color3f* textures(const BSDFQueryRecord& bRec) const {
+        return m_constant ? m_values : fetchTextures(bRec, m_bound);
+    }
+
+    /// BRDF value for the texture values of the query
+    Color3f evalKernel(const BSDFQueryRecord& bRec, const Color3f* tex) const {
+        /* This is a smooth BRDF -- return zero if the measure
+        is wrong, or when queried for illumination on the backside */
+        if (bRec.measure != ESolidAngle
+            || Frame::cosTheta(bRec.wi) <= 0
+            || Frame::cosTheta(bRec.wo) <= 0)
+            return Color3f(0.0f);
+        
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();
+        if(wh[0] == 0 && wh[1] == 0 && wh[2] == 0)
+            return Color3f(0.0f);
+        
+        float alpha = tex[EAlpha].x();
+        Color3f f = Reflectance::BeckmannNDF(wh, alpha)
+            * Reflectance::fresnel(wh.dot(bRec.wo), tex[ER0]) 
+            * Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha)
+            / (4 * abs(Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo)));
+
+        return f;
+    }
+
+    /// Sampling density for the texture values of the query
+    float pdfKernel(const BSDFQueryRecord& bRec, const Color3f* tex) const {
+        /* This is a smooth BRDF -- return zero if the measure
+        is wrong, or when queried for illumination on the backside */
+        if (bRec.measure != ESolidAngle
+            || Frame::cosTheta(bRec.wi) <= 0
+            || Frame::cosTheta(bRec.wo) <= 0)
+            return 0.0f;
+
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();    
+
+        return Warp::squareToBeckmannPdf(wh, tex[EAlpha].x());
+    }
+
     Texture* m_alpha;
     Texture* m_R0;
+    TextureBinding m_bound[ETextureCount];
+    Color3f m_values[ETextureCount];
+    bool m_constant;
 };
 
 
@@ -264,49 +296,33 @@ public:
 
         /* Albedo of the diffuse base material (a.k.a "kd") */
         m_kd = new ConstantSpectrumTexture(propList.getColor("kd", Color3f(0.5f)));
+
+        activate();
     }
 
+    /// Bind the textures once all the children have been added
+    void activate() {
+        m_bound[EAlpha].bind(m_alpha);
+        m_bound[EKd].bind(m_kd);
 
-    /// Evaluate the BRDF for the given pair of directions
-    Color3f eval(const BSDFQueryRecord &bRec) const {
-        /* This is a smooth BRDF -- return zero if the measure
-        is wrong, or when queried for illumination on the backside */
-        if (bRec.measure != ESolidAngle
-            || Frame::cosTheta(bRec.wi) <= 0
-            || Frame::cosTheta(bRec.wo) <= 0)
-            return Color3f(0.0f);
-
-        Color3f fdiff = 28 * m_kd->eval(bRec.uv) / (23 * M_PIf)
-            * (1 - pow( (m_extIOR - m_intIOR) / (m_extIOR + m_intIOR), 2))
-            * (1 - pow( 1 - 0.5 * Frame::cosTheta(bRec.wi), 5)) 
-            * (1 - pow( 1 - 0.5 * Frame::cosTheta(bRec.wo), 5)); 
-        
-        Vector3f wh = (bRec.wi + bRec.wo).normalized();
-        float alpha = m_alpha->eval(bRec.uv).x();
-        Color3f fmf = Reflectance::BeckmannNDF(wh, alpha)
-            * Reflectance::fresnel(wh.dot(bRec.wo), m_extIOR, m_intIOR) 
-            * Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha)
-            / (4 * Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo));
+        /* With constant textures every query shares the same values */
+        m_constant = m_bound[EAlpha].isConstant() && m_bound[EKd].isConstant();
+        for (int i = 0; i < ETextureCount; ++i)
+            m_values[i] = m_bound[i].eval(Point2f(0.f));
 
+        /* Part of the diffuse term that only depends on the IORs */
+        m_diffuseScale = 28 / (23 * M_PIf)
+            * (1 - pow( (m_extIOR - m_intIOR) / (m_extIOR + m_intIOR), 2));
+    }
 
-		return fmf + fdiff;
-	}
+    /// Evaluate the BRDF for the given pair of directions
+    Color3f eval(const BSDFQueryRecord &bRec) const {
+        return evalKernel(bRec, textures(bRec));
+    }
 
     /// Evaluate the sampling density of \ref sample() wrt. solid angles
     float pdf(const BSDFQueryRecord &bRec) const {
-        /* This is a smooth BRDF -- return zero if the measure
-       is wrong, or when queried for illumination on the backside */
-        if (bRec.measure != ESolidAngle
-            || Frame::cosTheta(bRec.wi) <= 0
-            || Frame::cosTheta(bRec.wo) <= 0)
-            return 0.0f;
-        
-        Vector3f wh = (bRec.wi + bRec.wo).normalized();
-        float pf = Reflectance::fresnel(Frame::cosTheta(bRec.wi), m_extIOR, m_intIOR);
-
-        return  (Warp::squareToBeckmannPdf(wh, m_alpha->eval(bRec.uv).x()) * pf 
-            +  Warp::squareToCosineHemispherePdf(bRec.wo) * (1 - pf));
-
+        return pdfKernel(bRec, textures(bRec));
     }
 
     /// Sample the BRDF
@@ -319,9 +335,10 @@ public:
         if (Frame::cosTheta(bRec.wi) <= 0)
             return Color3f(0.0f);
 
+        const Color3f *tex = textures(bRec);
         bRec.measure = ESolidAngle;
 
-        Vector3f wh = Warp::squareToBeckmann(_sample, m_alpha->eval(bRec.uv).x());
+        Vector3f wh = Warp::squareToBeckmann(_sample, tex[EAlpha].x());
         
         float pf = Reflectance::fresnel(Frame::cosTheta(bRec.wi), m_extIOR, m_intIOR);
         float sample = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
@@ -334,10 +351,11 @@ public:
 
         bRec.eta = 1.0f;
 
-        if(pdf(bRec) == 0)
+        float p = pdfKernel(bRec, tex);
+        if(p == 0)
             return Color3f(0.);
 
-        Color3f Lo = eval(bRec) * Frame::cosTheta(bRec.wo) / pdf(bRec);
+        Color3f Lo = evalKernel(bRec, tex) * Frame::cosTheta(bRec.wo) / p;
 		return Lo;
 	}
 
@@ -386,9 +404,59 @@ public:
         );
     }
 private:
+    enum ETextureSlot { EAlpha = 0, EKd, ETextureCount };
+
+    /// Texture values for the query: constant ones don't need any lookup
+    const Color3f *textures(const BSDFQueryRecord &bRec) const {
+        return m_constant ? m_values : fetchTextures(bRec, m_bound);
+    }
+
+    /// BRDF value for the texture values of the query
+    Color3f evalKernel(const BSDFQueryRecord &bRec, const Color3f *tex) const {
+        /* This is a smooth BRDF -- return zero if the measure
+        is wrong, or when queried for illumination on the backside */
+        if (bRec.measure != ESolidAngle
+            || Frame::cosTheta(bRec.wi) <= 0
+            || Frame::cosTheta(bRec.wo) <= 0)
+            return Color3f(0.0f);
+
+        Color3f fdiff = m_diffuseScale * tex[EKd]
+            * (1 - pow( 1 - 0.5 * Frame::cosTheta(bRec.wi), 5)) 
+            * (1 - pow( 1 - 0.5 * Frame::cosTheta(bRec.wo), 5)); 
+        
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();
+        float alpha = tex[EAlpha].x();
+        Color3f fmf = Reflectance::BeckmannNDF(wh, alpha)
+            * Reflectance::fresnel(wh.dot(bRec.wo), m_extIOR, m_intIOR) 
+            * Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha)
+            / (4 * Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo));
+
+        return fmf + fdiff;
+    }
+
+    /// Sampling density for the texture values of the query
+    float pdfKernel(const BSDFQueryRecord &bRec, const Color3f *tex) const {
+        /* This is a smooth BRDF -- return zero if the measure
+       is wrong, or when queried for illumination on the backside */
+        if (bRec.measure != ESolidAngle
+            || Frame::cosTheta(bRec.wi) <= 0
+            || Frame::cosTheta(bRec.wo) <= 0)
+            return 0.0f;
+        
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();
+        float pf = Reflectance::fresnel(Frame::cosTheta(bRec.wi), m_extIOR, m_intIOR);
+
+        return  (Warp::squareToBeckmannPdf(wh, tex[EAlpha].x()) * pf 
+            +  Warp::squareToCosineHemispherePdf(bRec.wo) * (1 - pf));
+    }
+
     float m_intIOR, m_extIOR, pFresnel;
+    float m_diffuseScale;
     Texture* m_alpha;
     Texture* m_kd;
+    TextureBinding m_bound[ETextureCount];
+    Color3f m_values[ETextureCount];
+    bool m_constant;
 };
 
 NORI_REGISTER_CLASS(RoughConductor, "roughconductor");
@@ -25,7 +25,29 @@
 
 NORI_NAMESPACE_BEGIN
 
-NoriObject *loadFromXML(const std::string &filename) {
+/// Check if a path component (e.g. "mesh[1]") matches a pattern ("mesh" or "mesh[1]")
+static bool matchComponent(const std::string &pattern, const std::string &component) {
+    return pattern == component || pattern == component.substr(0, component.find('['));
+}
+
+/// Check if the first \c count components of a path match a pattern
+static bool matchPath(const std::vector<std::string> &pattern,
+        const std::vector<std::string> &path, size_t count) {
+    if (pattern.size() < count || path.size() < count)
+        return false;
+    for (size_t i = 0; i < count; ++i) {
+        if (!matchComponent(pattern[i], path[i]))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Parse a scene file. When \c selection is nonempty, only the objects
+ * matching it (and their children) are instantiated and added to \c selected
+ */
+static NoriObject *parseXML(const std::string &filename, const PropertyOverrides &overrides,
+        const std::string &selection, std::vector<std::pair<std::string, NoriObject *>> *selected) {
     /* Load the XML file using 'pugi' (a tiny self-contained XML parser implemented in C++) */
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load_file(filename.c_str());
@@ -68,9 +90,13 @@ NoriObject *loadFromXML(const std::string &filename) {
         ESampler              = NoriObject::ESampler,
         ETest                 = NoriObject::ETest,
         EReconstructionFilter = NoriObject::EReconstructionFilter,
+        EDenoiser             = NoriObject::EDenoiser,
+
+        /* Marks the end of the object classes */
+        EClassTypeCount       = NoriObject::EClassTypeCount,
 
         /* Properties */
-        EBoolean = NoriObject::EClassTypeCount,
+        EBoolean = EClassTypeCount,
         EInteger,
         EFloat,
         EString,
@@ -100,6 +126,7 @@ NoriObject *loadFromXML(const std::string &filename) {
     tags["integrator"] = EIntegrator;
     tags["sampler"]    = ESampler;
     tags["rfilter"]    = EReconstructionFilter;
+    tags["denoiser"]   = EDenoiser;
     tags["test"]       = ETest;
     tags["boolean"]    = EBoolean;
     tags["integer"]    = EInteger;
@@ -131,11 +158,31 @@ NoriObject *loadFromXML(const std::string &filename) {
                                 filename, *attrs.begin(), node.name(), offset(node.offset_debug()));
     };
 
+    /* Split the overrides into object path, property name and value */
+    struct Override {
+        std::string key, property, value;
+        std::vector<std::string> path;
+        bool used;
+    };
+    std::vector<Override> parsedOverrides;
+    for (auto &entry : overrides) {
+        std::vector<std::string> path = tokenize(entry.first, ".");
+        if (path.empty())
+            throw NoriException("Invalid property override \"%s\"", entry.first);
+        std::string property = path.back();
+        path.pop_back();
+        parsedOverrides.push_back({ entry.first, property, entry.second, path, false });
+    }
+    std::vector<std::string> selectionPath = tokenize(selection, ".");
+
     Eigen::Affine3f transform;
 
-    /* Helper function to parse a Nori XML node (recursive) */
-    std::function<NoriObject *(pugi::xml_node &, PropertyList &, int)> parseTag = [&](
-        pugi::xml_node &node, PropertyList &list, int parentTag) -> NoriObject * {
+    /* Helper function to parse a Nori XML node (recursive). \c path contains the
+       tag names and indices (e.g. "mesh[1]") of the objects leading to this node */
+    std::function<NoriObject *(pugi::xml_node &, PropertyList &, int,
+            const std::vector<std::string> &, bool)> parseTag = [&](
+        pugi::xml_node &node, PropertyList &list, int parentTag,
+        const std::vector<std::string> &path, bool instantiate) -> NoriObject * {
         /* Skip over comments */
         if (node.type() == pugi::node_comment || node.type() == pugi::node_declaration)
             return nullptr;
@@ -172,6 +219,27 @@ NoriObject *loadFromXML(const std::string &filename) {
             throw NoriException("Error while parsing \"%s\": node \"%s\" requires a Nori object as parent (at %s)",
                                 filename, node.name(), offset(node.offset_debug()));
 
+        if (currentIsObject && !instantiate) {
+            if (matchPath(selectionPath, path, selectionPath.size()) && path.size() == selectionPath.size()) {
+                /* This object was selected: instantiate it and its children */
+                std::string name;
+                for (auto &component : path)
+                    name += (name.empty() ? "" : ".") + component;
+                selected->push_back({ name, parseTag(node, list, parentTag, path, true) });
+            } else if (matchPath(selectionPath, path, path.size())) {
+                /* A selected object might be further down in the hierarchy */
+                std::map<std::string, int> counts;
+                PropertyList unused;
+                for (pugi::xml_node &ch: node.children()) {
+                    std::vector<std::string> childPath = path;
+                    if (tags.count(ch.name()) && tags[ch.name()] < EClassTypeCount)
+                        childPath.push_back(tfm::format("%s[%i]", ch.name(), counts[ch.name()]++));
+                    parseTag(ch, unused, tag, childPath, false);
+                }
+            }
+            return nullptr;
+        }
+
         if (tag == EScene)
             node.append_attribute("type") = "scene";
         else if (tag == ETransform)
@@ -180,8 +248,12 @@ NoriObject *loadFromXML(const std::string &filename) {
         PropertyList propList;
         std::vector<NoriObject *> children;
         std::vector<std::string> children_names;
+        std::map<std::string, int> counts;
         for (pugi::xml_node &ch: node.children()) {
-            NoriObject *child = parseTag(ch, propList, tag);
+            std::vector<std::string> childPath = path;
+            if (tags.count(ch.name()) && tags[ch.name()] < EClassTypeCount)
+                childPath.push_back(tfm::format("%s[%i]", ch.name(), counts[ch.name()]++));
+            NoriObject *child = parseTag(ch, propList, tag, childPath, true);
             if (child)
             {
                 children.push_back(child);
@@ -193,12 +265,21 @@ NoriObject *loadFromXML(const std::string &filename) {
         try {
             if (currentIsObject) {
                 check_attributes(node, { "type" });
+                std::string type = node.attribute("type").value();
+
+                /* Apply the property overrides that refer to this object */
+                for (auto &o : parsedOverrides) {
+                    if (o.path.size() != path.size() || !matchPath(o.path, path, path.size()))
+                        continue;
+                    if (o.property == "type")
+                        type = o.value;
+                    else
+                        propList.setUntyped(o.property, o.value);
+                    o.used = true;
+                }
 
                 /* This is an object, first instantiate it */
-                result = NoriObjectFactory::createInstance(
-                    node.attribute("type").value(),
-                    propList
-                );
+                result = NoriObjectFactory::createInstance(type, propList);
 
                 if (result->getClassType() != (int) tag) {
                     throw NoriException(
@@ -323,7 +404,39 @@ NoriObject *loadFromXML(const std::string &filename) {
     };
 
     PropertyList list;
-    return parseTag(*doc.begin(), list, EInvalid);
+    NoriObject *root = parseTag(*doc.begin(), list, EInvalid,
+        std::vector<std::string>(), selected == nullptr);
+
+    if (!selected) {
+        for (auto &o : parsedOverrides) {
+            if (!o.used) {
+                delete root;
+                throw NoriException("Property override \"%s\" does not refer to "
+                                    "any object in \"%s\"", o.key, filename);
+            }
+        }
+    }
+
+    return root;
+}
+
+NoriObject *loadFromXML(const std::string &filename, const PropertyOverrides &overrides) {
+    return parseXML(filename, overrides, "", nullptr);
+}
+
+std::vector<std::pair<std::string, NoriObject *>> loadObjectsFromXML(
+        const std::string &filename, const std::string &path, const PropertyOverrides &overrides) {
+    if (path.empty())
+        throw NoriException("loadObjectsFromXML(): expected an object path");
+    std::vector<std::pair<std::string, NoriObject *>> selected;
+    try {
+        parseXML(filename, overrides, path, &selected);
+    } catch (...) {
+        for (auto &entry : selected)
+            delete entry.second;
+        throw;
+    }
+    return selected;
 }
 
 NORI_NAMESPACE_END
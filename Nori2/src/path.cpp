@@ -3,32 +3,71 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/roulette.h>
 #include <random>
 NORI_NAMESPACE_BEGIN
 class PathTracing : public Integrator
 {
 public:
-    PathTracing(const PropertyList &props)
+    PathTracing(const PropertyList &props) : m_roulette(props)
     {
-        /* No parameters this time */
     }
     Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        return Li(scene, sampler, ray, PathState(), nullptr);
+    }
+    std::string toString() const
+    {
+        return tfm::format("PathTracing[%s]", m_roulette.toString());
+    }
+
+protected:
+    // State of a path when it reaches the next vertex
+    struct PathState {
+        Color3f bsdf = Color3f(1.f);
+        // Weight window of the roulette, reduced when the path is split
+        float window = 1.f;
+        int bounce = 0;
+        // Vertices up to this bounce can't be split again
+        int splitBounce = -1;
+    };
+
+    // Trace the path that continues along ray. The copies of a split path
+    // start at the vertex of the original one, which is given as 'first'
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray, PathState state, const Intersection *first) const
     {
         Color3f Lo(0.);
         Intersection its;
         Ray3f iteRay(ray);
         Color3f Le(0.);
-        Color3f bsdf(1.);
-        while(true){
+        Color3f &bsdf = state.bsdf;
+        for(;;++state.bounce){
 
-            if (!scene->rayIntersect(iteRay, its)) //Return environment
-                return scene->getBackground(ray) * bsdf;
+            if (first) {
+                its = *first;
+                first = nullptr;
+            }
+            else if (!scene->rayIntersect(iteRay, its)) //Return environment
+                return Lo + scene->getBackground(iteRay) * bsdf;
             else if(its.mesh->isEmitter()){
                 const Emitter* em = its.mesh->getEmitter();
                 EmitterQueryRecord emRecord(em, iteRay.o, its.p, its.shFrame.n, its.uv);
                 Le = em->eval(emRecord);
 
-                return Le * bsdf;
+                return Lo + Le * bsdf;
+            }
+
+            if (m_roulette.reachedMaxDepth(state.bounce))
+                return Lo;
+
+            // Splitting: the other copies continue from this same vertex
+            int splits = state.bounce > state.splitBounce ? m_roulette.splitCount(state.bounce, its.mesh->getBSDF()->isDiffuse()) : 1;
+            if (splits > 1) {
+                bsdf /= (float) splits;
+                state.window /= splits;
+                state.splitBounce = state.bounce;
+                for (int i = 1; i < splits; ++i)
+                    Lo += Li(scene, sampler, iteRay, state, &its);
             }
 
             //Sample BSDF
@@ -36,23 +75,17 @@ public:
             Color3f bsdf_aux = its.mesh->getBSDF()->sample(bsdfRecord, sampler->next2D());
             bsdf *= bsdf_aux;
 
-            float prob = bsdf_aux.maxCoeff(); 
-            if(prob >= 1)
-                prob = 0.9;
-            if(sampler->next1D() < 1 - prob){
-                return Color3f(0.);
-            }
+            // Russian roulette on the accumulated throughput
+            if (bsdf.isZero() || !m_roulette.survive(state.bounce, bsdf, state.window, sampler->next1D()))
+                return Lo;
 
             iteRay = Ray3f(its.p, its.toWorld(bsdfRecord.wo));
-            bsdf /= prob;
         }
         
         return Lo;
     }
-    std::string toString() const
-    {
-        return "Direct Emitter Sampler []";
-    }
+
+    PathRoulette m_roulette;
 };
 NORI_REGISTER_CLASS(PathTracing, "path");
-NORI_NAMESPACE_END
\ No newline at end of file
+NORI_NAMESPACE_END
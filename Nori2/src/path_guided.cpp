@@ -0,0 +1,277 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/render.h>
+#include <nori/sdtree.h>
+#include <nori/timer.h>
+#include <nori/roulette.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Path tracer with emitter sampling and MIS (as path_mis) that additionally
+ * guides the directions of the path with a spatial-directional tree of the
+ * incident radiance (Müller et al. 2017, "Practical Path Guiding").
+ *
+ * The tree is trained in the preprocess step: every training pass renders
+ * the image with twice the samples of the previous one, records the
+ * radiance of the paths and refines the tree. The final render only reads
+ * the tree, and chooses between BSDF and guided sampling with one-sample MIS.
+ * The Russian roulette is the one of the other path tracers (without
+ * splitting).
+ */
+class PathTracingGuided : public Integrator
+{
+public:
+    PathTracingGuided(const PropertyList &props) : m_roulette(props)
+    {
+        /* Number of training passes (with 1, 2, 4, ... samples per pixel) */
+        m_trainingPasses = props.getInteger("trainingPasses", 5);
+        /* Probability of sampling the BSDF instead of the guiding distribution */
+        m_bsdfSamplingFraction = props.getFloat("bsdfSamplingFraction", 0.5f);
+        /* Split spatial leaves with more than c * sqrt(2^pass) records */
+        m_spatialThreshold = props.getInteger("spatialThreshold", 12000);
+        /* Subdivide directional quadrants holding more than this fraction of the energy */
+        m_directionalThreshold = props.getFloat("directionalThreshold", 0.01f);
+    }
+
+    virtual ~PathTracingGuided()
+    {
+        delete m_sdTree;
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        delete m_sdTree;
+        m_sdTree = new SDTree(scene->getBoundingBox());
+
+        cout << "Training the guiding distribution .. ";
+        cout.flush();
+        Timer timer;
+
+        for (int pass = 0; pass < m_trainingPasses; ++pass) {
+            trainingPass(scene, 1 << pass);
+            m_sdTree->refine((uint32_t) (m_spatialThreshold * std::sqrt((float) (1 << pass))),
+                m_directionalThreshold);
+        }
+
+        cout << "done. (" << m_sdTree->getLeafCount() << " spatial leaves, took "
+             << timer.elapsedString() << ")" << endl;
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        return trace(scene, sampler, ray, false);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PathTracingGuided[\n"
+            "  trainingPasses = %i,\n"
+            "  bsdfSamplingFraction = %f,\n"
+            "  spatialThreshold = %i,\n"
+            "  directionalThreshold = %f,\n"
+            "  %s\n"
+            "]",
+            m_trainingPasses, m_bsdfSamplingFraction, m_spatialThreshold, m_directionalThreshold,
+            m_roulette.toString());
+    }
+
+protected:
+    /// Path vertex whose incident radiance is recorded into the tree
+    struct Vertex {
+        SDTree::Leaf *leaf;
+        Vector3f dir;        ///< Sampled direction (world space)
+        float pdf;           ///< Density of the sampled direction
+        Color3f throughput;  ///< Path throughput after the vertex
+        Color3f radiance;    ///< Radiance that reached the camera through the vertex
+    };
+
+    static const int MaxRecordedVertices = 32;
+
+    float weight(float mainPdf, float auxPdf) const {
+        if (isinf(mainPdf) || (mainPdf == 0 && auxPdf == 0))
+            return 1;
+        return mainPdf / (mainPdf + auxPdf);
+    }
+
+    /// Trace the image once with 'spp' samples per pixel, recording radiance into the tree
+    void trainingPass(const Scene *scene, int spp)
+    {
+        std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+        sampler->setSampleCount(spp);
+        traceCameraRays(scene, sampler.get(), [&](Sampler *sampler, const Ray3f &ray) {
+            trace(scene, sampler, ray, true);
+        });
+    }
+
+    Color3f trace(const Scene* scene, Sampler* sampler, const Ray3f &ray, bool train) const
+    {
+        Vertex vertices[MaxRecordedVertices];
+        int vertexCount = 0;
+        auto addRadiance = [&](const Color3f &L, int count) {
+            for (int i = 0; i < count; ++i)
+                vertices[i].radiance += L;
+        };
+
+        Intersection its;
+        Ray3f iteRay(ray);
+        Color3f Le(0.);
+        Color3f throughput(1.);
+
+        float emPdf = 0, dirPdf = 0;
+        bool isSpecular = false;
+        // Normal at the origin of iteRay, needed for the emitter selection pdf
+        Normal3f prevN(0.f);
+        // Whether the last vertex was recorded (and thus receives unweighted emission)
+        bool lastRecorded = false;
+
+        for (int bounce = 0;; ++bounce) {
+            Color3f emitted(0.);
+            bool hitEmitter = false;
+            if (!scene->rayIntersect(iteRay, its)) {
+                const Emitter* emEnv = scene->getEnvironmentalEmitter();
+                if (emEnv != nullptr) {
+                    EmitterQueryRecord emitter_intersection(
+                        emEnv, iteRay.o, iteRay.o + iteRay.d, Normal3f(0, 0, 1), Vector2f());
+                    emPdf = scene->pdfEmitter(emEnv, iteRay.o, prevN) * emEnv->pdf(emitter_intersection);
+                }
+                emitted = scene->getBackground(iteRay) * throughput;
+                hitEmitter = true;
+            }
+            else if (its.mesh->isEmitter()) {
+                const Emitter* em = its.mesh->getEmitter(its.triIndex);
+                EmitterQueryRecord emRecord(em, iteRay.o, its.p, its.shFrame.n, its.uv);
+                emRecord.refNormal = prevN;
+                emRecord.triIndex = its.triIndex;
+                emPdf = em->pdf(emRecord) * scene->pdfEmitter(em, iteRay.o, prevN);
+                emitted = em->eval(emRecord) * throughput;
+                hitEmitter = true;
+            }
+
+            if (hitEmitter) {
+                Color3f weighted = emitted * (bounce == 0 || isSpecular ? 1 : weight(dirPdf, emPdf));
+                Le += weighted;
+                if (train) {
+                    // The vertex that sampled this direction learns about the full emission
+                    int count = lastRecorded ? vertexCount - 1 : vertexCount;
+                    addRadiance(weighted, count);
+                    if (lastRecorded)
+                        vertices[vertexCount - 1].radiance += emitted;
+                }
+                break;
+            }
+
+            if (m_roulette.reachedMaxDepth(bounce))
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            SDTree::Leaf *leaf = m_sdTree ? m_sdTree->lookup(its.p) : nullptr;
+
+            // Sample the BSDF first, which also tells whether the vertex is specular
+            BSDFQueryRecord bsdfRecord(its.toLocal(-iteRay.d), its.uv);
+            Color3f bsdfWeight = bsdf->sample(bsdfRecord, sampler->next2D());
+            isSpecular = bsdfRecord.measure == EDiscrete;
+
+            // Guided sampling needs a trained distribution
+            bool guided = !isSpecular && leaf && leaf->sampling.getTotal() > 0;
+            float bsdfFraction = guided ? m_bsdfSamplingFraction : 1.f;
+            float guideSample = sampler->next1D();
+            Point2f guideDirSample = sampler->next2D();
+
+            Color3f stepWeight;
+            if (!guided) {
+                stepWeight = bsdfWeight;
+                dirPdf = isSpecular ? 0.f : bsdf->pdf(bsdfRecord);
+            }
+            else {
+                if (guideSample >= bsdfFraction) {
+                    // Replace the BSDF sample by a direction from the guiding distribution
+                    bsdfRecord.wo = its.toLocal(leaf->sampling.sample(guideDirSample));
+                    bsdfRecord.measure = ESolidAngle;
+                }
+                float bsdfPdf = bsdf->pdf(bsdfRecord);
+                float guidePdf = leaf->sampling.pdf(its.toWorld(bsdfRecord.wo));
+                dirPdf = bsdfFraction * bsdfPdf + (1 - bsdfFraction) * guidePdf;
+                stepWeight = dirPdf > 0
+                    ? Color3f(bsdf->eval(bsdfRecord) * std::abs(Frame::cosTheta(bsdfRecord.wo)) / dirPdf)
+                    : Color3f(0.f);
+            }
+
+            // Emitter sampling (not useful for specular vertices)
+            const Emitter* emit = nullptr;
+            float pdflight = 0;
+            if (!isSpecular)
+                emit = scene->sampleEmitter(its.p, its.shFrame.n, sampler->next1D(), pdflight);
+            if (emit) {
+                EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
+                emitterRecord.emitter = emit;
+                Color3f Le_em = emit->sample(emitterRecord, sampler->next2D(), 0.);
+
+                Ray3f sray(its.p, emitterRecord.wi);
+                Intersection it_shadow;
+                if (emitterRecord.pdf > 0 &&
+                    (!scene->rayIntersect(sray, it_shadow) || it_shadow.t >= (emitterRecord.dist - 1.e-5))) {
+                    BSDFQueryRecord bsdfRecord_emit(its.toLocal(-iteRay.d),
+                        its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+
+                    // The direction could also have been sampled by the BSDF or the guiding distribution
+                    float emPdf_emit = pdflight * emitterRecord.pdf;
+                    float dirPdf_emit = 0.f;
+                    if (!emit->isDelta()) {
+                        dirPdf_emit = bsdfFraction * bsdf->pdf(bsdfRecord_emit);
+                        if (guided)
+                            dirPdf_emit += (1 - bsdfFraction) * leaf->sampling.pdf(emitterRecord.wi);
+                    }
+                    Color3f L = Le_em * throughput * its.shFrame.n.dot(emitterRecord.wi) * bsdf->eval(bsdfRecord_emit)
+                        * weight(emPdf_emit, dirPdf_emit) / emPdf_emit;
+                    Le += L;
+                    if (train)
+                        addRadiance(L, vertexCount);
+                }
+            }
+
+            throughput *= stepWeight;
+
+            // Russian roulette on the accumulated throughput
+            if (throughput.isZero() || !m_roulette.survive(bounce, throughput, 1.f, sampler->next1D()))
+                break;
+
+            // Remember the vertex to learn the radiance arriving from the sampled direction
+            Vector3f wo = its.toWorld(bsdfRecord.wo);
+            lastRecorded = train && !isSpecular && leaf && vertexCount < MaxRecordedVertices;
+            if (lastRecorded)
+                vertices[vertexCount++] = Vertex { leaf, wo, dirPdf, throughput, Color3f(0.f) };
+
+            prevN = its.shFrame.n;
+            iteRay = Ray3f(its.p, wo);
+        }
+
+        if (train) {
+            for (int i = 0; i < vertexCount; ++i) {
+                const Vertex &v = vertices[i];
+                Color3f incident(0.f);
+                for (int c = 0; c < 3; ++c)
+                    if (v.throughput[c] > 0)
+                        incident[c] = v.radiance[c] / v.throughput[c];
+                v.leaf->building.record(v.dir, incident.getLuminance() / v.pdf);
+                v.leaf->count++;
+            }
+        }
+
+        return Le;
+    }
+
+    int m_trainingPasses;
+    float m_bsdfSamplingFraction;
+    int m_spatialThreshold;
+    float m_directionalThreshold;
+    SDTree *m_sdTree = nullptr;
+    PathRoulette m_roulette;
+};
+NORI_REGISTER_CLASS(PathTracingGuided, "path_guided");
+NORI_NAMESPACE_END
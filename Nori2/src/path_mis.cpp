@@ -3,14 +3,14 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/roulette.h>
 #include <random>
 NORI_NAMESPACE_BEGIN
 class PathTracingMIS : public Integrator
 {
 public:
-    PathTracingMIS(const PropertyList &props)
+    PathTracingMIS(const PropertyList &props) : m_roulette(props)
     {
-        /* No parameters this time */
     }
 
     float weight(float mainPdf, float auxPdf) const {
@@ -23,106 +23,188 @@ public:
     }
 
     Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        return Li(scene, sampler, ray, PathState(), nullptr, nullptr);
+    }
+
+    std::vector<std::string> getAOVNames() const
+    {
+        return { "direct", "indirect" };
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray, SampleRecord &sRec) const
+    {
+        Color3f direct(0.f);
+        Color3f L = Li(scene, sampler, ray, PathState(), nullptr, sRec.aovs ? &direct : nullptr,
+            sRec.needsFeatures ? &sRec : nullptr);
+        if (sRec.aovs) {
+            sRec.aovs[0] = direct;
+            sRec.aovs[1] = L - direct;
+        }
+        return L;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format("PathTracingMIS[%s]", m_roulette.toString());
+    }
+
+protected:
+    // State of a path when it reaches the next vertex
+    struct PathState {
+        Color3f bsdf = Color3f(1.f);
+        // Weight window of the roulette, reduced when the path is split
+        float window = 1.f;
+        int bounce = 0;
+        // Vertices up to this bounce can't be split again
+        int splitBounce = -1;
+        float matPdf = 0.f;
+        bool isSpecular = false;
+        // Normal at the origin of the ray, needed for the emitter selection pdf
+        Normal3f prevN = Normal3f(0.f);
+    };
+
+    // Trace the path that continues along ray. The copies of a split path
+    // start at the vertex of the original one, which is given as 'first'.
+    // The light that is seen directly or reflected once is also added to 'direct',
+    // and the features of the first hit are recorded in 'features'
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray, PathState state, const Intersection *first,
+        Color3f *direct, SampleRecord *features = nullptr) const
     {
         Intersection its;
         Ray3f iteRay(ray);
         Color3f Le(0.);
-        Color3f bsdf(1.);
+        Color3f &bsdf = state.bsdf;
 
-        float emPdf = 0, matPdf = 0;
-        bool isSpecular = false;
-        for(int bounce = 0;;++bounce){
+        // The features are recorded at the first hit (a ray that escapes has none)
+        if (features)
+            features->hasFeatures = true;
+
+        float emPdf = 0;
+        for(;;++state.bounce){
+            int bounce = state.bounce;
 
             // Hit a lightsource
             // If bounce == 0, first object intersected is lightsource so MIS weight is not taken into account
-            if (!scene->rayIntersect(iteRay, its)){
+            if (first) {
+                its = *first;
+                first = nullptr;
+            }
+            else if (!scene->rayIntersect(iteRay, its)){
 
                 const Emitter* emEnv = scene->getEnvironmentalEmitter();
                 if(emEnv != nullptr){
+                    // There is no intersection: query the environment along the ray direction
                     EmitterQueryRecord emitter_intersection(
-                        emEnv, iteRay.o, its.p, its.shFrame.n, its.uv);
-                    emPdf = scene->pdfEmitter(emEnv) * emEnv->pdf(emitter_intersection);  
+                        emEnv, iteRay.o, iteRay.o + iteRay.d, Normal3f(0, 0, 1), Vector2f());
+                    emPdf = scene->pdfEmitter(emEnv, iteRay.o, state.prevN) * emEnv->pdf(emitter_intersection);  
                 }
 
                 // Return accumulated light + 
                 //      Background * bsdf accumulated * weight
                 //  The matPdf comes from bsdf evaluation on previous iteration
-                return Le + scene->getBackground(iteRay) * bsdf 
-                    * (bounce == 0 || isSpecular ? 1 : weight(matPdf, emPdf));
+                Color3f Lb = scene->getBackground(iteRay) * bsdf 
+                    * (bounce == 0 || state.isSpecular ? 1 : weight(state.matPdf, emPdf));
+                if (direct && bounce <= 1)
+                    *direct += Lb;
+                return Le + Lb;
+            }
+
+            if (features && bounce == 0) {
+                features->mesh = its.mesh;
+                features->normal = its.shFrame.n;
+                features->depth = its.t;
             }
-            else if (its.mesh->isEmitter()) {
 
-                const Emitter* em = its.mesh->getEmitter();
+            if (its.mesh->isEmitter()) {
+
+                const Emitter* em = its.mesh->getEmitter(its.triIndex);
                 EmitterQueryRecord emRecord(em, iteRay.o, its.p, its.shFrame.n, its.uv);
-                emPdf = em->pdf(emRecord) * scene->pdfEmitter(em);
+                emRecord.refNormal = state.prevN;
+                emRecord.triIndex = its.triIndex;
+                emPdf = em->pdf(emRecord) * scene->pdfEmitter(em, iteRay.o, state.prevN);
 
                 // Return accumulated light + 
                 //      light evaluation * bsdf accumulated * weight
                 //  The matPdf comes from bsdf evaluation on previous iteration
-                return Le + em->eval(emRecord) * bsdf 
-                    * (bounce == 0 || isSpecular ? 1 : weight(matPdf, emPdf));
+                Color3f Lem = em->eval(emRecord) * bsdf 
+                    * (bounce == 0 || state.isSpecular ? 1 : weight(state.matPdf, emPdf));
+                if (direct && bounce <= 1)
+                    *direct += Lem;
+                return Le + Lem;
+            }
+
+            if (m_roulette.reachedMaxDepth(bounce))
+                return Le;
+
+            // Splitting: the other copies continue from this same vertex
+            int splits = bounce > state.splitBounce ? m_roulette.splitCount(bounce, its.mesh->getBSDF()->isDiffuse()) : 1;
+            if (splits > 1) {
+                bsdf /= (float) splits;
+                state.window /= splits;
+                state.splitBounce = bounce;
+                for (int i = 1; i < splits; ++i)
+                    Le += Li(scene, sampler, iteRay, state, &its, direct);
             }
 
             //Sample BSDF
             BSDFQueryRecord bsdfRecord(its.toLocal(-iteRay.d), its.uv);
             Color3f bsdf_aux = its.mesh->getBSDF()->sample(bsdfRecord, sampler->next2D());
-            isSpecular = bsdfRecord.measure == EDiscrete;
+            state.isSpecular = bsdfRecord.measure == EDiscrete;
+            if (features && bounce == 0 && bsdf_aux.isValid())
+                features->albedo = bsdf_aux;
             
             // If its not specular, sample a light source
             // The reason is that direct sampling an emitter doesn't make sense with specular materials
             // as the probability of sampling that direction is approximated to 0
-            Color3f Le_emiter(0.);
-            if(!isSpecular){ // Emitter sampling
+            const Emitter* emit = nullptr;
+            float pdflight = 0;
+            if(!state.isSpecular) // Choose an emitter for the current shading point
+                emit = scene->sampleEmitter(its.p, its.shFrame.n, sampler->next1D(), pdflight);
+            if(emit){ // Emitter sampling
                 
-                float pdflight;
-                EmitterQueryRecord emitterRecord(its.p);
-                const Emitter* emit = scene->sampleEmitter(sampler->next1D(), pdflight);
+                EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
                 emitterRecord.emitter = emit;
                 Color3f Le_em = emit->sample(emitterRecord, sampler->next2D(), 0.);
 
-                // Visibility check
+                // Visibility check (a shadow ray that escapes the scene reaches the environment)
                 Ray3f sray(its.p, emitterRecord.wi);
                 Intersection it_shadow;
-                if (scene->rayIntersect(sray, it_shadow))
-                    if(it_shadow.t >= (emitterRecord.dist - 1.e-5)){
+                if (emitterRecord.pdf > 0 &&
+                    (!scene->rayIntersect(sray, it_shadow) || it_shadow.t >= (emitterRecord.dist - 1.e-5))){
                     BSDFQueryRecord bsdfRecord_emit(its.toLocal(-iteRay.d),
                         its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
 
                     // Calculate pdfs for the MIS
                     emPdf = pdflight * emitterRecord.pdf;
-                    float matPdf_emit = its.mesh->getBSDF()->pdf(bsdfRecord_emit);
-                    Le_emiter = Le_em * bsdf * its.shFrame.n.dot(emitterRecord.wi) * its.mesh->getBSDF()->eval(bsdfRecord_emit) * weight(emPdf, matPdf_emit)
+                    // Delta emitters can't be reached by BSDF sampling
+                    float matPdf_emit = emit->isDelta() ? 0.f : its.mesh->getBSDF()->pdf(bsdfRecord_emit);
+                    Color3f Ld = Le_em * bsdf * its.shFrame.n.dot(emitterRecord.wi) * its.mesh->getBSDF()->eval(bsdfRecord_emit) * weight(emPdf, matPdf_emit)
                         / (pdflight * emitterRecord.pdf);
+                    if (direct && bounce == 0)
+                        *direct += Ld;
+                    Le += Ld;
                 }
             }
             
             // Accumulate bsdf for the different bounces / iterations
             bsdf *= bsdf_aux;
             // Compute material pdf for the next iteration (in case it intersects light emitter prepare the matPdf in advance)
-            matPdf = its.mesh->getBSDF()->pdf(bsdfRecord);
+            state.matPdf = its.mesh->getBSDF()->pdf(bsdfRecord);
 
-            // Russian roulette
-            // The probability of the ray dying is 1 - maxCoeff(bsdf)
-            // We return light accumulated by direct emitter sampling as this is iterative
-            float prob = bsdf_aux.maxCoeff();
-            if(sampler->next1D() < 1 - prob){
+            // Russian roulette on the accumulated throughput
+            if (bsdf.isZero() || !m_roulette.survive(bounce, bsdf, state.window, sampler->next1D()))
                 return Le;
-            }
-
-            // Account for the russian roulette probs
-            Le += Le_emiter / prob;
-            bsdf = bsdf / prob;
 
             // Update ray
+            state.prevN = its.shFrame.n;
             iteRay = Ray3f(its.p, its.toWorld(bsdfRecord.wo));
         }
         
         return Le;
     }
-    std::string toString() const
-    {
-        return "Direct Emitter Sampler []";
-    }
+
+    PathRoulette m_roulette;
 };
 NORI_REGISTER_CLASS(PathTracingMIS, "path_mis");
 NORI_NAMESPACE_END
\ No newline at end of file
@@ -3,36 +3,62 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/roulette.h>
 #include <random>
 NORI_NAMESPACE_BEGIN
 class PathTracingNEE : public Integrator
 {
 public:
-    PathTracingNEE(const PropertyList &props)
+    PathTracingNEE(const PropertyList &props) : m_roulette(props)
     {
-        /* No parameters this time */
     }
     Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        return Li(scene, sampler, ray, PathState(), nullptr);
+    }
+    std::string toString() const
+    {
+        return tfm::format("PathTracingNEE[%s]", m_roulette.toString());
+    }
+
+protected:
+    // State of a path when it reaches the next vertex
+    struct PathState {
+        Color3f bsdf = Color3f(1.f);
+        // Weight window of the roulette, reduced when the path is split
+        float window = 1.f;
+        int bounce = 0;
+        // Vertices up to this bounce can't be split again
+        int splitBounce = -1;
+        bool isSpecular = false;
+    };
+
+    // Trace the path that continues along ray. The copies of a split path
+    // start at the vertex of the original one, which is given as 'first'
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray, PathState state, const Intersection *first) const
     {
         Intersection its;
         Ray3f iteRay(ray);
         Color3f Le(0.);
-        Color3f bsdf(1.);
+        Color3f &bsdf = state.bsdf;
 
-        bool isSpecular = false;
-
-        for(int bounce = 0;;++bounce){
+        for(;;++state.bounce){
+            int bounce = state.bounce;
 
-            if (!scene->rayIntersect(iteRay, its)){
+            if (first) {
+                its = *first;
+                first = nullptr;
+            }
+            else if (!scene->rayIntersect(iteRay, its)){
 
-                if(isSpecular || bounce == 0)
+                if(state.isSpecular || bounce == 0)
                     return Le + scene->getBackground(iteRay) * bsdf;
 
                 return Le;
             }
             else if (its.mesh->isEmitter()) {
 
-                if(isSpecular || bounce == 0){
+                if(state.isSpecular || bounce == 0){
                     const Emitter* em = its.mesh->getEmitter();
                     EmitterQueryRecord emRecord(em, iteRay.o, its.p, its.shFrame.n, its.uv);
                     return Le + em->eval(emRecord) * bsdf;
@@ -40,49 +66,59 @@ public:
 
                 return Le;
             }
-            
-            Color3f Le_emiter(0.);
-            if(!isSpecular){ // Emitter sampling for NEE
+
+            if (m_roulette.reachedMaxDepth(bounce))
+                return Le;
+
+            // Splitting: the other copies continue from this same vertex
+            int splits = bounce > state.splitBounce ? m_roulette.splitCount(bounce, its.mesh->getBSDF()->isDiffuse()) : 1;
+            if (splits > 1) {
+                bsdf /= (float) splits;
+                state.window /= splits;
+                state.splitBounce = bounce;
+                for (int i = 1; i < splits; ++i)
+                    Le += Li(scene, sampler, iteRay, state, &its);
+            }
+
+            //Sample BSDF
+            BSDFQueryRecord bsdfRecord(its.toLocal(-iteRay.d), its.uv);
+            Color3f bsdf_aux = its.mesh->getBSDF()->sample(bsdfRecord, sampler->next2D());
+            state.isSpecular = bsdfRecord.measure == EDiscrete;
+
+            const Emitter* emit = nullptr;
+            float pdflight = 0;
+            if(!state.isSpecular) // Choose an emitter for the current shading point
+                emit = scene->sampleEmitter(its.p, its.shFrame.n, sampler->next1D(), pdflight);
+            if(emit){ // Emitter sampling for NEE
                 
-                float pdflight;
-                EmitterQueryRecord emitterRecord(its.p);
-                const Emitter* emit = scene->sampleEmitter(sampler->next1D(), pdflight);
+                EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
                 emitterRecord.emitter = emit;
                 Color3f Le_em = emit->sample(emitterRecord, sampler->next2D(), 0.);
 
+                // A shadow ray that escapes the scene reaches the environment
                 Ray3f sray(its.p, emitterRecord.wi);
                 Intersection it_shadow;
-                if (scene->rayIntersect(sray, it_shadow))
-                    if(it_shadow.t >= (emitterRecord.dist - 1.e-5)){
+                if (emitterRecord.pdf > 0 &&
+                    (!scene->rayIntersect(sray, it_shadow) || it_shadow.t >= (emitterRecord.dist - 1.e-5))){
                     BSDFQueryRecord bsdfRecord_emit(its.toLocal(-iteRay.d),
                         its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
-                    Le_emiter = Le_em * bsdf * its.shFrame.n.dot(emitterRecord.wi) * its.mesh->getBSDF()->eval(bsdfRecord_emit) / (pdflight * emitterRecord.pdf);
+                    Le += Le_em * bsdf * its.shFrame.n.dot(emitterRecord.wi) * its.mesh->getBSDF()->eval(bsdfRecord_emit) / (pdflight * emitterRecord.pdf);
                 }
             }
 
-            //Sample BSDF
-            BSDFQueryRecord bsdfRecord(its.toLocal(-iteRay.d), its.uv);
-            Color3f bsdf_aux = its.mesh->getBSDF()->sample(bsdfRecord, sampler->next2D());
             bsdf *= bsdf_aux;
 
-            float prob = bsdf_aux.maxCoeff();
-            if(sampler->next1D() < 1 - prob){
+            // Russian roulette on the accumulated throughput
+            if (bsdf.isZero() || !m_roulette.survive(bounce, bsdf, state.window, sampler->next1D()))
                 return Le;
-            }
-
-            Le += Le_emiter / prob;
-            bsdf = bsdf / prob;
 
             iteRay = Ray3f(its.p, its.toWorld(bsdfRecord.wo));
-            isSpecular = bsdfRecord.measure == EDiscrete;
         }
         
         return Le;
     }
-    std::string toString() const
-    {
-        return "Direct Emitter Sampler []";
-    }
+
+    PathRoulette m_roulette;
 };
 NORI_REGISTER_CLASS(PathTracingNEE, "path_nee");
 NORI_NAMESPACE_END
\ No newline at end of file
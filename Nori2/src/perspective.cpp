@@ -37,6 +37,16 @@ public:
         m_outputSize.y() = propList.getInteger("height", 720);
         m_invOutputSize = m_outputSize.cast<float>().cwiseInverse();
 
+        /* Optional crop window, only this part of the image is rendered. Default: full image */
+        m_cropOffset.x() = propList.getInteger("cropOffsetX", 0);
+        m_cropOffset.y() = propList.getInteger("cropOffsetY", 0);
+        m_cropSize.x() = propList.getInteger("cropWidth", m_outputSize.x() - m_cropOffset.x());
+        m_cropSize.y() = propList.getInteger("cropHeight", m_outputSize.y() - m_cropOffset.y());
+        if ((m_cropOffset.array() < 0).any() || (m_cropSize.array() <= 0).any() ||
+            ((m_cropOffset + m_cropSize).array() > m_outputSize.array()).any())
+            throw NoriException("PerspectiveCamera: the crop window %s+%s exceeds the image size %s!",
+                m_cropSize.toString(), m_cropOffset.toString(), m_outputSize.toString());
+
         /* Specifies an optional camera-to-world transformation. Default: none */
         m_cameraToWorld = propList.getTransform("toWorld", Transform());
 
@@ -79,6 +89,14 @@ public:
             Eigen::DiagonalMatrix<float, 3>(Vector3f(-0.5f, -0.5f * aspect, 1.0f)) *
             Eigen::Translation<float, 3>(-1.0f, -1.0f/aspect, 0.0f) * perspective).inverse();
 
+        /* Area of the film on the plane at z=1 (in camera space), which
+           normalizes the importance of the camera */
+        Point3f filmMin = m_sampleToCamera * Point3f(0.f, 0.f, 0.f);
+        Point3f filmMax = m_sampleToCamera * Point3f(1.f, 1.f, 0.f);
+        filmMin /= filmMin.z();
+        filmMax /= filmMax.z();
+        m_filmArea = std::abs((filmMax.x() - filmMin.x()) * (filmMax.y() - filmMin.y()));
+
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
         if (!m_rfilter)
             m_rfilter = static_cast<ReconstructionFilter *>(
@@ -108,6 +126,39 @@ public:
         return Color3f(1.0f);
     }
 
+    Color3f sampleImportance(const Point3f &ref, Point2f &samplePosition,
+            Point3f &origin, float &pdf) const {
+        origin = m_cameraToWorld * Point3f(0, 0, 0);
+        Vector3f d = m_cameraToWorld.inverse() * Vector3f(ref - origin);
+        float dist = d.norm();
+        d /= dist;
+
+        if (!projectToFilm(d, samplePosition))
+            return Color3f(0.0f);
+
+        /* Pinhole: the position is fixed, the density wrt. solid angles at
+           'ref' only depends on the distance (and the cosine at the lens) */
+        float cosTheta = d.z();
+        pdf = dist * dist / cosTheta;
+
+        /* Importance of a pinhole camera with a film of area m_filmArea */
+        float cos2Theta = cosTheta * cosTheta;
+        return Color3f(1.0f / (m_filmArea * cos2Theta * cos2Theta));
+    }
+
+    void pdfRay(const Ray3f &ray, float &pdfPos, float &pdfDir) const {
+        Vector3f d = (m_cameraToWorld.inverse() * ray.d).normalized();
+        Point2f samplePosition;
+        pdfPos = 1.0f;
+        if (!projectToFilm(d, samplePosition)) {
+            pdfDir = 0.0f;
+            return;
+        }
+        /* Uniform density on the film, converted to solid angles */
+        float cosTheta = d.z();
+        pdfDir = 1.0f / (m_filmArea * cosTheta * cosTheta * cosTheta);
+    }
+
     void addChild(NoriObject *obj, const std::string& name = "none") {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
@@ -128,12 +179,15 @@ public:
             "PerspectiveCamera[\n"
             "  cameraToWorld = %s,\n"
             "  outputSize = %s,\n"
+            "  crop = %s+%s,\n"
             "  fov = %f,\n"
             "  clip = [%f, %f],\n"
             "  rfilter = %s\n"
             "]",
             indent(m_cameraToWorld.toString(), 18),
             m_outputSize.toString(),
+            m_cropSize.toString(),
+            m_cropOffset.toString(),
             m_fov,
             m_nearClip,
             m_farClip,
@@ -141,12 +195,23 @@ public:
         );
     }
 private:
+    /// Return the film position seen in direction 'd' (camera space), if any
+    bool projectToFilm(const Vector3f &d, Point2f &samplePosition) const {
+        if (d.z() <= 0)
+            return false;
+        Point3f sample = m_sampleToCamera.inverse() * Point3f(d / d.z());
+        samplePosition = Point2f(sample.x() * m_outputSize.x(), sample.y() * m_outputSize.y());
+        return samplePosition.x() >= 0 && samplePosition.y() >= 0 &&
+            samplePosition.x() < m_outputSize.x() && samplePosition.y() < m_outputSize.y();
+    }
+
     Vector2f m_invOutputSize;
     Transform m_sampleToCamera;
     Transform m_cameraToWorld;
     float m_fov;
     float m_nearClip;
     float m_farClip;
+    float m_filmArea;
 };
 
 NORI_REGISTER_CLASS(PerspectiveCamera, "perspective");
@@ -0,0 +1,53 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/photonmap.h>
+
+NORI_NAMESPACE_BEGIN
+
+void PhotonMap::build(std::vector<Photon> &&photons, float radius) {
+    m_radius = radius;
+    m_invCellSize = 1.f / (2.f * radius);
+
+    /* About one bucket per photon (rounded up to a power of two) */
+    uint32_t bucketCount = 1;
+    while (bucketCount < photons.size())
+        bucketCount <<= 1;
+    m_bucketMask = bucketCount - 1;
+
+    /* Counting sort by bucket */
+    std::vector<uint32_t> buckets(photons.size());
+    m_bucketStart.assign(bucketCount + 1, 0);
+    for (size_t i = 0; i < photons.size(); ++i) {
+        buckets[i] = hash(getCell(photons[i].p));
+        m_bucketStart[buckets[i] + 1]++;
+    }
+    for (uint32_t i = 0; i < bucketCount; ++i)
+        m_bucketStart[i + 1] += m_bucketStart[i];
+
+    std::vector<uint32_t> next(m_bucketStart.begin(), m_bucketStart.end() - 1);
+    m_photons.resize(photons.size());
+    for (size_t i = 0; i < photons.size(); ++i)
+        m_photons[next[buckets[i]]++] = photons[i];
+
+    photons.clear();
+    photons.shrink_to_fit();
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,273 @@
+#include <nori/warp.h>
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/photonmap.h>
+#include <nori/lightbvh.h>
+#include <nori/dpdf.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Photon mapping: camera paths are followed through specular bounces up to
+ * the first diffuse surface, where the direct light is computed with emitter
+ * sampling and the indirect light (including caustics) with a density
+ * estimate of the photons stored there.
+ *
+ * The photons are emitted in parallel in the preprocess step, until the
+ * photon budget is used up. With more than one iteration, the budget is
+ * split into several photon maps whose gather radius shrinks as in
+ * probabilistic progressive photon mapping (Knaus and Zwicker 2011); every
+ * camera path uses one of them, so the image averages all iterations.
+ */
+class PhotonMapper : public Integrator
+{
+public:
+    PhotonMapper(const PropertyList &props)
+    {
+        /* Maximum number of stored photons (of all iterations) */
+        m_photonCount = props.getInteger("photonCount", 1000000);
+        /* Gather radius of the first iteration (relative to the scene's diagonal if negative) */
+        m_radius = props.getFloat("radius", -0.005f);
+        /* Number of photon maps, with shrinking radius */
+        m_iterations = props.getInteger("iterations", 1);
+        /* Radius reduction of progressive photon mapping, in (0, 1) */
+        m_alpha = props.getFloat("alpha", 0.7f);
+
+        if (m_photonCount <= 0 || m_iterations <= 0)
+            throw NoriException("PhotonMapper: photonCount and iterations must be positive!");
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        const std::vector<Emitter *> &lights = scene->getLights();
+
+        // Choose emitters proportionally to their power
+        m_lightPdf.clear();
+        for (const Emitter *light : lights) {
+            LightBounds bounds;
+            m_lightPdf.append(light->getLightBounds(bounds) ? bounds.phi : 0.f);
+        }
+        m_lightPdf.normalize();
+
+        cout << "Emitting photons .. ";
+        cout.flush();
+        Timer timer;
+
+        float radius = m_radius > 0 ? m_radius : -m_radius * scene->getBoundingBox().getExtents().norm();
+        m_maps = std::vector<PhotonMap>(m_iterations);
+        m_emitted = std::vector<size_t>(m_iterations, 0);
+        size_t photons = 0;
+        for (int i = 0; i < m_iterations; ++i) {
+            if (m_lightPdf.getSum() > 0) {
+                std::vector<Photon> stored;
+                m_emitted[i] = emitPhotons(scene, m_photonCount / m_iterations, i, stored);
+                m_maps[i].build(std::move(stored), radius);
+                photons += m_maps[i].size();
+            }
+            radius *= std::sqrt((i + 1 + m_alpha) / (i + 2));
+        }
+
+        cout << "done. (" << photons << " photons, took " << timer.elapsedString() << ")" << endl;
+    }
+
+    Color3f Li(const Scene* scene, Sampler* sampler, const Ray3f &ray) const
+    {
+        Intersection its;
+        Ray3f iteRay(ray);
+        Color3f Le(0.);
+        Color3f bsdf(1.);
+
+        bool isSpecular = false;
+
+        for(int bounce = 0;;++bounce){
+
+            if (!scene->rayIntersect(iteRay, its)){
+                if(isSpecular || bounce == 0)
+                    return Le + scene->getBackground(iteRay) * bsdf;
+
+                return Le;
+            }
+            else if (its.mesh->isEmitter()) {
+                if(isSpecular || bounce == 0){
+                    const Emitter* em = its.mesh->getEmitter(its.triIndex);
+                    EmitterQueryRecord emRecord(em, iteRay.o, its.p, its.shFrame.n, its.uv);
+                    return Le + em->eval(emRecord) * bsdf;
+                }
+
+                return Le;
+            }
+
+            const BSDF *material = its.mesh->getBSDF();
+            if (material->isDiffuse()) {
+                // Direct light with emitter sampling
+                float pdflight = 0;
+                const Emitter* emit = scene->sampleEmitter(its.p, its.shFrame.n, sampler->next1D(), pdflight);
+                if (emit) {
+                    EmitterQueryRecord emitterRecord(its.p, its.shFrame.n);
+                    emitterRecord.emitter = emit;
+                    Color3f Le_em = emit->sample(emitterRecord, sampler->next2D(), 0.);
+
+                    // A shadow ray that escapes the scene reaches the environment
+                    Ray3f sray(its.p, emitterRecord.wi);
+                    Intersection it_shadow;
+                    if (emitterRecord.pdf > 0 &&
+                        (!scene->rayIntersect(sray, it_shadow) || it_shadow.t >= (emitterRecord.dist - 1.e-5))){
+                        BSDFQueryRecord bsdfRecord_emit(its.toLocal(-iteRay.d),
+                            its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+                        Le += Le_em * bsdf * its.shFrame.n.dot(emitterRecord.wi) * material->eval(bsdfRecord_emit) / (pdflight * emitterRecord.pdf);
+                    }
+                }
+
+                // Indirect light from the photons of one of the iterations
+                int iteration = std::min((int) (sampler->next1D() * m_iterations), m_iterations - 1);
+                const PhotonMap &map = m_maps[iteration];
+                if (m_emitted[iteration] > 0) {
+                    Vector3f wi = its.toLocal(-iteRay.d);
+                    Color3f sum(0.f);
+                    map.query(its.p, [&](const Photon &photon) {
+                        BSDFQueryRecord bRec(wi, its.toLocal(photon.wi), its.uv, ESolidAngle);
+                        sum += material->eval(bRec) * photon.power;
+                    });
+                    float radius = map.getRadius();
+                    Le += bsdf * sum / (M_PI * radius * radius * m_emitted[iteration]);
+                }
+                return Le;
+            }
+
+            // Follow specular (and other non-diffuse) bounces
+            BSDFQueryRecord bsdfRecord(its.toLocal(-iteRay.d), its.uv);
+            Color3f bsdf_aux = material->sample(bsdfRecord, sampler->next2D());
+            bsdf *= bsdf_aux;
+
+            // Russian roulette (the dielectric's weight can exceed one)
+            float prob = std::min(bsdf_aux.maxCoeff(), 1.f);
+            if(sampler->next1D() >= prob){
+                return Le;
+            }
+            bsdf = bsdf / prob;
+
+            iteRay = Ray3f(its.p, its.toWorld(bsdfRecord.wo));
+            isSpecular = bsdfRecord.measure == EDiscrete;
+        }
+
+        return Le;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PhotonMapper[\n"
+            "  photonCount = %i,\n"
+            "  radius = %f,\n"
+            "  iterations = %i,\n"
+            "  alpha = %f\n"
+            "]",
+            m_photonCount, m_radius, m_iterations, m_alpha);
+    }
+
+protected:
+    /**
+     * Trace photon paths in parallel until \c budget photons are stored.
+     * Returns the number of emitted paths.
+     */
+    size_t emitPhotons(const Scene *scene, size_t budget, int iteration, std::vector<Photon> &photons) const
+    {
+        // Photon paths are traced in chunks with their own random sequence
+        const size_t chunkSize = 4096;
+        // Chunks traced in parallel at once, enough to fill the budget if no photon escapes
+        const size_t waveSize = budget / chunkSize + 1;
+        // Bound the work if most photons escape the scene
+        const size_t maxChunks = 64 * waveSize;
+
+        struct Chunk {
+            std::vector<Photon> photons;
+            std::vector<size_t> pathEnds; ///< Number of photons after each path
+        };
+        std::vector<Chunk> chunks(waveSize);
+        size_t emitted = 0;
+
+        for (size_t first = 0; first < maxChunks; first += waveSize) {
+            tbb::blocked_range<size_t> range(0, waveSize);
+            tbb::parallel_for(range, [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i < range.end(); ++i) {
+                    Chunk &chunk = chunks[i];
+                    pcg32 rng(first + i, iteration + 1);
+                    chunk.photons.clear();
+                    chunk.pathEnds.clear();
+                    for (size_t j = 0; j < chunkSize; ++j) {
+                        tracePhoton(scene, rng, chunk.photons);
+                        chunk.pathEnds.push_back(chunk.photons.size());
+                    }
+                }
+            });
+
+            // The chunks are stored in the order of their ids, so the result
+            // doesn't depend on the scheduling. The chunk that overflows the
+            // budget is truncated after its last path that fits, so the
+            // stored photons always come from complete photon paths
+            for (const Chunk &chunk : chunks) {
+                size_t paths = std::upper_bound(chunk.pathEnds.begin(), chunk.pathEnds.end(),
+                    budget - photons.size()) - chunk.pathEnds.begin();
+                size_t count = paths > 0 ? chunk.pathEnds[paths - 1] : 0;
+                photons.insert(photons.end(), chunk.photons.begin(), chunk.photons.begin() + count);
+                emitted += paths;
+                if (paths < chunkSize)
+                    return emitted;
+            }
+        }
+
+        return emitted;
+    }
+
+    /// Trace a photon path and store a photon at every diffuse surface after the first bounce
+    void tracePhoton(const Scene *scene, pcg32 &rng, std::vector<Photon> &photons) const
+    {
+        const std::vector<Emitter *> &lights = scene->getLights();
+        float lightPdf;
+        size_t index = m_lightPdf.sample(rng.nextFloat(), lightPdf);
+
+        Ray3f ray;
+        Normal3f n;
+        Point2f sample1(rng.nextFloat(), rng.nextFloat());
+        Point2f sample2(rng.nextFloat(), rng.nextFloat());
+        Color3f power = lights[index]->samplePhoton(ray, n, sample1, sample2) / lightPdf;
+
+        Intersection its;
+        for (int bounce = 0; !power.isZero() && scene->rayIntersect(ray, its); ++bounce) {
+            const BSDF *bsdf = its.mesh->getBSDF();
+
+            // Direct light is computed by emitter sampling
+            if (bounce > 0 && bsdf->isDiffuse())
+                photons.push_back(Photon(its.p, -ray.d, power));
+
+            BSDFQueryRecord bRec(its.toLocal(-ray.d), its.uv);
+            Color3f weight = bsdf->sample(bRec, Point2f(rng.nextFloat(), rng.nextFloat()));
+
+            // Russian roulette
+            float prob = std::min(weight.maxCoeff(), 1.f);
+            if (!(prob > 0) || rng.nextFloat() >= prob)
+                break;
+            power *= weight / prob;
+
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+    }
+
+    int m_photonCount;
+    float m_radius;
+    int m_iterations;
+    float m_alpha;
+    DiscretePDF m_lightPdf;
+    std::vector<PhotonMap> m_maps;
+    std::vector<size_t> m_emitted;
+};
+NORI_REGISTER_CLASS(PhotonMapper, "photonmapper");
+NORI_NAMESPACE_END
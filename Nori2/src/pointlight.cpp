@@ -1,4 +1,6 @@
 #include <nori/emitter.h>
+#include <nori/lightbvh.h>
+#include <nori/warp.h>
 
 NORI_NAMESPACE_BEGIN
 class PointEmitter : public Emitter
@@ -39,13 +41,37 @@ public:
         lRec.pdf = 1.;
         // Note that here it is assumed perfect visibility; this means
         // that visibility should be taken care of in the integrator.
-        return m_radiance / (lRec.dist);
+        return m_radiance / (lRec.dist * lRec.dist);
     } // Note that the pdf should be infinite, but for numerical reasons
     // it is more convenient to just leave as 1
     virtual float pdf(const EmitterQueryRecord &lRec) const
     {
         return 1.;
     }
+    // Photons leave uniformly in all directions, the intensity is m_radiance
+    virtual Color3f samplePhoton(Ray3f &ray, Normal3f &n, const Point2f &sample1, const Point2f &sample2) const
+    {
+        ray = Ray3f(m_position, Warp::squareToUniformSphere(sample2));
+        n = Normal3f(0.f);
+        return m_radiance * 4 * M_PI;
+    }
+    virtual void pdfPhoton(const Point3f &p, const Normal3f &n, const Vector3f &d,
+                           float &pdfPos, float &pdfDir) const
+    {
+        pdfPos = 1.;
+        pdfDir = Warp::squareToUniformSpherePdf(d);
+    }
+    // A point light emits in all directions
+    virtual bool getLightBounds(LightBounds &bounds) const
+    {
+        bounds.bounds = BoundingBox3f(m_position);
+        bounds.w = Vector3f(0, 0, 1);
+        bounds.cosTheta_o = -1.;
+        bounds.cosTheta_e = 0.;
+        bounds.phi = 4 * M_PI * m_radiance.getLuminance();
+        bounds.twoSided = false;
+        return true;
+    }
 
 protected:
     Point3f m_position;
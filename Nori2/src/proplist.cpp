@@ -20,6 +20,35 @@
 
 NORI_NAMESPACE_BEGIN
 
+/* Conversions of untyped (command line) property values */
+static void fromString(const std::string &str, bool &value) { value = toBool(str); }
+static void fromString(const std::string &str, int &value) { value = toInt(str); }
+static void fromString(const std::string &str, float &value) { value = toFloat(str); }
+static void fromString(const std::string &str, std::string &value) { value = str; }
+static void fromString(const std::string &str, Point3f &value) { value = toVector3f(str); }
+static void fromString(const std::string &str, Vector3f &value) { value = toVector3f(str); }
+
+static void fromString(const std::string &str, Color3f &value) {
+    if (tokenize(str).size() == 1)
+        value = Color3f(toFloat(str));
+    else
+        value = Color3f(toVector3f(str).array());
+}
+
+static void fromString(const std::string &, Transform &) {
+    throw NoriException("transforms cannot be specified as a string");
+}
+
+template <typename Type> static Type convert(const std::string &name, const std::string &str) {
+    Type value;
+    try {
+        fromString(str, value);
+    } catch (const std::exception &e) {
+        throw NoriException("Property '%s' has an invalid value \"%s\": %s", name, str, e.what());
+    }
+    return value;
+}
+
 #define DEFINE_PROPERTY_ACCESSOR(Type, TypeName, XmlName) \
     void PropertyList::set##TypeName(const std::string &name, const Type &value) { \
         if (m_properties.find(name) != m_properties.end()) \
@@ -33,6 +62,8 @@ NORI_NAMESPACE_BEGIN
         auto it = m_properties.find(name); \
         if (it == m_properties.end()) \
             throw NoriException("Property '%s' is missing!", name); \
+        if (it->second.type == Property::untyped_type) \
+            return convert<Type>(name, it->second.value.string_value); \
         if (it->second.type != Property::XmlName##_type) \
             throw NoriException("Property '%s' has the wrong type! " \
                 "(expected <" #XmlName ">)!", name); \
@@ -43,6 +74,8 @@ NORI_NAMESPACE_BEGIN
         auto it = m_properties.find(name); \
         if (it == m_properties.end()) \
             return defVal; \
+        if (it->second.type == Property::untyped_type) \
+            return convert<Type>(name, it->second.value.string_value); \
         if (it->second.type != Property::XmlName##_type) \
             throw NoriException("Property '%s' has the wrong type! " \
                 "(expected <" #XmlName ">)!", name); \
@@ -58,5 +91,11 @@ DEFINE_PROPERTY_ACCESSOR(Vector3f, Vector, vector)
 DEFINE_PROPERTY_ACCESSOR(std::string, String, string)
 DEFINE_PROPERTY_ACCESSOR(Transform, Transform, transform)
 
+void PropertyList::setUntyped(const std::string &name, const std::string &value) {
+    auto &prop = m_properties[name];
+    prop.value.string_value = value;
+    prop.type = Property::untyped_type;
+}
+
 NORI_NAMESPACE_END
 
@@ -0,0 +1,369 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <nori/timer.h>
+#include <nori/dpdf.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <atomic>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Sampler that records the primary sample vector of a Markov chain and
+ * replays it with mutations (Kelemen et al. 2002)
+ *
+ * Every call of next1D() returns the next component of the current state.
+ * Components are mutated lazily when they are requested: a large step
+ * replaces them with a new uniform value, a small step perturbs them with
+ * a normal distribution (accumulating the small steps that were skipped
+ * while the component was not used). Rejected mutations are undone.
+ *
+ * Paths that request more than \c maxDimensions components (e.g. rays
+ * trapped by total internal reflection, which are never terminated by
+ * Russian roulette) are aborted with a \ref PathTooLong exception.
+ */
+class MLTSampler : public Sampler {
+public:
+    struct PathTooLong { };
+
+    MLTSampler(uint64_t seed, float sigma, float largeStepProbability, size_t maxDimensions)
+        : m_sigma(sigma), m_largeStepProbability(largeStepProbability), m_maxDimensions(maxDimensions) {
+        m_sampleCount = 1;
+        m_random.seed(seed);
+    }
+
+    std::unique_ptr<Sampler> clone() const {
+        return std::unique_ptr<Sampler>(new MLTSampler(*this));
+    }
+
+    void prepare(const ImageBlock &block) { /* No-op for this sampler */ }
+
+    /// Start reading the primary sample vector from its first component
+    void generate() { m_index = 0; }
+    void advance()  { /* No-op for this sampler */ }
+
+    float next1D() {
+        if (m_index >= m_samples.size()) {
+            if (m_index >= m_maxDimensions)
+                throw PathTooLong();
+            m_samples.resize(m_index + 1);
+        }
+        PrimarySample &sample = m_samples[m_index++];
+        mutate(sample);
+        return sample.value;
+    }
+
+    Point2f next2D() {
+        float x = next1D();
+        return Point2f(x, next1D());
+    }
+
+    /// Use a new random stream for the mutations (the current state is kept)
+    void seed(uint64_t seed) { m_random.seed(seed); }
+
+    /// Propose a new state, which is either a large or a small step
+    void startIteration() {
+        ++m_iteration;
+        m_largeStep = m_random.nextFloat() < m_largeStepProbability;
+        generate();
+    }
+
+    /// Keep the proposed state
+    void accept() {
+        if (m_largeStep)
+            m_lastLargeStep = m_iteration;
+    }
+
+    /// Go back to the state before the last call of startIteration()
+    void reject() {
+        for (PrimarySample &sample : m_samples)
+            if (sample.modified == m_iteration)
+                sample.restore();
+        --m_iteration;
+    }
+
+    std::string toString() const {
+        return tfm::format("MLTSampler[sigma = %f, largeStepProbability = %f]",
+            m_sigma, m_largeStepProbability);
+    }
+
+protected:
+    struct PrimarySample {
+        float value = 0.f, backupValue = 0.f;
+        /// Iteration in which the value was last mutated
+        int64_t modified = 0, backupModified = 0;
+
+        void backup() { backupValue = value; backupModified = modified; }
+        void restore() { value = backupValue; modified = backupModified; }
+    };
+
+    void mutate(PrimarySample &sample) {
+        // Components that were not used since the last accepted large step are stale
+        if (sample.modified < m_lastLargeStep) {
+            sample.value = m_random.nextFloat();
+            sample.modified = m_lastLargeStep;
+        }
+
+        sample.backup();
+        if (m_largeStep) {
+            sample.value = m_random.nextFloat();
+        }
+        else {
+            // Apply all small steps since the last use at once (sum of normal distributions)
+            float sigma = m_sigma * std::sqrt((float) (m_iteration - sample.modified));
+            float normal = std::sqrt(-2.f * std::log(1.f - m_random.nextFloat()))
+                * std::cos(2.f * (float) M_PI * m_random.nextFloat());
+            sample.value += normal * sigma;
+            sample.value -= std::floor(sample.value);
+            if (sample.value >= 1.f)
+                sample.value = 0.f;
+        }
+        sample.modified = m_iteration;
+    }
+
+    float m_sigma;
+    float m_largeStepProbability;
+    size_t m_maxDimensions;
+    pcg32 m_random;
+    std::vector<PrimarySample> m_samples;
+    size_t m_index = 0;
+    int64_t m_iteration = 0;
+    /// The first evaluation of a chain uses new uniform values
+    bool m_largeStep = true;
+    int64_t m_lastLargeStep = 0;
+};
+
+/**
+ * Primary sample space Metropolis light transport (Kelemen et al. 2002)
+ *
+ * Wraps another integrator (given as a nested <integrator> or by name with
+ * the "nested" property) and explores the image with Markov chains over the
+ * random numbers that it consumes: the film position, the aperture and
+ * everything requested by its Li(). The chains run in parallel and splat
+ * their contributions, which are normalized with the average luminance
+ * estimated by a bootstrap phase of independent samples.
+ *
+ * The nested integrator is only used through Li(), contributions that it
+ * splats in its own postprocess step (e.g. light tracing) are not included.
+ */
+class PSSMLTIntegrator : public Integrator
+{
+public:
+    PSSMLTIntegrator(const PropertyList &props)
+    {
+        /* Name of the nested integrator, unless it is given as a child */
+        m_nestedName = props.getString("nested", "path_mis");
+        /* Number of mutations per pixel of the crop window (by default, the sample count of the sampler) */
+        m_mutationsPerPixel = props.getInteger("mutationsPerPixel", -1);
+        /* Number of independent samples used to pick the initial states and the normalization */
+        m_bootstrapSamples = props.getInteger("bootstrapSamples", 100000);
+        /* Number of Markov chains run in parallel */
+        m_chains = props.getInteger("chains", 1000);
+        /* Probability of a large step, i.e. of proposing an independent sample */
+        m_largeStepProbability = props.getFloat("largeStepProbability", 0.3f);
+        /* Standard deviation of the small steps in primary sample space */
+        m_sigma = props.getFloat("sigma", 0.01f);
+        /* Paths that consume more random numbers than this are discarded */
+        m_maxDimensions = props.getInteger("maxDimensions", 4096);
+
+        if (m_bootstrapSamples <= 0 || m_chains <= 0 || m_maxDimensions <= 0)
+            throw NoriException("PSSMLTIntegrator: the number of bootstrap samples, chains and dimensions must be positive!");
+    }
+
+    virtual ~PSSMLTIntegrator()
+    {
+        delete m_nested;
+    }
+
+    void addChild(NoriObject *obj, const std::string& name = "none")
+    {
+        switch (obj->getClassType()) {
+            case EIntegrator:
+                if (m_nested)
+                    throw NoriException("PSSMLTIntegrator: tried to register multiple nested integrators!");
+                m_nested = static_cast<Integrator *>(obj);
+                break;
+
+            default:
+                throw NoriException("PSSMLTIntegrator::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    void activate()
+    {
+        if (!m_nested) {
+            m_nested = static_cast<Integrator *>(
+                NoriObjectFactory::createInstance(m_nestedName, PropertyList()));
+            m_nested->activate();
+        }
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        m_nested->preprocess(scene);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        // Only reached when rendering without render(), e.g. by a preprocess step
+        return m_nested->Li(scene, sampler, ray);
+    }
+
+    bool needsWholeImage() const
+    {
+        return true;
+    }
+
+    bool render(const Scene *scene, const Sampler *sampler, ImageBlock &result,
+        int shardIndex, int shardCount) const
+    {
+        const Camera *camera = scene->getCamera();
+        const Point2i &offset = camera->getCropOffset();
+        const Vector2i &size = camera->getCropSize();
+        size_t pixels = (size_t) size.x() * size.y();
+
+        // Bootstrap: independent samples give the normalization and the initial states
+        std::vector<float> bootstrap(m_bootstrapSamples);
+        tbb::parallel_for(tbb::blocked_range<int>(0, m_bootstrapSamples),
+            [&](const tbb::blocked_range<int> &range) {
+            for (int i = range.begin(); i < range.end(); ++i) {
+                MLTSampler mltSampler(i, m_sigma, m_largeStepProbability, m_maxDimensions);
+                Point2f pixelSample;
+                bootstrap[i] = std::max(0.f, evalPath(scene, &mltSampler, pixelSample).getLuminance());
+            }
+        });
+
+        DiscretePDF bootstrapPdf(m_bootstrapSamples);
+        for (float luminance : bootstrap)
+            bootstrapPdf.append(luminance);
+        float b = bootstrapPdf.normalize() / m_bootstrapSamples;
+        if (b == 0)
+            return true;
+
+        // Every shard runs its own subset of the chains and gives a complete estimate
+        size_t mutationsPerPixel = m_mutationsPerPixel > 0 ? (size_t) m_mutationsPerPixel : sampler->getSampleCount();
+        size_t totalMutations = mutationsPerPixel * pixels;
+        std::vector<int> chains;
+        for (int i = shardIndex; i < m_chains; i += shardCount)
+            chains.push_back(i);
+        if (chains.empty())
+            return true;
+
+        SplatBlock splats(offset, size);
+        std::atomic<size_t> mutations(0), accepted(0);
+        Timer timer;
+
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, chains.size()),
+            [&](const tbb::blocked_range<size_t> &range) {
+            for (size_t c = range.begin(); c < range.end(); ++c) {
+                int chain = chains[c];
+                size_t chainMutations = totalMutations / m_chains + ((size_t) chain < totalMutations % m_chains ? 1 : 0);
+                pcg32 random(chain, 1);
+
+                // Start from a bootstrap sample chosen proportionally to its luminance
+                float pdf;
+                size_t index = bootstrapPdf.sample(random.nextFloat(), pdf);
+                MLTSampler mltSampler(index, m_sigma, m_largeStepProbability, m_maxDimensions);
+                Point2f currentPos;
+                Color3f current = evalPath(scene, &mltSampler, currentPos);
+                float currentI = current.getLuminance();
+                mltSampler.seed(m_bootstrapSamples + (uint64_t) chain);
+
+                size_t chainAccepted = 0;
+                for (size_t j = 0; j < chainMutations; ++j) {
+                    mltSampler.startIteration();
+                    Point2f proposedPos;
+                    Color3f proposed = evalPath(scene, &mltSampler, proposedPos);
+                    float proposedI = proposed.getLuminance();
+
+                    // Splat both states with their expected weights (a state
+                    // without contribution has nothing to splat)
+                    float a = currentI > 0 ? std::min(1.f, proposedI / currentI) : 1.f;
+                    if (a > 0 && proposedI > 0)
+                        splats.splat(proposedPos, proposed * (a / proposedI));
+                    if (a < 1 && currentI > 0)
+                        splats.splat(currentPos, current * ((1 - a) / currentI));
+
+                    if (random.nextFloat() < a) {
+                        current = proposed;
+                        currentI = proposedI;
+                        currentPos = proposedPos;
+                        mltSampler.accept();
+                        ++chainAccepted;
+                    }
+                    else
+                        mltSampler.reject();
+                }
+                mutations += chainMutations;
+                accepted += chainAccepted;
+            }
+        });
+
+        if (mutations > 0)
+            splats.putInto(result, b * pixels / mutations);
+
+        double seconds = std::max(timer.elapsed(), 1.0) / 1000.0;
+        cout << tfm::format("%i chains, %.3g mutations (%.3g mutations/s, %.1f%% accepted) .. ",
+            chains.size(), (double) mutations, mutations / seconds, 100.0 * accepted / std::max<size_t>(mutations, 1));
+        cout.flush();
+        return true;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PSSMLTIntegrator[\n"
+            "  nested = %s,\n"
+            "  mutationsPerPixel = %i,\n"
+            "  bootstrapSamples = %i,\n"
+            "  chains = %i,\n"
+            "  largeStepProbability = %f,\n"
+            "  sigma = %f,\n"
+            "  maxDimensions = %i\n"
+            "]",
+            m_nested ? indent(m_nested->toString()) : m_nestedName,
+            m_mutationsPerPixel, m_bootstrapSamples, m_chains, m_largeStepProbability, m_sigma, m_maxDimensions);
+    }
+
+protected:
+    /// Evaluate the path given by the sampler's primary sample vector
+    Color3f evalPath(const Scene *scene, MLTSampler *sampler, Point2f &pixelSample) const
+    {
+        const Camera *camera = scene->getCamera();
+        Point2f offset = camera->getCropOffset().cast<float>();
+        Vector2f size = camera->getCropSize().cast<float>();
+
+        sampler->generate();
+        Point2f filmSample = sampler->next2D();
+        pixelSample = Point2f(offset.x() + filmSample.x() * size.x(), offset.y() + filmSample.y() * size.y());
+        Point2f apertureSample = sampler->next2D();
+
+        Ray3f ray;
+        Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+        if (value.isZero())
+            return value;
+        try {
+            value *= m_nested->Li(scene, sampler, ray);
+        }
+        catch (const MLTSampler::PathTooLong &) {
+            return Color3f(0.f);
+        }
+        return value.isValid() ? value : Color3f(0.f);
+    }
+
+    Integrator *m_nested = nullptr;
+    std::string m_nestedName;
+    int m_mutationsPerPixel;
+    int m_bootstrapSamples;
+    int m_chains;
+    float m_largeStepProbability;
+    float m_sigma;
+    int m_maxDimensions;
+};
+NORI_REGISTER_CLASS(PSSMLTIntegrator, "pssmlt");
+NORI_NAMESPACE_END
@@ -84,29 +84,33 @@ float Reflectance::fresnel(float cosThetaI, float extIOR, float intIOR) {
 
 Color3f Reflectance::fresnel(float cosThetaI, const Color3f &R0)
 {
-    return R0 + (1. - R0) * pow(1. - cosThetaI, 5.);
+    float c = 1 - cosThetaI, c2 = c * c;
+    return R0 + (1.f - R0) * (c2 * c2 * c);
 }
 
 
 float Reflectance::G1(const Vector3f& wv, const Vector3f &wh, float alpha)
 {
-    float b = 1. / (alpha * sqrt(1 - wv[2] * wv[2]) / wv[2]);
-
     if (wv.dot(wh) / wv[2] <= 0)
         return 0;
 
-    if (b < 1.6)
-        return (3.535 * b + 2.181 * b * b) / (1 + 2.276 * b + 2.577 * b * b);
+    // b = 1 / (alpha tan(theta))
+    float b = wv[2] / (alpha * std::sqrt(1 - wv[2] * wv[2]));
+
+    if (b < 1.6f)
+        return (3.535f * b + 2.181f * b * b) / (1 + 2.276f * b + 2.577f * b * b);
     else
         return 1;
 }
 
 float Reflectance::BeckmannNDF(const Vector3f& wh, float alpha)
 {
-    float tan_thetah = sqrt((float)1 - wh[2] * wh[2]) / wh[2];
-    
-    return exp(-tan_thetah * tan_thetah / (alpha * alpha)) /
-        (M_PI * alpha * alpha * wh[2] * wh[2] * wh[2] * wh[2]); 
+    float cos2_thetah = wh[2] * wh[2];
+    float tan2_thetah = (1 - cos2_thetah) / cos2_thetah;
+    float alpha2 = alpha * alpha;
+
+    return std::exp(-tan2_thetah / alpha2) /
+        (M_PIf * alpha2 * cos2_thetah * cos2_thetah);
 }
 
 NORI_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,384 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/timer.h>
+#include <nori/bitmap.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/denoiser.h>
+#include <nori/bsdf.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Record the features of the first surface seen by a camera ray, for
+ * integrators that don't record them while computing the radiance
+ */
+static void sampleFeatures(const Scene *scene, const Ray3f &ray, const Point2f &sample,
+        SampleRecord &sRec) {
+    Intersection its;
+    if (!scene->rayIntersect(ray, its))
+        return;
+
+    /* The sampling weight of the BSDF is its albedo for a diffuse
+       surface, and an estimate of it for glossy ones. Emitters have no
+       albedo, so that a denoiser doesn't blur them into the surroundings */
+    if (!its.mesh->isEmitter()) {
+        BSDFQueryRecord bRec(its.toLocal(-ray.d), its.uv);
+        Color3f weight = its.mesh->getBSDF()->sample(bRec, sample);
+        if (weight.isValid())
+            sRec.albedo = weight;
+    }
+    sRec.mesh = its.mesh;
+    sRec.normal = its.shFrame.n;
+    sRec.depth = its.t;
+}
+
+/**
+ * Render the pixels of a block. With \c features, the feature buffers of the
+ * pixels are computed as well, and \c radiance = false only computes these.
+ * The AOVs of the integrator are computed when the block has layers for them
+ */
+static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block,
+        FeatureBuffers *features = nullptr, bool radiance = true) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size  = block.getSize();
+    const std::vector<Mesh *> &meshes = scene->getMeshes();
+    std::vector<Color3f> aovs(block.getLayerNames().size());
+
+    /* Clear the block contents */
+    block.clear();
+
+    /* For each pixel and pixel sample sample */
+    for (int y=0; y<size.y(); ++y) {
+        for (int x=0; x<size.x(); ++x) {
+            sampler->setPixel(Point2i(x + offset.x(), y + offset.y()));
+            sampler->generate();
+
+            Color3f sum(0.f), sumSq(0.f), albedo(0.f), normal(0.f);
+            float depth = 0.f;
+            const Mesh *mesh = nullptr;
+            int validCount = 0;
+
+            for (uint32_t i=0; i<sampler->getSampleCount(); ++i) {
+                Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+
+                SampleRecord sRec;
+                sRec.needsFeatures = features != nullptr;
+
+                if (radiance && aovs.empty() && !features) {
+                    /* Compute the incident radiance */
+                    value *= integrator->Li(scene, sampler, ray);
+
+                    /* Store in the image block */
+                    block.put(pixelSample, value);
+                } else if (radiance) {
+                    /* Compute the radiance along with the AOVs and features */
+                    std::fill(aovs.begin(), aovs.end(), Color3f(0.f));
+                    sRec.aovs = aovs.empty() ? nullptr : aovs.data();
+                    Color3f weight = value;
+                    value *= integrator->Li(scene, sampler, ray, sRec);
+                    for (Color3f &aov : aovs)
+                        aov *= weight;
+
+                    block.put(pixelSample, value, sRec.aovs);
+                }
+
+                if (features) {
+                    /* The subpixel position doubles as the BSDF sample, so
+                       that the sample sequence of the integrator is unchanged */
+                    if (!sRec.hasFeatures)
+                        sampleFeatures(scene, ray, Point2f(pixelSample.x() - std::floor(pixelSample.x()),
+                            pixelSample.y() - std::floor(pixelSample.y())), sRec);
+                    albedo += sRec.albedo;
+                    normal += sRec.normal.array();
+                    depth += sRec.depth;
+                    if (i == 0)
+                        mesh = sRec.mesh;
+                }
+
+                if (radiance && value.isValid()) {
+                    sum += value;
+                    sumSq += value * value;
+                    ++validCount;
+                }
+
+                sampler->advance();
+            }
+
+            /* Features are stored relative to the crop window, which
+               excludes the margin sampled around it */
+            Point2i pixel = Point2i(x + offset.x(), y + offset.y()) - camera->getCropOffset();
+            if (features && (pixel.array() >= 0).all() && (pixel.array() < camera->getCropSize().array()).all()) {
+                float n = (float) sampler->getSampleCount();
+                features->albedo(pixel.y(), pixel.x()) = albedo / n;
+                features->normal(pixel.y(), pixel.x()) = normal / n;
+                features->depth(pixel.y(), pixel.x()) = Color3f(depth / n);
+                if (mesh)
+                    features->meshId(pixel.y(), pixel.x()) = Color3f((float) (std::find(
+                        meshes.begin(), meshes.end(), mesh) - meshes.begin() + 1));
+                features->sampleCount(pixel.y(), pixel.x()) = Color3f((float) validCount);
+
+                /* Variance of the mean of the valid pixel samples */
+                if (validCount > 1) {
+                    float m = (float) validCount;
+                    Color3f mean = sum / m;
+                    features->variance(pixel.y(), pixel.x()) =
+                        (sumSq / m - mean * mean).max(0.f) / (m - 1);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Region of the image in which pixel samples are taken: the crop window
+ * extended by the filter border, as samples just outside of it still
+ * contribute to its pixels (clipped to the image)
+ */
+static void getSampledRegion(const Camera *camera, int borderSize, Point2i &offset, Vector2i &size) {
+    Point2i min = (camera->getCropOffset() - Vector2i::Constant(borderSize)).cwiseMax(Point2i(0, 0));
+    Point2i max = (camera->getCropOffset() + camera->getCropSize()
+        + Vector2i::Constant(borderSize)).cwiseMin(camera->getOutputSize());
+    offset = min;
+    size = max - min;
+}
+
+void renderScene(Scene *scene, ImageBlock &result, const Sampler *sampler,
+        int shardIndex, int shardCount, FeatureBuffers *features) {
+    const Camera *camera = scene->getCamera();
+    if (!sampler)
+        sampler = scene->getSampler();
+
+    if (result.getOffset() != camera->getCropOffset() || result.getSize() != camera->getCropSize())
+        throw NoriException("renderScene(): the image block does not match the crop window!");
+    if (features && (features->albedo.cols() != result.getSize().x() || features->albedo.rows() != result.getSize().y()))
+        throw NoriException("renderScene(): the feature buffers do not match the crop window!");
+    if (!result.getLayerNames().empty() && result.getLayerNames() != scene->getIntegrator()->getAOVNames())
+        throw NoriException("renderScene(): the layers of the image block are not the AOVs of the integrator!");
+
+    scene->getIntegrator()->preprocess(scene);
+
+    /* Create a block generator (i.e. a work scheduler) that only emits
+       the blocks of the current shard around the camera's crop window */
+    Point2i sampledOffset;
+    Vector2i sampledSize;
+    getSampledRegion(camera, result.getBorderSize(), sampledOffset, sampledSize);
+    BlockGenerator blockGenerator(sampledOffset, sampledSize, NORI_BLOCK_SIZE, shardIndex, shardCount);
+
+    /* Clear the output image */
+    result.clear();
+
+    cout << "Rendering .. ";
+    cout.flush();
+    Timer timer;
+
+    tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+    bool radiance = true;
+
+    auto map = [&](const tbb::blocked_range<int>& range) {
+        /* Allocate memory for a small image block to be rendered
+           by the current thread */
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+            camera->getReconstructionFilter());
+        block.setLayers(result.getLayerNames());
+
+        /* Create a clone of the sampler for the current thread */
+        std::unique_ptr<Sampler> blockSampler(sampler->clone());
+
+        for (int i = range.begin(); i < range.end(); ++i) {
+            /* Request an image block from the block generator */
+            blockGenerator.next(block);
+
+            /* Inform the sampler about the block to be rendered */
+            blockSampler->prepare(block);
+
+            /* Render all contained pixels */
+            renderBlock(scene, blockSampler.get(), block, features, radiance);
+
+            /* The image block has been processed. Now add it to
+               the "big" block that represents the entire image */
+            if (radiance)
+                result.put(block);
+        }
+    };
+
+    /// Default: parallel rendering (unless the integrator renders the whole image itself)
+    if (scene->getIntegrator()->render(scene, sampler, result, shardIndex, shardCount))
+        radiance = false;
+    if (features) {
+        features->hasVariance = radiance && sampler->getSampleCount() > 1;
+        features->hasSampleCount = radiance;
+    }
+
+    /* The features of integrators that render the image themselves
+       are computed by a separate pass over the blocks */
+    if (radiance || features)
+        tbb::parallel_for(range, map);
+
+    /// (equivalent to the following single-threaded call)
+    // map(range);
+
+    scene->getIntegrator()->postprocess(scene, result);
+
+    cout << "done. (took " << timer.elapsedString() << ")" << endl;
+}
+
+void renderSceneStreaming(Scene *scene, const std::string &outputName,
+        const EXRSettings &settings, const Sampler *sampler) {
+    const Camera *camera = scene->getCamera();
+    const Integrator *integrator = scene->getIntegrator();
+    if (!sampler)
+        sampler = scene->getSampler();
+
+    if (integrator->needsWholeImage())
+        throw NoriException("renderSceneStreaming(): the integrator needs the whole image!");
+
+    scene->getIntegrator()->preprocess(scene);
+
+    int borderSize = ImageBlock(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter()).getBorderSize();
+    Point2i sampledOffset;
+    Vector2i sampledSize;
+    getSampledRegion(camera, borderSize, sampledOffset, sampledSize);
+    BlockGenerator blockGenerator(sampledOffset, sampledSize, NORI_BLOCK_SIZE);
+    blockGenerator.setScanlineOrder();
+
+    ImageStream stream(outputName, camera->getCropOffset(), camera->getCropSize(),
+        sampledOffset, sampledSize, NORI_BLOCK_SIZE, borderSize, settings);
+
+    cout << "Rendering .. ";
+    cout.flush();
+    Timer timer;
+
+    tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+    tbb::parallel_for(range, [&](const tbb::blocked_range<int> &range) {
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+            camera->getReconstructionFilter());
+        std::unique_ptr<Sampler> blockSampler(sampler->clone());
+
+        for (int i = range.begin(); i < range.end(); ++i) {
+            blockGenerator.next(block);
+            blockSampler->prepare(block);
+            renderBlock(scene, blockSampler.get(), block);
+
+            /* Write the strips of the image that this block completes */
+            stream.put(block);
+        }
+    });
+
+    cout << "done. (took " << timer.elapsedString() << ", at most "
+         << memString(stream.getPeakStripCount() * stream.getStripMemory())
+         << " of the image in memory)" << endl;
+}
+
+void traceCameraRays(const Scene *scene, const Sampler *sampler,
+        const std::function<void(Sampler *, const Ray3f &)> &trace) {
+    const Camera *camera = scene->getCamera();
+    BlockGenerator blockGenerator(camera->getCropOffset(),
+        camera->getCropSize(), NORI_BLOCK_SIZE);
+
+    tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+    tbb::parallel_for(range, [&](const tbb::blocked_range<int> &range) {
+        /* The block only describes the pixels, nothing is stored in it */
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
+            camera->getReconstructionFilter());
+        std::unique_ptr<Sampler> blockSampler(sampler->clone());
+
+        for (int i = range.begin(); i < range.end(); ++i) {
+            blockGenerator.next(block);
+            blockSampler->prepare(block);
+
+            Point2i offset = block.getOffset();
+            Vector2i size  = block.getSize();
+            for (int y=0; y<size.y(); ++y) {
+                for (int x=0; x<size.x(); ++x) {
+                    blockSampler->setPixel(Point2i(x + offset.x(), y + offset.y()));
+                    blockSampler->generate();
+
+                    for (uint32_t j=0; j<blockSampler->getSampleCount(); ++j) {
+                        Point2f pixelSample = Point2f((float) (x + offset.x()), (float) (y + offset.y())) + blockSampler->next2D();
+                        Point2f apertureSample = blockSampler->next2D();
+
+                        Ray3f ray;
+                        if (!camera->sampleRay(ray, pixelSample, apertureSample).isZero())
+                            trace(blockSampler.get(), ray);
+
+                        blockSampler->advance();
+                    }
+                }
+            }
+        }
+    });
+}
+
+ImageBlock *createImageBlock(const Camera *camera) {
+    ImageBlock *result = new ImageBlock(camera->getCropSize(),
+        camera->getReconstructionFilter());
+    result->setOffset(camera->getCropOffset());
+    result->clear();
+    return result;
+}
+
+void compositeImage(const ImageBlock &result, Bitmap &target) {
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    Point2i offset = result.getOffset();
+    if (offset.x() + bitmap->cols() > target.cols() || offset.y() + bitmap->rows() > target.rows())
+        throw NoriException("compositeImage(): the image block does not fit into the target bitmap!");
+    target.block(offset.y(), offset.x(), bitmap->rows(), bitmap->cols()) = *bitmap;
+}
+
+void saveImage(const ImageBlock &result, const std::string &outputName,
+        const FeatureBuffers *features, const EXRSettings &settings) {
+    /* Now turn the rendered image block into
+       a properly normalized bitmap */
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+
+    /* The AOVs of the integrator and the features become layers of the same file */
+    std::vector<std::unique_ptr<Bitmap>> aovs;
+    std::vector<BitmapLayer> layers;
+    for (size_t i = 0; i < result.getLayerNames().size(); ++i) {
+        aovs.emplace_back(result.layerToBitmap(i));
+        layers.push_back({ result.getLayerNames()[i], aovs.back().get(), "RGB" });
+    }
+    if (features) {
+        std::vector<BitmapLayer> featureLayers = features->getLayers();
+        layers.insert(layers.end(), featureLayers.begin(), featureLayers.end());
+    }
+
+    /* Save using the OpenEXR format */
+    bitmap->saveEXR(outputName, layers, settings);
+
+    /* Save tonemapped (sRGB) output using the PNG format */
+    bitmap->savePNG(outputName);
+}
+
+NORI_NAMESPACE_END
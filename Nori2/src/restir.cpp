@@ -0,0 +1,406 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/block.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <pcg32.h>
+#include <functional>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * Direct illumination with reservoir-based spatiotemporal importance
+ * resampling (ReSTIR DI, Bitterli et al. 2020)
+ *
+ * The image is rendered in passes of one sample per pixel. In every pass:
+ *  1. A G-buffer stores the first intersection of each pixel.
+ *  2. Each pixel draws many cheap light candidates with Scene::sampleEmitter()
+ *     and keeps one of them with weighted reservoir sampling, with the
+ *     unshadowed contribution as target function.
+ *  3. The reservoir of the previous pass (temporal reuse) and those of
+ *     random neighbours with a similar surface (spatial reuse) are merged
+ *     into it.
+ *  4. Only the selected light sample is shaded with a shadow ray.
+ *
+ * Light samples on area lights are reused in area measure so that they
+ * can be moved between shading points. Merged reservoirs are normalized
+ * with the number of candidates that could have produced the sample,
+ * which keeps the estimate unbiased.
+ */
+class ReSTIRDirect : public Integrator
+{
+public:
+    ReSTIRDirect(const PropertyList &props)
+    {
+        /* Number of light candidates per pixel and pass */
+        m_candidates = props.getInteger("candidates", 32);
+        /* Number of rounds of spatial reuse */
+        m_spatialIterations = props.getInteger("spatialIterations", 1);
+        /* Neighbours merged in every round of spatial reuse */
+        m_spatialSamples = props.getInteger("spatialSamples", 5);
+        /* Radius of the neighbourhood in pixels */
+        m_spatialRadius = props.getFloat("spatialRadius", 10.f);
+        /* Reuse the reservoirs of the previous pass. The passes of a still image then become
+           correlated, which usually costs more than it gains, so it is disabled by default */
+        m_temporalReuse = props.getBoolean("temporalReuse", false);
+        /* The history is limited to this many times the candidates of one pass */
+        m_maxHistory = props.getFloat("maxHistory", 20.f);
+
+        if (m_candidates <= 0)
+            throw NoriException("ReSTIRDirect: the number of candidates must be positive!");
+    }
+
+    /// Estimate of a single ray, without any resampling (e.g. for a preprocess step)
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        Intersection its;
+        if (!scene->rayIntersect(ray, its))
+            return scene->getBackground(ray);
+
+        Color3f L = emitted(its, ray);
+        float pdfLight;
+        const Emitter *emitter = scene->sampleEmitter(its.p, its.shFrame.n, sampler->next1D(), pdfLight);
+        LightSample y;
+        float pdf;
+        if (emitter && sampleLight(emitter, its.p, sampler->next2D(), y, pdf) && pdf > 0) {
+            Vector3f wi;
+            Color3f f = integrand(y, its, -ray.d, wi);
+            if (!f.isZero() && visible(scene, its.p, y, wi))
+                L += f / (pdfLight * pdf);
+        }
+        return L;
+    }
+
+    bool needsWholeImage() const
+    {
+        return true;
+    }
+
+    bool render(const Scene *scene, const Sampler *sampler, ImageBlock &result,
+        int shardIndex, int shardCount) const
+    {
+        const Camera *camera = scene->getCamera();
+        const Point2i &offset = camera->getCropOffset();
+        const Vector2i &size = camera->getCropSize();
+        int pixelCount = size.x() * size.y();
+
+        // Reservoirs of all pixels are needed for the reuse, even with shards
+        std::vector<Pixel> pixels(pixelCount), previous;
+        std::vector<Reservoir> reservoirs(pixelCount), reused(pixelCount);
+        std::vector<pcg32> randoms(pixelCount);
+        for (int i = 0; i < pixelCount; ++i)
+            randoms[i].seed(i, 1);
+
+        auto forEachPixel = [&](const std::function<void(int, int, int)> &func) {
+            tbb::parallel_for(tbb::blocked_range<int>(0, size.y()), [&](const tbb::blocked_range<int> &range) {
+                for (int y = range.begin(); y < range.end(); ++y)
+                    for (int x = 0; x < size.x(); ++x)
+                        func(x, y, y * size.x() + x);
+            });
+        };
+
+        size_t passes = sampler->getSampleCount();
+        for (size_t pass = 0; pass < passes; ++pass) {
+            // G-buffer and initial candidates
+            forEachPixel([&](int x, int y, int i) {
+                pcg32 &random = randoms[i];
+                Pixel &pixel = pixels[i];
+                pixel.samplePosition = Point2f(x + offset.x() + random.nextFloat(), y + offset.y() + random.nextFloat());
+                Ray3f ray;
+                pixel.weight = camera->sampleRay(ray, pixel.samplePosition, Point2f(random.nextFloat(), random.nextFloat()));
+                pixel.wo = -ray.d;
+                pixel.valid = scene->rayIntersect(ray, pixel.its);
+                pixel.depth = pixel.valid ? pixel.its.t : 0.f;
+                pixel.Le = pixel.valid ? emitted(pixel.its, ray) : scene->getBackground(ray);
+
+                Reservoir &r = reservoirs[i];
+                r = Reservoir();
+                if (!pixel.valid)
+                    return;
+                for (int j = 0; j < m_candidates; ++j) {
+                    float pdfLight, pdf;
+                    LightSample candidate;
+                    const Emitter *emitter = scene->sampleEmitter(pixel.its.p, pixel.its.shFrame.n, random.nextFloat(), pdfLight);
+                    Point2f sample(random.nextFloat(), random.nextFloat());
+                    float pHat = 0.f;
+                    if (emitter && sampleLight(emitter, pixel.its.p, sample, candidate, pdf) && pdf > 0)
+                        pHat = targetPdf(candidate, pixel);
+                    r.update(candidate, pHat > 0 ? pHat / (pdfLight * pdf) : 0.f, pHat, 1.f, random.nextFloat());
+                }
+                r.finalize(r.M);
+            });
+
+            // Temporal reuse: merge the final reservoir of the previous pass at the same pixel
+            if (m_temporalReuse && pass > 0) {
+                forEachPixel([&](int x, int y, int i) {
+                    const Pixel &pixel = pixels[i], &prev = previous[i];
+                    if (!pixel.valid || !prev.valid || !similar(pixel, prev))
+                        return;
+                    Reservoir history = reused[i];
+                    history.M = std::min(history.M, m_maxHistory * m_candidates);
+                    const Pixel *sources[2] = { &pixel, &prev };
+                    const Reservoir *inputs[2] = { &reservoirs[i], &history };
+                    reservoirs[i] = merge(pixel, sources, inputs, 2, randoms[i]);
+                });
+            }
+
+            // Spatial reuse
+            for (int iteration = 0; iteration < m_spatialIterations; ++iteration) {
+                forEachPixel([&](int x, int y, int i) {
+                    const Pixel &pixel = pixels[i];
+                    if (!pixel.valid) {
+                        reused[i] = reservoirs[i];
+                        return;
+                    }
+                    pcg32 &random = randoms[i];
+                    std::vector<const Pixel *> sources(1, &pixel);
+                    std::vector<const Reservoir *> inputs(1, &reservoirs[i]);
+                    for (int j = 0; j < m_spatialSamples; ++j) {
+                        float radius = m_spatialRadius * std::sqrt(random.nextFloat());
+                        float phi = 2 * M_PI * random.nextFloat();
+                        int nx = x + (int) std::round(radius * std::cos(phi));
+                        int ny = y + (int) std::round(radius * std::sin(phi));
+                        if (nx < 0 || ny < 0 || nx >= size.x() || ny >= size.y() || (nx == x && ny == y))
+                            continue;
+                        int n = ny * size.x() + nx;
+                        if (!pixels[n].valid || !similar(pixel, pixels[n]))
+                            continue;
+                        sources.push_back(&pixels[n]);
+                        inputs.push_back(&reservoirs[n]);
+                    }
+                    reused[i] = merge(pixel, sources.data(), inputs.data(), (int) sources.size(), random);
+                });
+                std::swap(reservoirs, reused);
+            }
+            // The history of the next pass
+            std::swap(reservoirs, reused);
+
+            // Shading with a single shadow ray per pixel
+            BlockGenerator blockGenerator(offset, size, NORI_BLOCK_SIZE, shardIndex, shardCount);
+            tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()),
+                [&](const tbb::blocked_range<int> &range) {
+                ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+                for (int b = range.begin(); b < range.end(); ++b) {
+                    blockGenerator.next(block);
+                    block.clear();
+                    Point2i blockOffset = block.getOffset() - offset;
+                    for (int y = 0; y < block.getSize().y(); ++y) {
+                        for (int x = 0; x < block.getSize().x(); ++x) {
+                            int i = (y + blockOffset.y()) * size.x() + x + blockOffset.x();
+                            const Pixel &pixel = pixels[i];
+                            const Reservoir &r = reused[i];
+                            Color3f L = pixel.Le;
+                            if (pixel.valid && r.W > 0) {
+                                Vector3f wi;
+                                Color3f f = integrand(r.y, pixel.its, pixel.wo, wi);
+                                if (!f.isZero() && visible(scene, pixel.its.p, r.y, wi))
+                                    L += f * r.W;
+                            }
+                            block.put(pixel.samplePosition, pixel.weight * L);
+                        }
+                    }
+                    result.put(block);
+                }
+            });
+
+            if (m_temporalReuse)
+                std::swap(pixels, previous);
+            if (pixels.empty())
+                pixels.resize(pixelCount);
+        }
+        return true;
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "ReSTIRDirect[\n"
+            "  candidates = %i,\n"
+            "  spatialIterations = %i,\n"
+            "  spatialSamples = %i,\n"
+            "  spatialRadius = %f,\n"
+            "  temporalReuse = %s,\n"
+            "  maxHistory = %f\n"
+            "]",
+            m_candidates, m_spatialIterations, m_spatialSamples, m_spatialRadius,
+            m_temporalReuse ? "true" : "false", m_maxHistory);
+    }
+
+protected:
+    /// Point on a light (area and point lights) or direction (environment)
+    struct LightSample {
+        const Emitter *emitter = nullptr;
+        Point3f p = Point3f(0.f);
+        Normal3f n = Normal3f(0.f);
+        Point2f uv = Point2f(0.f);
+    };
+
+    struct Reservoir {
+        LightSample y;
+        /// Target function of \c y at the pixel of the reservoir
+        float pHat = 0.f;
+        float wSum = 0.f;
+        /// Number of candidates seen
+        float M = 0.f;
+        /// Contribution weight of \c y, i.e. an estimate of its inverse density
+        float W = 0.f;
+
+        void update(const LightSample &sample, float w, float samplePHat, float count, float rnd) {
+            wSum += w;
+            M += count;
+            if (w > 0 && rnd * wSum < w) {
+                y = sample;
+                pHat = samplePHat;
+            }
+        }
+
+        /// Compute W, where Z is the number of candidates that could have produced y
+        void finalize(float Z) {
+            W = (pHat > 0 && Z > 0) ? wSum / (Z * pHat) : 0.f;
+        }
+    };
+
+    struct Pixel {
+        bool valid = false;
+        Intersection its;
+        Vector3f wo;
+        float depth = 0.f;
+        Point2f samplePosition;
+        /// Importance of the camera ray
+        Color3f weight;
+        /// Radiance emitted by the first intersection (or the background)
+        Color3f Le;
+    };
+
+    static bool isEnvironment(const Emitter *emitter)
+    {
+        return emitter->getEmitterType() == EmitterType::EMITTER_ENVIRONMENT;
+    }
+
+    static Color3f emitted(const Intersection &its, const Ray3f &ray)
+    {
+        if (!its.mesh->isEmitter())
+            return Color3f(0.f);
+        const Emitter *em = its.mesh->getEmitter();
+        return em->eval(EmitterQueryRecord(em, ray.o, its.p, its.shFrame.n, its.uv));
+    }
+
+    /**
+     * Sample a point on the emitter as seen from \c ref. Returns its
+     * density in the measure the sample is reused in: area for area
+     * lights, solid angle for the environment, one for point lights.
+     */
+    static bool sampleLight(const Emitter *emitter, const Point3f &ref, const Point2f &sample,
+        LightSample &y, float &pdf)
+    {
+        EmitterQueryRecord lRec(ref);
+        lRec.emitter = emitter;
+        if (emitter->sample(lRec, sample, 0.f).isZero() || lRec.pdf <= 0)
+            return false;
+
+        y.emitter = emitter;
+        y.n = lRec.n;
+        y.uv = lRec.uv;
+        pdf = lRec.pdf;
+        if (isEnvironment(emitter))
+            y.p = Point3f(lRec.wi);
+        else {
+            y.p = lRec.p;
+            if (!emitter->isDelta())
+                pdf *= std::abs(lRec.n.dot(lRec.wi)) / (lRec.dist * lRec.dist);
+        }
+        return true;
+    }
+
+    /// Radiance arriving at \c ref from the light sample, in the measure of the sample
+    static Color3f incident(const LightSample &y, const Point3f &ref, Vector3f &wi, float &dist)
+    {
+        EmitterQueryRecord lRec(ref);
+        lRec.emitter = y.emitter;
+        if (isEnvironment(y.emitter)) {
+            lRec.wi = wi = Vector3f(y.p);
+            dist = std::numeric_limits<float>::infinity();
+            return y.emitter->eval(lRec);
+        }
+        if (y.emitter->isDelta()) {
+            // Point lights are deterministic: sampling them again gives the incident radiance
+            Color3f Le = y.emitter->sample(lRec, Point2f(0.5f), 0.f);
+            wi = lRec.wi;
+            dist = lRec.dist;
+            return Le;
+        }
+        lRec = EmitterQueryRecord(y.emitter, ref, y.p, y.n, y.uv);
+        wi = lRec.wi;
+        dist = lRec.dist;
+        if (dist == 0)
+            return Color3f(0.f);
+        return y.emitter->eval(lRec) * std::abs(y.n.dot(wi)) / (dist * dist);
+    }
+
+    /// Unshadowed contribution of the light sample to the surface
+    static Color3f integrand(const LightSample &y, const Intersection &its, const Vector3f &wo, Vector3f &wi)
+    {
+        float dist;
+        Color3f Le = incident(y, its.p, wi, dist);
+        if (Le.isZero())
+            return Le;
+        BSDFQueryRecord bRec(its.toLocal(wo), its.toLocal(wi), its.uv, ESolidAngle);
+        return Le * its.mesh->getBSDF()->eval(bRec) * std::abs(its.shFrame.n.dot(wi));
+    }
+
+    static float targetPdf(const LightSample &y, const Pixel &pixel)
+    {
+        Vector3f wi;
+        return std::max(0.f, integrand(y, pixel.its, pixel.wo, wi).getLuminance());
+    }
+
+    static bool visible(const Scene *scene, const Point3f &p, const LightSample &y, const Vector3f &wi)
+    {
+        if (isEnvironment(y.emitter))
+            return !scene->rayIntersect(Ray3f(p, wi));
+        float dist = (y.p - p).norm();
+        return !scene->rayIntersect(Ray3f(p, wi, Epsilon, dist * (1 - Epsilon)));
+    }
+
+    /// Neighbours are only reused if their surface is similar (normal and depth)
+    static bool similar(const Pixel &a, const Pixel &b)
+    {
+        return a.its.shFrame.n.dot(b.its.shFrame.n) > 0.9f
+            && std::abs(a.depth - b.depth) < 0.1f * a.depth;
+    }
+
+    /// Merge the reservoirs of several pixels into a reservoir for \c pixel (sources[0] must be \c pixel)
+    Reservoir merge(const Pixel &pixel, const Pixel * const *sources, const Reservoir * const *inputs,
+        int count, pcg32 &random) const
+    {
+        Reservoir r;
+        for (int j = 0; j < count; ++j) {
+            const Reservoir &q = *inputs[j];
+            float pHat = j == 0 ? q.pHat : (q.W > 0 ? targetPdf(q.y, pixel) : 0.f);
+            r.update(q.y, pHat * q.W * q.M, pHat, q.M, random.nextFloat());
+        }
+        if (r.pHat <= 0)
+            return r;
+
+        // Only the candidates of pixels where the sample has a nonzero target count
+        float Z = 0.f;
+        for (int j = 0; j < count; ++j)
+            if (j == 0 || targetPdf(r.y, *sources[j]) > 0)
+                Z += inputs[j]->M;
+        r.finalize(Z);
+        return r;
+    }
+
+    int m_candidates;
+    int m_spatialIterations;
+    int m_spatialSamples;
+    float m_spatialRadius;
+    bool m_temporalReuse;
+    float m_maxHistory;
+};
+NORI_REGISTER_CLASS(ReSTIRDirect, "restir");
+NORI_NAMESPACE_END
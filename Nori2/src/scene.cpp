@@ -24,14 +24,22 @@
 #include <nori/integrator.h>
 #include <nori/sampler.h>
 #include <nori/camera.h>
+#include <nori/denoiser.h>
 #include <nori/emitter.h>
+#include <nori/bsdf.h>
 #include <numeric>
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &) {
+Scene::Scene(const PropertyList &propList) {
     m_accel = new Accel();
     m_enviromentalEmitter = 0;
+
+    std::string lightSampling = propList.getString("lightSampling", "bvh");
+    if (lightSampling == "uniform")
+        m_uniformLightSampling = true;
+    else if (lightSampling != "bvh")
+        throw NoriException("Scene: unknown light sampling strategy \"%s\"!", lightSampling);
 }
 
 Scene::~Scene() {
@@ -39,7 +47,9 @@ Scene::~Scene() {
     delete m_sampler;
     delete m_camera;
     delete m_integrator;
+    delete m_denoiser;
     delete impSampling;
+    delete m_lightBVH;
 }
 
 void Scene::activate() {
@@ -64,17 +74,30 @@ void Scene::activate() {
     }
 
     std::vector<float> luminances(m_emitters.size());
-    Point3f refPoint;
+    Point3f refPoint(0.f);
     EmitterQueryRecord emitterRecord(refPoint);
-    impSampling = new DiscretePDF(m_emitters.size());
+    impSampling = new DiscreteAliasPDF(m_emitters.size());
 
     for(auto i : m_emitters){
-        impSampling->append(i->sample(emitterRecord, Point2f(), 0.0f).getLuminance());
+        impSampling->append(i->sample(emitterRecord, Point2f(0.5f, 0.5f), 0.0f).getLuminance());
     }
     
     if(!impSampling->isNormalized())
         impSampling->normalize();
 
+    // None of the samples hit a bright region: choose all emitters uniformly
+    if(!impSampling->isNormalized()){
+        impSampling->clear();
+        for(size_t i = 0; i < m_emitters.size(); ++i)
+            impSampling->append(1.0f);
+        impSampling->normalize();
+    }
+
+    for (const Emitter *emitter : m_emitters)
+        emitter->getLightPrimitives(m_lightPrimitives);
+    if (!m_uniformLightSampling)
+        m_lightBVH = new LightBVH(m_lightPrimitives);
+
     cout << endl;
     cout << "Configuration: " << toString() << endl;
     cout << endl;
@@ -98,6 +121,26 @@ float Scene::pdfEmitter(const Emitter *em) const {
     return 1. / float(m_emitters.size());
 }
 
+const Emitter * Scene::sampleEmitter(const Point3f &p, const Normal3f &n, float rnd, float &pdf) const {
+    if (m_lightBVH)
+        return m_lightBVH->sample(p, n, rnd, pdf);
+
+    if (m_lightPrimitives.empty()) {
+        pdf = 0;
+        return nullptr;
+    }
+    size_t count = m_lightPrimitives.size();
+    size_t index = std::min(static_cast<size_t>(std::floor(count * rnd)), count - 1);
+    pdf = 1. / float(count);
+    return m_lightPrimitives[index];
+}
+
+float Scene::pdfEmitter(const Emitter *em, const Point3f &p, const Normal3f &n) const {
+    if (m_lightBVH)
+        return m_lightBVH->pmf(p, n, em);
+    return m_lightPrimitives.empty() ? 0.f : 1. / float(m_lightPrimitives.size());
+}
+
 
 void Scene::addChild(NoriObject *obj, const std::string& name) {
     switch (obj->getClassType()) {
@@ -139,12 +182,76 @@ void Scene::addChild(NoriObject *obj, const std::string& name) {
             m_integrator = static_cast<Integrator *>(obj);
             break;
 
+        case EDenoiser:
+            if (m_denoiser)
+                throw NoriException("There can only be one denoiser per scene!");
+            m_denoiser = static_cast<Denoiser *>(obj);
+            break;
+
         default:
             throw NoriException("Scene::addChild(<%s>) is not supported!",
                 classTypeName(obj->getClassType()));
     }
 }
 
+std::string Scene::getReplaceablePath(const std::string &key) {
+    std::vector<std::string> path = tokenize(key, ".");
+    if (path.size() < 2)
+        return "";
+
+    std::string tag = path[0].substr(0, path[0].find('['));
+    if (tag == "camera" || tag == "sampler" || tag == "integrator" || tag == "denoiser")
+        return path[0];
+
+    /* The BSDF (and its textures) of a mesh, but not the mesh itself */
+    if (tag == "mesh" && path.size() >= 3 && path[1].substr(0, path[1].find('[')) == "bsdf")
+        return path[0] + "." + path[1];
+
+    return "";
+}
+
+void Scene::replaceChild(NoriObject *obj, const std::string &path) {
+    switch (obj->getClassType()) {
+        case ESampler:
+            delete m_sampler;
+            m_sampler = static_cast<Sampler *>(obj);
+            break;
+
+        case ECamera:
+            delete m_camera;
+            m_camera = static_cast<Camera *>(obj);
+            break;
+
+        case EIntegrator:
+            delete m_integrator;
+            m_integrator = static_cast<Integrator *>(obj);
+            break;
+
+        case EDenoiser:
+            delete m_denoiser;
+            m_denoiser = static_cast<Denoiser *>(obj);
+            break;
+
+        case EBSDF: {
+                /* Look up the mesh index in a path like "mesh[1].bsdf[0]" */
+                size_t start = path.find('['), end = path.find(']');
+                if (path.compare(0, 5, "mesh[") != 0 || end == std::string::npos)
+                    throw NoriException("Scene::replaceChild(): invalid BSDF path \"%s\"", path);
+                size_t index = toUInt(path.substr(start + 1, end - start - 1));
+                if (index >= m_meshes.size())
+                    throw NoriException("Scene::replaceChild(): no mesh with index %i", index);
+                m_meshes[index]->setBSDF(static_cast<BSDF *>(obj));
+                obj->setParent(m_meshes[index]);
+            }
+            return;
+
+        default:
+            throw NoriException("Scene::replaceChild(<%s>) is not supported!",
+                classTypeName(obj->getClassType()));
+    }
+    obj->setParent(this);
+}
+
 Color3f Scene::getBackground(const Ray3f& ray) const
 {
     if (!m_enviromentalEmitter)
@@ -178,6 +285,7 @@ std::string Scene::toString() const {
         "  integrator = %s,\n"
         "  sampler = %s\n"
         "  camera = %s,\n"
+        "  denoiser = %s,\n"
         "  meshes = {\n"
         "  %s  }\n"
 		"  emitters = {\n"
@@ -186,6 +294,7 @@ std::string Scene::toString() const {
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
         indent(m_camera->toString()),
+        m_denoiser ? indent(m_denoiser->toString()) : std::string("null"),
         indent(meshes, 2),
 		indent(lights, 2)
     );
@@ -0,0 +1,298 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/sdtree.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Largest float below one
+static const float OneMinusEpsilon = 0.99999994f;
+
+/// Maximum depth of the spatial tree
+static const int MaxSpatialDepth = 30;
+
+static void atomicAdd(std::atomic<float> &target, float value) {
+    float current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+        ;
+}
+
+/// Area preserving mapping from the unit sphere to the unit square
+static Point2f dirToSquare(const Vector3f &dir) {
+    float cosTheta = clamp(dir.z(), -1.f, 1.f);
+    float phi = std::atan2(dir.y(), dir.x());
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Point2f(clamp((cosTheta + 1) * 0.5f, 0.f, OneMinusEpsilon),
+                   clamp(phi * INV_TWOPI, 0.f, OneMinusEpsilon));
+}
+
+/// Inverse of \ref dirToSquare()
+static Vector3f squareToDir(const Point2f &p) {
+    float cosTheta = 2 * p.x() - 1;
+    float sinTheta = std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta));
+    float phi = 2 * M_PI * p.y();
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+/// Return the quadrant of p and map p to the unit square of that quadrant
+static int childQuadrant(Point2f &p) {
+    int x = p.x() >= 0.5f ? 1 : 0, y = p.y() >= 0.5f ? 1 : 0;
+    p = Point2f(clamp(2 * p.x() - x, 0.f, OneMinusEpsilon), clamp(2 * p.y() - y, 0.f, OneMinusEpsilon));
+    return x + 2 * y;
+}
+
+DTree::Node::Node() {
+    for (int q = 0; q < 4; ++q) {
+        sum[q].store(0.f, std::memory_order_relaxed);
+        child[q] = 0;
+    }
+}
+
+DTree::Node::Node(const Node &other) {
+    *this = other;
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other) {
+    for (int q = 0; q < 4; ++q) {
+        sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[q] = other.child[q];
+    }
+    return *this;
+}
+
+float DTree::Node::getTotal() const {
+    float total = 0.f;
+    for (int q = 0; q < 4; ++q)
+        total += sum[q].load(std::memory_order_relaxed);
+    return total;
+}
+
+DTree::DTree() : m_nodes(1) { }
+
+void DTree::record(const Vector3f &dir, float value) {
+    if (!(value > 0) || !std::isfinite(value))
+        return;
+
+    Point2f p = dirToSquare(dir);
+    uint32_t index = 0;
+    while (true) {
+        Node &node = m_nodes[index];
+        int q = childQuadrant(p);
+        atomicAdd(node.sum[q], value);
+        if (!node.child[q])
+            break;
+        index = node.child[q];
+    }
+}
+
+Vector3f DTree::sample(Point2f sample) const {
+    Point2f origin(0.f, 0.f);
+    float size = 1.f;
+    uint32_t index = 0;
+
+    while (true) {
+        const Node &node = m_nodes[index];
+        float s[4];
+        for (int q = 0; q < 4; ++q)
+            s[q] = node.sum[q].load(std::memory_order_relaxed);
+        float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0))
+            break;
+
+        /* Choose the column, then the quadrant within it */
+        int x = 0, y = 0;
+        float pLeft = (s[0] + s[2]) / total;
+        if (sample.x() < pLeft) {
+            sample.x() = sample.x() / pLeft;
+        } else {
+            x = 1;
+            sample.x() = (sample.x() - pLeft) / (1 - pLeft);
+        }
+        float pBottom = s[x] / (s[x] + s[x + 2]);
+        if (sample.y() < pBottom) {
+            sample.y() = sample.y() / pBottom;
+        } else {
+            y = 1;
+            sample.y() = (sample.y() - pBottom) / (1 - pBottom);
+        }
+        sample = Point2f(std::min(sample.x(), OneMinusEpsilon), std::min(sample.y(), OneMinusEpsilon));
+
+        size *= 0.5f;
+        origin += Vector2f(x * size, y * size);
+
+        int q = x + 2 * y;
+        if (!node.child[q])
+            break;
+        index = node.child[q];
+    }
+
+    return squareToDir(origin + sample * size);
+}
+
+float DTree::pdf(const Vector3f &dir) const {
+    Point2f p = dirToSquare(dir);
+    float pdf = 1.f;
+    uint32_t index = 0;
+
+    while (true) {
+        const Node &node = m_nodes[index];
+        float total = node.getTotal();
+        if (!(total > 0))
+            break;
+
+        int q = childQuadrant(p);
+        pdf *= 4 * node.sum[q].load(std::memory_order_relaxed) / total;
+        if (!node.child[q])
+            break;
+        index = node.child[q];
+    }
+
+    return pdf * INV_FOURPI;
+}
+
+float DTree::getTotal() const {
+    return m_nodes[0].getTotal();
+}
+
+void DTree::refine(const DTree &previous, float threshold, int maxDepth) {
+    m_nodes.assign(1, Node());
+
+    float total = previous.getTotal();
+    if (!(total > 0))
+        return;
+
+    /* Nodes of the new tree, with the matching node of the previous tree
+       (if any) and the energy of the node */
+    struct Item {
+        uint32_t node;
+        int previous;
+        float energy;
+        int depth;
+    };
+    std::vector<Item> stack;
+    stack.push_back(Item { 0, 0, total, 1 });
+
+    while (!stack.empty()) {
+        Item item = stack.back();
+        stack.pop_back();
+
+        for (int q = 0; q < 4; ++q) {
+            /* Quadrants that were not subdivided before get a quarter of the energy */
+            float energy = item.energy / 4;
+            int previousChild = -1;
+            if (item.previous >= 0) {
+                const Node &node = previous.m_nodes[item.previous];
+                energy = node.sum[q].load(std::memory_order_relaxed);
+                if (node.child[q])
+                    previousChild = (int) node.child[q];
+            }
+
+            if (item.depth < maxDepth && energy > threshold * total) {
+                uint32_t child = (uint32_t) m_nodes.size();
+                m_nodes.push_back(Node());
+                m_nodes[item.node].child[q] = child;
+                stack.push_back(Item { child, previousChild, energy, item.depth + 1 });
+            }
+        }
+    }
+}
+
+SDTree::SDTree(const BoundingBox3f &bounds) {
+    /* Use a slightly enlarged cube, so that the leaves stay well shaped */
+    Point3f center = bounds.getCenter();
+    float extent = 0.5f * bounds.getExtents().maxCoeff() * 1.01f + Epsilon;
+    m_bounds = BoundingBox3f(center - Vector3f::Constant(extent), center + Vector3f::Constant(extent));
+
+    m_nodes.push_back(Node { -1, 0 });
+    m_leaves.emplace_back(new Leaf());
+}
+
+SDTree::Leaf *SDTree::lookup(const Point3f &p) const {
+    Point3f min = m_bounds.min, max = m_bounds.max;
+    uint32_t index = 0;
+    while (m_nodes[index].axis >= 0) {
+        const Node &node = m_nodes[index];
+        float mid = 0.5f * (min[node.axis] + max[node.axis]);
+        if (p[node.axis] < mid) {
+            max[node.axis] = mid;
+            index = node.index;
+        } else {
+            min[node.axis] = mid;
+            index = node.index + 1;
+        }
+    }
+    return m_leaves[m_nodes[index].index].get();
+}
+
+void SDTree::split(uint32_t nodeIndex, int depth, uint32_t spatialThreshold) {
+    uint32_t leafIndex = m_nodes[nodeIndex].index;
+    Leaf *leaf = m_leaves[leafIndex].get();
+    uint32_t count = leaf->count.load();
+    if (count <= spatialThreshold || depth >= MaxSpatialDepth)
+        return;
+
+    /* Both halves start with the directional trees of the parent */
+    std::unique_ptr<Leaf> copy(new Leaf());
+    copy->sampling = leaf->sampling;
+    copy->building = leaf->building;
+    copy->count = count / 2;
+    leaf->count = count - count / 2;
+
+    uint32_t copyIndex = (uint32_t) m_leaves.size();
+    m_leaves.push_back(std::move(copy));
+
+    uint32_t first = (uint32_t) m_nodes.size();
+    m_nodes.push_back(Node { -1, leafIndex });
+    m_nodes.push_back(Node { -1, copyIndex });
+    m_nodes[nodeIndex].axis = depth % 3;
+    m_nodes[nodeIndex].index = first;
+
+    split(first, depth + 1, spatialThreshold);
+    split(first + 1, depth + 1, spatialThreshold);
+}
+
+void SDTree::refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth) {
+    /* Find the current leaves and their depth */
+    std::vector<std::pair<uint32_t, int>> leaves, stack;
+    stack.push_back(std::make_pair(0u, 0));
+    while (!stack.empty()) {
+        std::pair<uint32_t, int> item = stack.back();
+        stack.pop_back();
+        const Node &node = m_nodes[item.first];
+        if (node.axis < 0) {
+            leaves.push_back(item);
+        } else {
+            stack.push_back(std::make_pair(node.index, item.second + 1));
+            stack.push_back(std::make_pair(node.index + 1, item.second + 1));
+        }
+    }
+
+    for (const std::pair<uint32_t, int> &leaf : leaves)
+        split(leaf.first, leaf.second, spatialThreshold);
+
+    /* The recorded energy becomes the sampling distribution */
+    for (std::unique_ptr<Leaf> &leaf : m_leaves) {
+        leaf->sampling = leaf->building;
+        leaf->building.refine(leaf->sampling, directionalThreshold, maxDepth);
+        leaf->count = 0;
+    }
+}
+
+NORI_NAMESPACE_END
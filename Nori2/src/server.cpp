@@ -0,0 +1,269 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/server.h>
+#include <nori/parser.h>
+#include <nori/render.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/sampler.h>
+#include <nori/timer.h>
+#include <nori/bitmap.h>
+#include <filesystem/resolver.h>
+#include <set>
+
+NORI_NAMESPACE_BEGIN
+
+/// Run a function while resources are resolved relative to a scene file
+template <typename Func> static auto withSceneDirectory(const filesystem::path &path, Func func) -> decltype(func()) {
+    /* Scenes are only parsed by the thread that reads the commands,
+       which is therefore the only one that touches the file resolver */
+    filesystem::resolver resolver = *getFileResolver();
+    getFileResolver()->prepend(path.parent_path());
+    try {
+        auto result = func();
+        *getFileResolver() = resolver;
+        return result;
+    } catch (...) {
+        *getFileResolver() = resolver;
+        throw;
+    }
+}
+
+/// Serialize a set of overrides (used to identify modified copies of a scene)
+static std::string overrideString(const PropertyOverrides &overrides) {
+    std::string result;
+    for (auto &entry : overrides)
+        result += " " + entry.first + "=" + entry.second;
+    return result;
+}
+
+void RenderServer::run(std::istream &in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> tokens = tokenize(line, " \t");
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+
+        const std::string &command = tokens[0];
+        try {
+            if (command == "render" && tokens.size() >= 2) {
+                Job job;
+                job.sampleCount = 0;
+                PropertyOverrides geometric, replaceable;
+                for (size_t i = 2; i < tokens.size(); ++i) {
+                    size_t pos = tokens[i].find('=');
+                    if (pos == std::string::npos)
+                        throw NoriException("expected a key=value pair, got \"%s\"", tokens[i]);
+                    std::string key = tokens[i].substr(0, pos), value = tokens[i].substr(pos + 1);
+                    if (key == "samples")
+                        job.sampleCount = toUInt(value);
+                    else if (key == "output")
+                        job.outputName = value;
+                    else if (key == "composite")
+                        job.compositeName = value;
+                    else if (key.find('.') == std::string::npos)
+                        throw NoriException("unknown job option \"%s\"", key);
+                    else if (Scene::getReplaceablePath(key).empty())
+                        geometric[key] = value;
+                    else
+                        replaceable[key] = value;
+                }
+                std::shared_ptr<ResidentScene> scene = getScene(tokens[1], geometric);
+
+                /* Re-create the objects whose overrides differ from the ones the
+                   previously queued job of this scene leaves behind */
+                std::set<std::string> paths;
+                for (auto &entry : scene->replaced) {
+                    auto it = replaceable.find(entry.first);
+                    if (it == replaceable.end() || it->second != entry.second)
+                        paths.insert(Scene::getReplaceablePath(entry.first));
+                }
+                for (auto &entry : replaceable) {
+                    auto it = scene->replaced.find(entry.first);
+                    if (it == scene->replaced.end() || it->second != entry.second)
+                        paths.insert(Scene::getReplaceablePath(entry.first));
+                }
+                PropertyOverrides overrides = geometric;
+                overrides.insert(replaceable.begin(), replaceable.end());
+                try {
+                    for (auto &path : paths) {
+                        auto objects = withSceneDirectory(scene->filename, [&] {
+                            return loadObjectsFromXML(scene->filename, path, overrides);
+                        });
+                        job.replacements.insert(job.replacements.end(), objects.begin(), objects.end());
+                    }
+                } catch (...) {
+                    for (auto &entry : job.replacements)
+                        delete entry.second;
+                    throw;
+                }
+                scene->replaced = replaceable;
+                job.id = ++m_jobCount;
+                if (job.outputName.empty()) {
+                    job.outputName = scene->filename;
+                    size_t lastdot = job.outputName.find_last_of(".");
+                    if (lastdot != std::string::npos)
+                        job.outputName.erase(lastdot, std::string::npos);
+                    job.outputName += "_job" + std::to_string(job.id);
+                }
+                reply(tfm::format("queued %i", job.id));
+                submit(scene, job);
+            } else if (command == "load" && tokens.size() == 2) {
+                reply("loaded " + getScene(tokens[1])->filename);
+            } else if (command == "unload" && tokens.size() == 2) {
+                /* Also release all modified copies of the scene */
+                std::string filename = filesystem::path(tokens[1]).make_absolute().str();
+                size_t count = 0;
+                tbb::mutex::scoped_lock lock(m_queueMutex);
+                for (auto it = m_scenes.begin(); it != m_scenes.end(); ) {
+                    if (it->second->filename == filename) {
+                        it = m_scenes.erase(it);
+                        ++count;
+                    } else {
+                        ++it;
+                    }
+                }
+                lock.release();
+                if (count == 0)
+                    throw NoriException("scene \"%s\" is not resident", filename);
+                reply("unloaded " + filename);
+            } else if (command == "list" && tokens.size() == 1) {
+                std::vector<std::string> lines;
+                tbb::mutex::scoped_lock lock(m_queueMutex);
+                for (auto &entry : m_scenes)
+                    lines.push_back("scene " + entry.first);
+                lock.release();
+                for (auto &message : lines)
+                    reply(message);
+                reply(tfm::format("scenes %i", lines.size()));
+            } else if (command == "wait" && tokens.size() == 1) {
+                m_jobs.wait();
+                reply("idle");
+            } else if (command == "quit" && tokens.size() == 1) {
+                break;
+            } else {
+                throw NoriException("invalid command \"%s\"", line);
+            }
+        } catch (const std::exception &e) {
+            reply(std::string("error ") + e.what());
+        }
+    }
+
+    m_jobs.wait();
+}
+
+std::shared_ptr<RenderServer::ResidentScene> RenderServer::getScene(const std::string &filename,
+        const PropertyOverrides &overrides) {
+    filesystem::path path = filesystem::path(filename).make_absolute();
+    std::string key = path.str() + overrideString(overrides);
+
+    {
+        tbb::mutex::scoped_lock lock(m_queueMutex);
+        auto it = m_scenes.find(key);
+        if (it != m_scenes.end())
+            return it->second;
+    }
+
+    std::unique_ptr<NoriObject> root(withSceneDirectory(path, [&] {
+        return loadFromXML(path.str(), overrides);
+    }));
+
+    if (root->getClassType() != NoriObject::EScene)
+        throw NoriException("\"%s\" does not describe a scene", path.str());
+
+    auto scene = std::make_shared<ResidentScene>();
+    scene->filename = path.str();
+    scene->overrides = overrides;
+    scene->root = std::move(root);
+
+    tbb::mutex::scoped_lock lock(m_queueMutex);
+    m_scenes[key] = scene;
+    return scene;
+}
+
+void RenderServer::submit(const std::shared_ptr<ResidentScene> &scene, const Job &job) {
+    tbb::mutex::scoped_lock lock(m_queueMutex);
+    scene->pending.push_back(job);
+    if (!scene->busy) {
+        scene->busy = true;
+        m_jobs.run([this, scene] { processQueue(scene); });
+    }
+}
+
+void RenderServer::processQueue(std::shared_ptr<ResidentScene> scene) {
+    /* Jobs of a scene are serialized through its queue rather than a lock:
+       a thread waiting in a nested parallel_for may steal another job, which
+       would then block on a lock held further up its own stack */
+    while (true) {
+        Job job;
+        {
+            tbb::mutex::scoped_lock lock(m_queueMutex);
+            if (scene->pending.empty()) {
+                scene->busy = false;
+                return;
+            }
+            job = scene->pending.front();
+            scene->pending.pop_front();
+        }
+
+        try {
+            execute(*scene, job);
+        } catch (const std::exception &e) {
+            reply(tfm::format("failed %i %s", job.id, e.what()));
+        }
+    }
+}
+
+void RenderServer::execute(ResidentScene &resident, const Job &job) {
+    Scene *scene = static_cast<Scene *>(resident.root.get());
+    Timer timer;
+
+    for (auto &entry : job.replacements)
+        scene->replaceChild(entry.second, entry.first);
+    const Camera *camera = scene->getCamera();
+
+    /* Apply the per-job settings to a private copy of the sampler */
+    std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+    if (job.sampleCount > 0)
+        sampler->setSampleCount(job.sampleCount);
+
+    std::unique_ptr<ImageBlock> result(createImageBlock(camera));
+    renderScene(scene, *result, sampler.get());
+
+    if (!job.compositeName.empty()) {
+        /* Paste the crop window over a previous full render */
+        Bitmap bitmap(job.compositeName);
+        compositeImage(*result, bitmap);
+        bitmap.saveEXR(job.outputName);
+        bitmap.savePNG(job.outputName);
+    } else {
+        saveImage(*result, job.outputName);
+    }
+
+    reply(tfm::format("done %i %s.exr %s.png %i", job.id, job.outputName,
+        job.outputName, (int) timer.elapsed()));
+}
+
+void RenderServer::reply(const std::string &message) {
+    tbb::mutex::scoped_lock lock(m_outputMutex);
+    m_out << message << std::endl;
+}
+
+NORI_NAMESPACE_END
@@ -39,13 +39,13 @@ float Warp::squareToTentPdf(const Point2f &p) {
 }
 
 Point2f Warp::squareToUniformDisk(const Point2f &sample) {
-    float rho = sqrt(sample.x());
-    float theta = 2 * M_PI * sample.y();
-    return Point2f(rho * cos(theta), rho * sin(theta));
+    float rho = std::sqrt(sample.x());
+    float theta = 2 * M_PIf * sample.y();
+    return Point2f(rho * std::cos(theta), rho * std::sin(theta));
 }
 
 float Warp::squareToUniformDiskPdf(const Point2f &p) {
-    return (p.x() * p.x() + p.y() * p.y() <= 1) ? 1.f / M_PI : 0.0f;
+    return (p.x() * p.x() + p.y() * p.y() <= 1) ? INV_PI : 0.0f;
 }
 
 Point2f Warp::squareToUniformTriangle(const Point2f& sample) {
@@ -65,61 +65,145 @@ float Warp::squareToUniformTrianglePdf(const Point2f& p) {
 }
 
 
-Vector3f Warp::squareToUniformSphere(const Point2f &sample) {
+// Sample x in [0,1] proportionally to the linear function with values a at 0 and b at 1
+static float sampleLinear(float sample, float a, float b) {
+    if (sample == 0 && a == 0)
+        return 0;
+    float x = sample * (a + b) / (a + sqrt((1 - sample) * a * a + sample * b * b));
+    return std::min(x, 0.99999994f);
+}
+
+Point2f Warp::squareToBilinear(const Point2f &sample, const Vector4f &w) {
+    // Sample y from the marginal, then x from the conditional density
+    float y = sampleLinear(sample.y(), w[0] + w[1], w[2] + w[3]);
+    float x = sampleLinear(sample.x(), (1 - y) * w[0] + y * w[2], (1 - y) * w[1] + y * w[3]);
+    return Point2f(x, y);
+}
+
+float Warp::squareToBilinearPdf(const Point2f &p, const Vector4f &w) {
+    if (p.x() < 0 || p.x() > 1 || p.y() < 0 || p.y() > 1)
+        return 0.;
+    if (w.sum() == 0)
+        return 1.;
+    return 4 * ((1 - p.x()) * (1 - p.y()) * w[0] + p.x() * (1 - p.y()) * w[1] +
+                (1 - p.x()) * p.y() * w[2] + p.x() * p.y() * w[3]) / w.sum();
+}
+
+/* The warps below avoid inverse trigonometric functions: the cosine of the
+   polar angle follows algebraically from the sample, and only the azimuth
+   needs a sine and a cosine */
+
+// Direction with the given polar angle and azimuth 2*pi*u
+static inline Vector3f polarToDirection(float cosTheta, float sinTheta, float u) {
+    float phi = 2 * M_PIf * u;
+    return Vector3f(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+}
+
+static inline Vector3f uniformSphere(const Point2f &sample) {
+    float cosTheta = 2 * sample.y() - 1;
+    return polarToDirection(cosTheta, std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta)), sample.x());
+}
+
+static inline Vector3f uniformHemisphere(const Point2f &sample) {
+    float cosTheta = 1 - sample.y();
+    return polarToDirection(cosTheta, std::sqrt(std::max(0.f, 1 - cosTheta * cosTheta)), sample.x());
+}
+
+static inline Vector3f cosineHemisphere(const Point2f &sample) {
+    return polarToDirection(std::sqrt(sample.y()), std::sqrt(1 - sample.y()), sample.x());
+}
+
+static inline float cosineHemispherePdf(const Vector3f &v) {
+    return (v.array() >= -1 && v.array() <= 1).all() && v.z() >= 0 ? v.z() * INV_PI : 0.f;
+}
+
+static inline Vector3f beckmann(const Point2f &sample, float alpha) {
+    // tan^2(theta) = -alpha^2 log(1 - u)
+    float logSample = std::log(1 - sample.y());
+    if (std::isinf(logSample)) logSample = 0;
+    float tanTheta2 = -alpha * alpha * logSample;
+
+    float cosTheta = 1 / std::sqrt(1 + tanTheta2);
+    return polarToDirection(cosTheta, std::sqrt(tanTheta2) * cosTheta, sample.x());
+}
 
-    float theta = 2*M_PIf*sample.x();
-    float phi = acos(2*sample.y()-1);
-    return Vector3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
+static inline float beckmannPdf(const Vector3f &m, float alpha) {
+    if (!(m.array() >= -1 && m.array() <= 1).all() || m.z() <= 0)
+        return 0.f;
 
+    // D(m) cos(theta) with tan^2(theta) = (x^2 + y^2) / z^2 and cos(theta) = z
+    float alpha2 = alpha * alpha;
+    float cosTheta2 = m.z() * m.z();
+    float tanTheta2 = (m.x() * m.x() + m.y() * m.y()) / cosTheta2;
+    return std::exp(-tanTheta2 / alpha2) / (M_PIf * alpha2 * cosTheta2 * m.z());
+}
+
+Vector3f Warp::squareToUniformSphere(const Point2f &sample) {
+    return uniformSphere(sample);
 }
 
 float Warp::squareToUniformSpherePdf(const Vector3f &v) {
 
-    return ((v.array() >= -1).all() && (v.array() <= 1).all()) ? 1.f / (4.f * M_PIf) : 0.0f;
+    return ((v.array() >= -1).all() && (v.array() <= 1).all()) ? INV_FOURPI : 0.0f;
 
 }
 
 Vector3f Warp::squareToUniformHemisphere(const Point2f &sample) {
-
-    float theta = 2*M_PIf*sample.x();
-    float phi = acos(1 - sample.y());
-    return Vector3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
+    return uniformHemisphere(sample);
 }
 
 float Warp::squareToUniformHemispherePdf(const Vector3f &v) {
-    return (v.x() >= -1 && v.x() <= 1 && v.y() <= 1 && v.y() >= -1 && v.z() >= 0 && v.z() <= 1) ? 1.f / (2.f * M_PIf) : 0.0f;
+    return (v.x() >= -1 && v.x() <= 1 && v.y() <= 1 && v.y() >= -1 && v.z() >= 0 && v.z() <= 1) ? INV_TWOPI : 0.0f;
 }
 
 Vector3f Warp::squareToCosineHemisphere(const Point2f &sample) {
-
-    float theta = 2*M_PIf*sample.x();
-    float phi = acos(sqrt(sample.y()));
-    return Vector3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
+    return cosineHemisphere(sample);
 }
 
 float Warp::squareToCosineHemispherePdf(const Vector3f &v) {
-
-    float phi = atan(sqrt(v.x()*v.x() + v.y()*v.y()) / v.z());
-    return (v.array() >= -1 && v.array() <= 1).all() && v.z() >= 0 ? cos(phi) / M_PIf : 0.;
+    return cosineHemispherePdf(v);
 }
 
 Vector3f Warp::squareToBeckmann(const Point2f &sample, float alpha) {
-    float alpha_squared = pow(alpha, 2);
-    float theta = 2*M_PIf*sample.x();
+    return beckmann(sample, alpha);
+}
 
-    float logSample = log(1 - sample.y());
-    if(std::isinf(logSample)) logSample = 0;
+float Warp::squareToBeckmannPdf(const Vector3f &m, float alpha) {
+    return beckmannPdf(m, alpha);
+}
 
-    float phi = atan(sqrt(-alpha_squared*logSample));
-    return Vector3f(cos(theta)*sin(phi), sin(theta)*sin(phi), cos(phi));
+void Warp::squareToUniformSphere(const Point2f *samples, Vector3f *dirs, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        dirs[i] = uniformSphere(samples[i]);
 }
 
-float Warp::squareToBeckmannPdf(const Vector3f &m, float alpha) {
+void Warp::squareToUniformHemisphere(const Point2f *samples, Vector3f *dirs, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        dirs[i] = uniformHemisphere(samples[i]);
+}
+
+void Warp::squareToCosineHemisphere(const Point2f *samples, Vector3f *dirs, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        dirs[i] = cosineHemisphere(samples[i]);
+}
+
+void Warp::squareToCosineHemispherePdf(const Vector3f *dirs, float *pdfs, size_t count) {
+    /* Branch-free form of cosineHemispherePdf(), so that the loop is vectorized */
+    for (size_t i = 0; i < count; ++i) {
+        float x = dirs[i].x(), y = dirs[i].y(), z = dirs[i].z();
+        float inside = (std::abs(x) <= 1) & (std::abs(y) <= 1) & (z >= 0) & (z <= 1);
+        pdfs[i] = inside * std::max(0.f, std::min(z, 1.f)) * INV_PI;
+    }
+}
+
+void Warp::squareToBeckmann(const Point2f *samples, float alpha, Vector3f *dirs, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        dirs[i] = beckmann(samples[i], alpha);
+}
 
-    float alpha_squared = pow(alpha, 2);
-    float phi = atan(sqrt(m.x()*m.x() + m.y()*m.y()) / m.z());
-    float pdf = exp(-pow(tan(phi), 2) / alpha_squared) / ( M_PIf * alpha_squared * pow(cos(phi), 3));
-    return (m.array() >= -1 && m.array() <= 1).all() && m.z() >= 0 ? pdf: 0.;
+void Warp::squareToBeckmannPdf(const Vector3f *dirs, float alpha, float *pdfs, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        pdfs[i] = beckmannPdf(dirs[i], alpha);
 }
 
 NORI_NAMESPACE_END
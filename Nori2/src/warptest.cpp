@@ -91,15 +91,17 @@ struct WarpTest {
     BSDF *bsdf;
     BSDFQueryRecord bRec;
     int xres, yres, res;
+    // Use the batch variants of the warps and densities (where there are any)
+    bool batch;
 
     // Observed and expected frequencies, initialized after calling run().
     std::unique_ptr<double[]> obsFrequencies, expFrequencies;
 
     WarpTest(WarpType warpType_, float parameterValue_, BSDF *bsdf_ = nullptr,
              BSDFQueryRecord bRec_ = BSDFQueryRecord(Vector3f()),
-             int xres_ = kDefaultXres, int yres_ = kDefaultYres)
+             int xres_ = kDefaultXres, int yres_ = kDefaultYres, bool batch_ = false)
         : warpType(warpType_), parameterValue(parameterValue_), bsdf(bsdf_),
-          bRec(bRec_), xres(xres_), yres(yres_) {
+          bRec(bRec_), xres(xres_), yres(yres_), batch(batch_) {
 
         if (warpType != Square && warpType != Disk && warpType != Tent)
             xres *= 2;
@@ -163,13 +165,21 @@ struct WarpTest {
                            (float) (sinTheta * sinPhi),
                            (float) y);
 
+                nori::Vector3f dir(v);
+                float pdf;
                 if (warpType == UniformSphere)
                     return Warp::squareToUniformSpherePdf(v);
                 else if (warpType == UniformHemisphere)
                     return Warp::squareToUniformHemispherePdf(v);
-                else if (warpType == CosineHemisphere)
+                else if (warpType == CosineHemisphere && batch) {
+                    Warp::squareToCosineHemispherePdf(&dir, &pdf, 1);
+                    return pdf;
+                } else if (warpType == CosineHemisphere)
                     return Warp::squareToCosineHemispherePdf(v);
-                else if (warpType == Beckmann)
+                else if (warpType == Beckmann && batch) {
+                    Warp::squareToBeckmannPdf(&dir, parameterValue, &pdf, 1);
+                    return pdf;
+                } else if (warpType == Beckmann)
                     return Warp::squareToBeckmannPdf(v, parameterValue);
                 else if (warpType == MicrofacetBRDF) {
                     BSDFQueryRecord br(bRec);
@@ -264,6 +274,7 @@ struct WarpTest {
         pcg32 rng;
         positions.resize(3, pointCount);
         weights.resize(1, pointCount);
+        std::vector<Point2f> samples(pointCount);
 
         for (int i=0; i<pointCount; ++i) {
             int y = i / sqrtVal, x = i % sqrtVal;
@@ -284,12 +295,46 @@ struct WarpTest {
                     break;
             }
 
-            auto result = warpPoint(sample);
+            samples[i] = sample;
+        }
+
+        if (batch && hasBatchWarp()) {
+            std::vector<nori::Vector3f> dirs(pointCount);
+            warpBatch(samples.data(), dirs.data(), pointCount);
+            for (int i=0; i<pointCount; ++i) {
+                positions.col(i) = dirs[i];
+                weights(0, i) = 1.f;
+            }
+            return;
+        }
+
+        for (int i=0; i<pointCount; ++i) {
+            auto result = warpPoint(samples[i]);
             positions.col(i) = result.first;
             weights(0, i) = result.second;
         }
     }
 
+    bool hasBatchWarp() const {
+        return warpType == UniformSphere || warpType == UniformHemisphere ||
+               warpType == CosineHemisphere || warpType == Beckmann;
+    }
+
+    void warpBatch(const Point2f *samples, nori::Vector3f *dirs, size_t count) const {
+        switch (warpType) {
+            case UniformSphere:
+                Warp::squareToUniformSphere(samples, dirs, count); break;
+            case UniformHemisphere:
+                Warp::squareToUniformHemisphere(samples, dirs, count); break;
+            case CosineHemisphere:
+                Warp::squareToCosineHemisphere(samples, dirs, count); break;
+            case Beckmann:
+                Warp::squareToBeckmann(samples, parameterValue, dirs, count); break;
+            default:
+                throw std::runtime_error("The warp type has no batch variant.");
+        }
+    }
+
     static std::pair<BSDF *, BSDFQueryRecord>
     create_microfacet_bsdf(float alpha, float kd, float bsdfAngle) {
         PropertyList list;
@@ -888,7 +933,10 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    // CLI mode
+    // CLI mode ("--batch" as the last argument tests the batch variants of the warps)
+    bool batch = strcmp(argv[argc - 1], "--batch") == 0;
+    if (batch)
+        --argc;
     WarpType warpType;
     float paramValue, param2Value;
     std::unique_ptr<BSDF> bsdf;
@@ -905,11 +953,14 @@ int main(int argc, char **argv) {
     std::string extra = "";
     if (param2Value > 0)
         extra = tfm::format(", second parameter value = %f", param2Value);
+    if (batch)
+        extra += " (batch variant)";
     std::cout << tfm::format(
         "Testing warp %s, parameter value = %f%s",
          kWarpTypeNames[int(warpType)], paramValue, extra
     ) << std::endl;
-    WarpTest tester(warpType, paramValue, bsdf.get(), bRec);
+    WarpTest tester(warpType, paramValue, bsdf.get(), bRec,
+        WarpTest::kDefaultXres, WarpTest::kDefaultYres, batch);
     auto res = tester.run();
     if (res.first)
         return 0;